@@ -0,0 +1,104 @@
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "memory/RAM.hpp"
+#include "memory/region.hpp"
+
+
+static constexpr U32 ram_bits = U32(1) << 26; // 8 MiB
+static constexpr U32 initial_capacity = 4;
+static constexpr U32 final_capacity = 16 * 1024;
+static constexpr U32 rounds = 50;
+
+using BenchmarkRAM = Mem::RAM<ram_bits, U32, Mem::ImplicitBinaryTreeManagedMemory>;
+
+
+struct Buffer
+{
+    U8* bytes = nullptr;
+    U32 size = 0;
+    U32 capacity = 0;
+};
+
+
+struct GrowthStats
+{
+    U64 copies = 0;
+    U64 copied_bytes = 0;
+    U64 resizes = 0;
+};
+
+
+/**
+ * Appends a byte to the buffer, doubling its capacity when it is full. The buffer is moved to a new allocation only if
+ * it cannot be resized in place, or if 'in_place' is false.
+ */
+void append(BenchmarkRAM& ram, Buffer& buffer, U8 value, bit in_place, GrowthStats& stats)
+{
+    if (buffer.size == buffer.capacity) {
+        const U32 new_capacity = buffer.capacity * 2;
+        if (in_place && ram.try_resize(buffer.bytes, buffer.capacity, new_capacity)) {
+            stats.resizes++;
+        }
+        else {
+            U8* new_bytes = ram.allocate_array<U8>(new_capacity);
+            std::memcpy(new_bytes, buffer.bytes, buffer.size);
+            ram.deallocate_array(buffer.bytes, buffer.capacity);
+            buffer.bytes = new_bytes;
+            stats.copies++;
+            stats.copied_bytes += buffer.size;
+        }
+        buffer.capacity = new_capacity;
+    }
+    buffer.bytes[buffer.size++] = value;
+}
+
+
+/**
+ * Grows 'buffers_count' buffers at the same time, one byte each in turn, from 'initial_capacity' to 'final_capacity'
+ * bytes, and prints the number of copies needed and the time taken.
+ */
+void benchmark(U32 buffers_count, bit in_place)
+{
+    Mem::Region region(ram_bits / 8);
+    BenchmarkRAM ram(region.get_bytes());
+
+    GrowthStats stats;
+    auto start = std::chrono::steady_clock::now();
+    for (U32 round = 0; round < rounds; round++) {
+        std::vector<Buffer> buffers(buffers_count);
+        for (Buffer& buffer : buffers) {
+            buffer.bytes = ram.allocate_array<U8>(initial_capacity);
+            buffer.capacity = initial_capacity;
+        }
+
+        for (U32 i = 0; i < final_capacity; i++) {
+            for (Buffer& buffer : buffers) {
+                append(ram, buffer, U8(i), in_place, stats);
+            }
+        }
+
+        for (Buffer& buffer : buffers) {
+            ram.deallocate_array(buffer.bytes, buffer.capacity);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << buffers_count << " buffers, " << (in_place ? "resize in place" : "copy always  ") << ":\t"
+              << stats.copies / rounds << " copies (" << stats.copied_bytes / rounds << " bytes), "
+              << stats.resizes / rounds << " resizes per round, " << seconds / rounds * 1e3 << " ms per round\n";
+}
+
+
+int main()
+{
+    for (U32 buffers_count : { 1, 4, 16 }) {
+        benchmark(buffers_count, false);
+        benchmark(buffers_count, true);
+    }
+    return 0;
+}
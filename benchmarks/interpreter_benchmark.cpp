@@ -0,0 +1,156 @@
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "CPU/CPU.h"
+#include "CPU/opcodes.h"
+#include "memory/memory_manager.hpp"
+#include "logger.h"
+
+
+static const U32 text_pos = 0x10000;
+static const U32 rom_pos = 0x200000;
+static const U32 ram_pos = rom_pos + Mem::ROM_SIZE;
+
+static const U32 loop_iterations = 1000000;
+
+
+/**
+ * A loop dominated by register arithmetic, comparisons and conditional jumps, like most guest programs.
+ */
+std::vector<Inst> benchmark_program()
+{
+    auto reg_imm = [](U8 opcode, Register reg, U32 imm, bit get_flags, bit write = true) {
+        Inst inst{};
+        inst.opcode = opcode;
+        inst.op1.type = OpType::REG;
+        inst.op1.reg = reg;
+        inst.op1.read = opcode != Opcodes::MOV;
+        inst.op2.type = OpType::IMM;
+        inst.op2.read = true;
+        inst.get_flags = get_flags;
+        inst.write_ret1_to_op1 = write;
+        inst.immediate_value = imm;
+        return inst;
+    };
+
+    auto reg_reg = [](U8 opcode, Register reg_1, Register reg_2, bit get_flags, bit write = true) {
+        Inst inst{};
+        inst.opcode = opcode;
+        inst.op1.type = OpType::REG;
+        inst.op1.reg = reg_1;
+        inst.op1.read = true;
+        inst.op2.type = OpType::REG;
+        inst.op2.reg = reg_2;
+        inst.op2.read = true;
+        inst.get_flags = get_flags;
+        inst.write_ret1_to_op1 = write;
+        return inst;
+    };
+
+    auto jump = [](U8 condition, U32 target) {
+        Inst inst{};
+        inst.opcode = Opcodes::Jcc;
+        inst.op1.type = OpType::IMM_MEM;
+        inst.op1.read = true;
+        inst.get_flags = true;
+        inst.address_value = target;
+        inst.immediate_value = condition;
+        return inst;
+    };
+
+    Inst store_result{};
+    store_result.opcode = Opcodes::MOV;
+    store_result.op1.type = OpType::MEM;
+    store_result.op2.type = OpType::REG;
+    store_result.op2.reg = Register::EAX;
+    store_result.op2.read = true;
+    store_result.write_ret1_to_op1 = true;
+    store_result.address_value = ram_pos;
+
+    Inst halt{};
+    halt.opcode = Opcodes::HLT;
+
+    return {
+        reg_imm(Opcodes::MOV, Register::ECX, loop_iterations, false),
+        reg_imm(Opcodes::MOV, Register::EAX, 0, false),
+        // Loop start
+        reg_reg(Opcodes::ADD, Register::EAX, Register::ECX, true),
+        reg_reg(Opcodes::XOR, Register::EDX, Register::EAX, true),
+        reg_imm(Opcodes::AND, Register::EDX, 0xFF, true),
+        reg_imm(Opcodes::CMP, Register::EDX, 0x80, true, false),
+        jump(0b00010, text_pos + 8), // JB
+        reg_imm(Opcodes::OR, Register::EBX, 1, true),
+        // Jump target
+        reg_imm(Opcodes::SUB, Register::ECX, 1, true),
+        jump(0b00101, text_pos + 2), // JNZ
+        store_result,
+        halt,
+    };
+}
+
+
+Mem::Memory* create_memory(std::vector<Inst>& instructions)
+{
+    return new Mem::Memory(text_pos, instructions.size() * sizeof(Inst), instructions, rom_pos);
+}
+
+
+/**
+ * Runs the program to its end 'runs' times, and prints the best number of guest instructions executed per second.
+ * If 'lazy_flags' is true, the flags are computed lazily and only when they are live, leaving more of the time to the
+ * dispatch of the instructions.
+ */
+template<typename ALU>
+void benchmark(const char* name, bit threaded, bit lazy_flags)
+{
+    static const U32 runs = 5;
+
+    double best_seconds = 0;
+    U32 cycles = 0;
+    for (U32 run = 0; run < runs; run++) {
+        std::vector<Inst> instructions = benchmark_program();
+        Mem::Memory* memory = create_memory(instructions);
+
+        CPU<ALU> cpu(memory);
+        cpu.set_lazy_flags(lazy_flags);
+        cpu.set_flags_liveness(lazy_flags);
+        cpu.startup();
+
+        auto start = std::chrono::steady_clock::now();
+        if (threaded) {
+            cpu.run_threaded();
+        }
+        else {
+            cpu.run();
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        if (run == 0 || seconds < best_seconds) {
+            best_seconds = seconds;
+        }
+        cycles = cpu.get_clock_cycle();
+
+        delete memory;
+    }
+
+    std::cout << name << (lazy_flags ? ", lazy flags" : "") << ":\t" << cycles << " instructions in " << best_seconds
+              << " s, " << cycles / best_seconds / 1e6 << " M instructions/s\n";
+}
+
+
+int main()
+{
+    Logger::set_mode(Logger::Mode::OFF);
+
+    for (bit lazy_flags : { false, true }) {
+        benchmark<CircuitALU>("circuit ALU, run", false, lazy_flags);
+        benchmark<CircuitALU>("circuit ALU, run_threaded", true, lazy_flags);
+        benchmark<NativeALU>("native ALU, run", false, lazy_flags);
+        benchmark<NativeALU>("native ALU, run_threaded", true, lazy_flags);
+    }
+
+    return 0;
+}
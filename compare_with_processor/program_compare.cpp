@@ -11,6 +11,7 @@
 #include "memory/memory_manager.hpp"
 #include "cycle_changes_monitor.h"
 #include "load_program.h"
+#include "program_file.h"
 
 
 static const char memory_map_filename[] = "../../executable_file_data/memory_map.txt";
@@ -49,22 +50,11 @@ void quick_exit_handler()
 }
 
 
-void load_instructions_map(std::map<U32, U32>& instructions_map)
+void set_instructions_map(std::span<const ProgramFile::InstructionsMapEntry> entries,
+                          std::map<U32, U32>& instructions_map)
 {
-    std::ifstream instructions_map_file(instructions_map_filename);
-
-    instructions_map_file >> std::hex;
-    while (instructions_map_file) {
-        U32 address, index;
-        instructions_map_file >> address;
-        instructions_map_file.ignore(1, ',');
-        instructions_map_file >> index;
-
-        if (!instructions_map_file) {
-            break;
-        }
-
-        instructions_map[index] = address;
+    for (const ProgramFile::InstructionsMapEntry& entry : entries) {
+        instructions_map[entry.index] = entry.address;
     }
 }
 
@@ -81,7 +71,7 @@ U32 opsize_to_size(OpSize size)
 }
 
 
-void print_changes(CPU& cpu)
+void print_changes(CPU<>& cpu)
 {
     static ChangesMonitor& changes_monitor = ChangesMonitor::get();
 
@@ -98,7 +88,7 @@ void print_changes(CPU& cpu)
 }
 
 
-void print_flags(CPU& cpu)
+void print_flags(CPU<>& cpu)
 {
 	std::string str = cpu.get_registers().flags.print();
 	std::string_view str_v(str);
@@ -107,7 +97,7 @@ void print_flags(CPU& cpu)
 }
 
 
-void run(CPU& cpu, U32 max_cycles, std::map<U32, U32>& instructions_map)
+void run(CPU<>& cpu, U32 max_cycles, std::map<U32, U32>& instructions_map)
 {
     static ChangesMonitor& changes_monitor = ChangesMonitor::get();
 
@@ -145,7 +135,10 @@ void run(CPU& cpu, U32 max_cycles, std::map<U32, U32>& instructions_map)
 }
 
 
-int main()
+/**
+ * The program is loaded from the program file given as argument, or else from the files of the program.
+ */
+int main(int argc, char** argv)
 {
     signal(SIGSEGV, signal_handler);
     signal(SIGABRT, signal_handler);
@@ -157,10 +150,24 @@ int main()
     std::at_quick_exit(quick_exit_handler);
 
     Mem::Memory* memory;
+    std::map<U32, U32> instructions_map;
     try {
-        memory = load_memory(memory_map_filename,
-                             memory_contents_filename,
-                             instructions_filename);
+        if (argc > 1) {
+            std::unique_ptr<ProgramFile::Reader> reader = ProgramFile::Reader::open(argv[1]);
+            memory = reader ? reader->create_memory() : nullptr;
+            if (memory != nullptr) {
+                set_instructions_map(reader->get_instructions_map(), instructions_map);
+            }
+        }
+        else {
+            memory = load_memory(memory_map_filename,
+                                 memory_contents_filename,
+                                 instructions_filename);
+
+            std::vector<ProgramFile::InstructionsMapEntry> entries;
+            load_instructions_map(instructions_map_filename, entries);
+            set_instructions_map(entries, instructions_map);
+        }
     }
     catch (const std::exception& e) {
         std::cout << "ERROR\n";
@@ -168,8 +175,10 @@ int main()
         return EXIT_FAILURE;
     }
 
-    std::map<U32, U32> instructions_map;
-    load_instructions_map(instructions_map);
+    if (memory == nullptr) {
+        std::cout << "ERROR\nLOADING\n";
+        return EXIT_FAILURE;
+    }
 
     Logger::set_mode(Logger::Mode::MONITOR_CHANGES);
 
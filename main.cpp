@@ -1,6 +1,7 @@
 ﻿
 #include <iostream>
 #include <csignal>
+#include <string>
 
 #include "CPU/CPU.h"
 #include "load_program.h"
@@ -47,14 +48,97 @@ void quick_exit_handler()
 void print_program_instructions(Mem::Memory* memory)
 {
     std::cout << "Instructions:\n";
-    const std::vector<Inst>* insts = memory->get_instructions();
-    print_instructions(insts, 0, insts->size(), memory->text_pos);
+    const std::span<const Inst> insts = memory->get_instructions();
+    print_instructions(insts, 0, insts.size(), memory->text_pos);
     std::cout << "\n";
 }
 
 
-int main()
+void print_usage(const char* program_name)
 {
+    std::cout << "Usage: " << program_name << " [--jit | --interpreter] [--native-alu | --circuit-alu] [--lazy-flags] [--flags-liveness] [--fault-status] [--program <file>]\n"
+              << "  --jit             Compile the hot blocks of the program to native code\n"
+              << "  --interpreter     Interpret all instructions (default)\n"
+              << "  --native-alu      Use the arithmetic of the host (default)\n"
+              << "  --circuit-alu     Use the ALU behaving exactly like the circuit\n"
+              << "  --lazy-flags      Compute the flags only when they are used\n"
+              << "  --flags-liveness  Don't compute the flags overwritten before being used\n"
+              << "  --fault-status    Stop on the faults of the program without throwing exceptions\n"
+              << "  --program <file>  Load the program from a single program file, instead of the files of\n"
+              << "                    '../executable_file_data'\n";
+}
+
+
+struct RunOptions
+{
+    bit use_jit = false;
+    bit use_native_ALU = true;
+    bit use_lazy_flags = false;
+    bit use_flags_liveness = false;
+    bit use_fault_status = false;
+    std::string program_filename;
+};
+
+
+template<typename ALU>
+void run_program(Mem::Memory* memory, const RunOptions& options)
+{
+    CPU<ALU> cpu(memory);
+    cpu.set_jit_enabled(options.use_jit);
+    cpu.set_lazy_flags(options.use_lazy_flags);
+    cpu.set_flags_liveness(options.use_flags_liveness);
+    cpu.set_throw_faults(!options.use_fault_status);
+    if (options.use_flags_liveness) {
+        std::cout << "Flags liveness: " << cpu.get_eliminated_flags_count() << " flag computations eliminated.\n";
+    }
+    cpu.startup();
+    cpu.run(1000);
+
+    if (cpu.get_fault().is_set()) {
+        std::cerr << cpu.get_fault().format() << "\n";
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    RunOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--jit") {
+            options.use_jit = true;
+        }
+        else if (arg == "--interpreter") {
+            options.use_jit = false;
+        }
+        else if (arg == "--native-alu") {
+            options.use_native_ALU = true;
+        }
+        else if (arg == "--circuit-alu") {
+            options.use_native_ALU = false;
+        }
+        else if (arg == "--lazy-flags") {
+            options.use_lazy_flags = true;
+        }
+        else if (arg == "--flags-liveness") {
+            options.use_flags_liveness = true;
+        }
+        else if (arg == "--fault-status") {
+            options.use_fault_status = true;
+        }
+        else if (arg == "--program" && i + 1 < argc) {
+            options.program_filename = argv[++i];
+        }
+        else {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.use_jit && !JIT::is_available()) {
+        std::cerr << "The JIT is not available on this host, using the interpreter.\n";
+    }
+
     signal(SIGSEGV, signal_handler);
     signal(SIGABRT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -67,9 +151,14 @@ int main()
     Mem::Memory* memory;
 
     try {
-        memory = load_memory(memory_map_filename,
-                             memory_contents_filename,
-                             instructions_filename);
+        if (!options.program_filename.empty()) {
+            memory = load_program_file(options.program_filename);
+        }
+        else {
+            memory = load_memory(memory_map_filename,
+                                 memory_contents_filename,
+                                 instructions_filename);
+        }
     }
     catch (const std::exception& e) {
         std::cout << "Program loading failed.\n";
@@ -77,14 +166,22 @@ int main()
         return EXIT_FAILURE;
     }
 
+    if (memory == nullptr) {
+        std::cout << "Program loading failed.\n";
+        return EXIT_FAILURE;
+    }
+
     std::cout << "Program loaded.\n";
 
     print_program_instructions(memory);
 
     try {
-        CPU cpu(memory);
-        cpu.startup();
-        cpu.run(1000);
+        if (options.use_native_ALU) {
+            run_program<NativeALU>(memory, options);
+        }
+        else {
+            run_program<CircuitALU>(memory, options);
+        }
     }
     catch (const std::exception& e) {
         std::cout << "Program failed.\n";
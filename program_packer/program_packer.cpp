@@ -0,0 +1,88 @@
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "memory/memory_manager.hpp"
+#include "load_program.h"
+#include "program_file.h"
+
+
+static const char memory_map_filename[] = "../../executable_file_data/memory_map.txt";
+static const char memory_contents_filename[] = "../../executable_file_data/memory_data.bin";
+static const char instructions_filename[] = "../../executable_file_data/instructions.bin";
+static const char instructions_map_filename[] = "../../executable_file_data/instructions_map.txt";
+
+
+void print_usage(const char* program_name)
+{
+    std::cout << "Usage: " << program_name << " <output> [--symbols <file>]\n"
+              << "       " << program_name << " --verify <program file>\n"
+              << "  Packs the memory map, memory contents, instructions and instructions map files of a program into a\n"
+              << "  single program file.\n"
+              << "  --symbols  Add the symbols of the file, with one 'address name' pair per line, the address in hex\n"
+              << "  --verify   Check the header and the checksums of all sections of a program file\n";
+}
+
+
+bool load_symbols(const std::string& symbols_filename, std::vector<ProgramFile::Symbol>& symbols)
+{
+    std::ifstream symbols_file(symbols_filename);
+    if (!symbols_file) {
+        std::cerr << "Could not open the symbols file '" << symbols_filename << "'\n";
+        return false;
+    }
+
+    ProgramFile::Symbol symbol;
+    while (symbols_file >> std::hex >> symbol.address >> symbol.name) {
+        symbols.push_back(symbol);
+    }
+    return true;
+}
+
+
+int verify(const std::string& program_filename)
+{
+    std::unique_ptr<ProgramFile::Reader> reader = ProgramFile::Reader::open(program_filename);
+    if (!reader) {
+        return EXIT_FAILURE;
+    }
+
+    if (!reader->verify_checksums()) {
+        std::cerr << "The sections of '" << program_filename << "' are corrupted.\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "'" << program_filename << "' is valid, with " << reader->get_sections().size() << " sections.\n";
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc == 3 && std::string(argv[1]) == "--verify") {
+        return verify(argv[2]);
+    }
+    if (argc != 2 && !(argc == 4 && std::string(argv[2]) == "--symbols")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ProgramFile::ProgramContents program;
+    if (!load_program_contents(memory_map_filename, memory_contents_filename, instructions_filename,
+                               instructions_map_filename, program)) {
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 4 && !load_symbols(argv[3], program.symbols)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!ProgramFile::write(argv[1], program)) {
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Packed " << program.instructions.size() << " instructions and "
+              << program.layout.regions.size() << " memory regions into '" << argv[1] << "'.\n";
+    return EXIT_SUCCESS;
+}
@@ -21,10 +21,10 @@
  *
  * This is why it is preferable to use binary trees to parse an integer. 'Flat' implementations are even better.
  */
-namespace ALU
+struct CircuitALU
 {
     template<typename N>
-    constexpr U8 get_last_bit_pos(const OpSize size)
+    static constexpr U8 get_last_bit_pos(const OpSize size)
     {
         U8 last_bit_pos;
         switch (size)
@@ -40,7 +40,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr U8 get_half_bit_pos(const OpSize size)
+    static constexpr U8 get_half_bit_pos(const OpSize size)
     {
         U8 half_bit_pos;
         switch (size)
@@ -56,7 +56,7 @@ namespace ALU
 
 
     template<typename N>
-    consteval U8 get_binary_tree_depth()
+    static consteval U8 get_binary_tree_depth()
     {
         static_assert(std::is_integral<N>::value, "N is not an integral type");
 
@@ -74,7 +74,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr bit check_equal_zero(const N n)
+    static constexpr bit check_equal_zero(const N n)
     {
         static_assert(std::is_integral<N>{}, "check_equal_zero operand must be of integral type");
 
@@ -85,7 +85,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr bit check_different_than_zero(const N n)
+    static constexpr bit check_different_than_zero(const N n)
     {
         static_assert(std::is_integral<N>{}, "check_different_than_zero operand must be of integral type");
 
@@ -96,7 +96,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr bit check_is_negative(const N n, const OpSize size = OpSize::UNKNOWN)
+    static constexpr bit check_is_negative(const N n, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "check_is_negative operand must be of integral type");
 
@@ -112,7 +112,7 @@ namespace ALU
      *	@brief Returns 1 if there is an even number of bits in n, 0 otherwise.
      */
     template<typename N>
-    constexpr bit check_parity(const N n)
+    static constexpr bit check_parity(const N n)
     {
         static_assert(std::is_integral<N>{}, "check_parity operand must be of integral type");
 
@@ -130,7 +130,7 @@ namespace ALU
      * @brief Returns 1 if there is only one set bit in n, else returns 0
      */
     template<typename N>
-    constexpr bit check_power_of_2(const N n)
+    static constexpr bit check_power_of_2(const N n)
     {
         static_assert(std::is_integral<N>{}, "check_power_of_2 operand must be of integral type");
         static_assert(std::is_unsigned<N>{}, "check_power_of_2 operand must be an unsigned type");
@@ -154,7 +154,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr bit compare_equal(const A a, const B b)
+    static constexpr bit compare_equal(const A a, const B b)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_equal operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_equal' must have read least the same bit length than the second");
@@ -177,7 +177,7 @@ namespace ALU
      * @brief Returns a >= b, with an additional flag if a == b.
      */
     template<typename A, typename B>
-    constexpr bit compare_greater_or_equal_with_eq(const A a, const B b, bit& equal)
+    static constexpr bit compare_greater_or_equal_with_eq(const A a, const B b, bit& equal)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_greater_or_equal operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_greater_or_equal' must have read least the same bit length than the second");
@@ -205,7 +205,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr bit compare_greater_or_equal(const A a, const B b)
+    static constexpr bit compare_greater_or_equal(const A a, const B b)
     {
         bit equal = 0;
         return compare_greater_or_equal_with_eq(a, b, equal);
@@ -213,7 +213,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr bit compare_greater(const A a, const B b)
+    static constexpr bit compare_greater(const A a, const B b)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_greater operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_greater' must have read least the same bit length than the second");
@@ -241,7 +241,7 @@ namespace ALU
      *	@brief extend a signed number which has been converted to an unsigned type which is double its size.
      */
     template<typename N>
-    constexpr N sign_extend(const N n, const OpSize prev_size = OpSize::UNKNOWN)
+    static constexpr N sign_extend(const N n, const OpSize prev_size = OpSize::UNKNOWN)
     {
         // TODO : check all usages, we should always use prev_size
         static_assert(std::is_integral<N>{}, "sign_extend operand must be of integral type");
@@ -266,7 +266,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A and_(const A a, const B b)
+    static constexpr A and_(const A a, const B b)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "and operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'and' must have read least the same bit length than the second");
@@ -277,7 +277,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A or_(const A a, const B b)
+    static constexpr A or_(const A a, const B b)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "or operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'or' must have read least the same bit length than the second");
@@ -288,7 +288,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A xor_(const A a, const B b)
+    static constexpr A xor_(const A a, const B b)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "xor operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'xor' must have read least the same bit length than the second");
@@ -299,7 +299,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N not_(const N n)
+    static constexpr N not_(const N n)
     {
         static_assert(std::is_integral<N>{}, "not operand must be of integral type");
 
@@ -309,7 +309,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N rotate_left_carry(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N rotate_left_carry(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "rotate_left_carry operand must be of integral type");
         static_assert(sizeof(N) <= sizeof(U32), "rotate_left_carry does not support rotations of types bigger than 32 bits");
@@ -333,7 +333,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N rotate_right_carry(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N rotate_right_carry(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "rotate_right_carry operand must be of integral type");
         static_assert(sizeof(N) <= sizeof(U32), "rotate_right_carry does not support rotations of types bigger than 32 bits");
@@ -356,7 +356,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N rotate_left(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N rotate_left(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "rotate_left operand must be of integral type");
         static_assert(sizeof(N) <= sizeof(U32), "rotate_left does not support rotations of types bigger than 32 bits");
@@ -379,7 +379,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N rotate_right(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N rotate_right(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "rotate_right operand must be of integral type");
         static_assert(sizeof(N) <= sizeof(U32), "rotate_right does not support rotations of types bigger than 32 bits");
@@ -401,7 +401,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N shift_left(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N shift_left(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         static_assert(std::is_integral<N>{}, "shift_left operand must be of integral type");
 
@@ -421,7 +421,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N shift_left_no_carry(const N n, U8 count, const OpSize size = OpSize::UNKNOWN)
+    static constexpr N shift_left_no_carry(const N n, U8 count, const OpSize size = OpSize::UNKNOWN)
     {
         bit _ = 0;
         return shift_left(n, _, count, size);
@@ -429,7 +429,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N shift_right(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN, const bit keep_sign = false)
+    static constexpr N shift_right(const N n, bit& carry, U8 count, const OpSize size = OpSize::UNKNOWN, const bit keep_sign = false)
     {
         static_assert(std::is_integral<N>{}, "shift_right operand must be of integral type");
 
@@ -453,22 +453,24 @@ namespace ALU
 
 
     template<typename N>
-    constexpr N shift_right_no_carry(const N n, U8 count, const OpSize size = OpSize::UNKNOWN, const bit keep_sign = false)
+    static constexpr N shift_right_no_carry(const N n, U8 count, const OpSize size = OpSize::UNKNOWN, const bit keep_sign = false)
     {
         bit carry = 0;
-        return ALU::shift_right(n, carry, count, size, keep_sign);
+        return shift_right(n, carry, count, size, keep_sign);
     }
 
 
     template<typename N>
-    constexpr U8 get_first_set_bit_index(const N n, bit& is_zero)
+    static constexpr U8 get_first_set_bit_index(const N n, bit& is_zero)
     {
         static_assert(std::is_integral<N>{}, "get_first_set_bit_index operand must be of integral type");
 
+        constexpr U8 loops_count = get_binary_tree_depth<N>() - 1;
+
         is_zero = true;
         U8 index = 0;
         typename std::make_unsigned<N>::type mask = N(-1);
-        for (int i = sizeof(N) + 3 - 2; i >= 0; i--) {
+        for (int i = loops_count; i >= 0; i--) {
             // equivalent to 'mask >>= (1 << i)' but without compiler warnings
             mask = (decltype(mask)) (U64(mask) >> (1 << i));
             index <<= 1;
@@ -499,7 +501,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr U8 get_last_set_bit_index(const N n, bit& is_zero)
+    static constexpr U8 get_last_set_bit_index(const N n, bit& is_zero)
     {
         static_assert(std::is_integral<N>{}, "get_last_set_bit_index operand must be of integral type");
 
@@ -537,7 +539,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr U8 get_last_set_bit_index_no_zero(const N n)
+    static constexpr U8 get_last_set_bit_index_no_zero(const N n)
     {
         bit _ = 0;
         return get_last_set_bit_index(n, _);
@@ -545,7 +547,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr bit get_and_set_bit_at(N& n, const U8 pos, const bit val, const bool _no_set = false)
+    static constexpr bit get_and_set_bit_at(N& n, const U8 pos, const bit val, const bool _no_set = false)
     {
         static_assert(std::is_integral<N>{}, "get_and_set_bit_at operand must be of integral type");
         static_assert(sizeof(N) <= sizeof(U32), "get_and_set_bit_at operand must be a 32 bit type or smaller");
@@ -594,7 +596,7 @@ namespace ALU
 
 
     template<typename N>
-    constexpr bit get_bit_at(const N n, const U8 pos)
+    static constexpr bit get_bit_at(const N n, const U8 pos)
     {
         // 'get_bit_at' and 'get_and_set_bit_at' share the same circuit,
         // because they are very similar, and not much used.
@@ -610,7 +612,7 @@ namespace ALU
      * The algorithm used is the same as the usual pen and paper addition.
      */
     template<typename A, typename B>
-    constexpr A add(const A a, const B b, bit& carry)
+    static constexpr A add(const A a, const B b, bit& carry)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "Add operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'add' must have read least the same bit length than the second");
@@ -634,7 +636,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A add_no_carry(const A a, const B b)
+    static constexpr A add_no_carry(const A a, const B b)
     {
         bit carry = 0;
         return add(a, b, carry);
@@ -646,7 +648,7 @@ namespace ALU
      * This can be interpreted as negating it.
      */
     template<typename N>
-    constexpr N negate(const N n)
+    static constexpr N negate(const N n)
     {
         static_assert(std::is_integral<N>{}, "negate operand must be of integral type");
 
@@ -671,24 +673,24 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A sub(const A a, const B b, bit& carry)
+    static constexpr A sub(const A a, const B b, bit& carry)
     {
-        B b_ = ALU::negate(b);
-        return ALU::add(a, b_, carry);
+        B b_ = negate(b);
+        return add(a, b_, carry);
     }
 
 
     template<typename A, typename B>
-    constexpr A sub_no_carry(const A a, const B b)
+    static constexpr A sub_no_carry(const A a, const B b)
     {
         bit carry = 0;
-        B b_ = ALU::negate(b);
-        return ALU::add(a, b_, carry);
+        B b_ = negate(b);
+        return add(a, b_, carry);
     }
 
 
     template<typename N>
-    constexpr N abs(const N n)
+    static constexpr N abs(const N n)
     {
         static_assert(std::is_integral<N>{}, "abs operand must be of integral type");
 
@@ -713,7 +715,7 @@ namespace ALU
      *  are made positive, then multiplied, then the sign is added back
      */
     template<typename A, typename B>
-    constexpr A multiply(const A a, const B b, bit& overflow)
+    static constexpr A multiply(const A a, const B b, bit& overflow)
     {
         static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "Multiply operands must be of integral type");
         static_assert(sizeof(A) >= sizeof(B), "First operand of 'multiply' must have read least the same bit length than the second");
@@ -739,7 +741,7 @@ namespace ALU
 
 
     template<typename A, typename B>
-    constexpr A multiply_no_overflow(const A a, const B b)
+    static constexpr A multiply_no_overflow(const A a, const B b)
     {
         bit overflow = 0;
         return multiply(a, b, overflow);
@@ -751,7 +753,7 @@ namespace ALU
      * If the divisor is zero, there is no division and the quotient and remainder are zero.
      */
     template<typename N, typename D>
-    constexpr void unsigned_divide(const N n, const D d, N& q, N& r, bit& divByZero)
+    static constexpr void unsigned_divide(const N n, const D d, N& q, N& r, bit& divByZero)
     {
         static_assert(std::is_integral<N>{} && std::is_integral<D>{}, "Division operands must be of integral type");
         static_assert(std::is_unsigned<N>{} && std::is_unsigned<D>{}, "Unsigned Division operands must be unsigned");
@@ -844,7 +846,7 @@ namespace ALU
 
 
     template<typename N, typename D>
-    constexpr void signed_divide(const N n, const D d, N& q, N& r, bit& divByZero)
+    static constexpr void signed_divide(const N n, const D d, N& q, N& r, bit& divByZero)
     {
         static_assert(std::is_integral<N>{} && std::is_integral<D>{}, "Division operands must be of integral type");
 
@@ -871,4 +873,10 @@ namespace ALU
             }
         }
     }
-}
+};
+
+
+/**
+ * The ALU used by default, which behaves exactly like the circuit.
+ */
+using ALU = CircuitALU;
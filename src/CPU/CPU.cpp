@@ -8,17 +8,25 @@
 #include "opcodes.h"
 
 
-CPU::CPU(Mem::Memory* memory)
+template<typename ALU>
+CPU<ALU>::CPU(Mem::Memory* memory)
 	: memory(memory)
-{ }
+{
+    decode_instructions();
+    build_basic_blocks();
+    fuse_compare_jumps();
+}
 
 
-void CPU::startup()
+template<typename ALU>
+void CPU<ALU>::startup()
 {
     registers.complete_reset();
 
     clock_cycle_count = 0;
     halted = false;
+    pending_flags.mask = 0;
+    fault.clear();
 
     // Setup CR0
     CR0 control_register = registers.get_CR0();
@@ -37,249 +45,210 @@ void CPU::startup()
 
 /**
  * Executes the instructions until the end of the instructions list or the maximum number of cycles is reached.
+ *
+ * Instructions are executed block by block: the instructions of a basic block always follow each other, so they are
+ * executed without looking up the next instruction. The next block is found from the links of the previous one.
  */
-void CPU::run(size_t max_cycles)
+template<typename ALU>
+void CPU<ALU>::run(size_t max_cycles)
 {
-	while (!halted) {
-		new_clock_cycle();
-        Logger::log() << "Cycle " << clock_cycle_count << "\n";
+	const BasicBlock* block = nullptr;
+
+	// Instructions watched for execution are checked one by one: they are not fused nor compiled
+	const bit watch_exec = memory->has_exec_watchpoints();
+	U32 resume_index = resume_after_watchpoint();
+
+	// Fused instructions are not printed separately, they are executed only when nothing is logged
+	const bit use_fusion = macro_fusion && !watch_exec && Logger::get_mode() == Logger::Mode::OFF;
+
+	while (!halted && !fault.is_set()) {
+		U32 index = registers.EIP - memory->text_pos;
+		block = get_next_block(block, index);
+
+		LOG_EVENT(LogEvent::Block, clock_cycle_count + 1, registers.EIP);
 		try {
-			execute_instruction(); // handles the incrementation of the EIP register
+			if (!watch_exec && run_compiled_block(block, index, max_cycles)) {
+				index = block->end;
+			}
+
+			for (; index < block->end; index++) {
+				if (watch_exec) {
+					if (index != resume_index && stop_at_exec_watchpoint(index)) {
+						break;
+					}
+					resume_index = no_resume_index;
+				}
+
+				const DecodedInst& decoded = decoded_instructions[index];
+				new_clock_cycle();
+				execute_decoded_instruction(decoded); // handles the incrementation of the EIP register
+
+				if (decoded.dispatch == Dispatch::FusedPair && use_fusion && clock_cycle_count < max_cycles
+					&& !fault.is_set()) {
+					// The jump ends the block
+					index++;
+					new_clock_cycle();
+					execute_direct_jcc(decoded_instructions[index]);
+				}
+
+				if (halted || fault.is_set() || clock_cycle_count >= max_cycles) {
+					break;
+				}
+			}
 		}
 		catch (ExceptionWithMsg& e) {
-            Logger::err() << e.what() << "\n";
+            LOG_ERROR(e.what() << "\n");
 			break;
 		}
 
 		if (clock_cycle_count >= max_cycles) {
-            Logger::log() << "Max cycles reached. Interrupting program.\n";
+            LOG_DEBUG("Max cycles reached. Interrupting program.\n");
 			break;
 		}
 	}
 
-    Logger::log() << "Program finished in " << clock_cycle_count << " cycles.\n";
+    LOG_DEBUG("Program finished in " << clock_cycle_count << " cycles.\n");
 }
 
 
 /**
- * Utility to keep track of how many cycles elapsed
+ * Clears the hit of a watchpoint which stopped the previous run. If it was an execution watchpoint, the index of its
+ * instruction is returned, as it must be executed this time. Otherwise returns 'no_resume_index'.
  */
-void CPU::new_clock_cycle()
+template<typename ALU>
+U32 CPU<ALU>::resume_after_watchpoint()
 {
-	clock_cycle_count++;
-	// TODO : reset the branch monitor here
+	if (fault.kind != FaultKind::Watchpoint) {
+		return no_resume_index;
+	}
+
+	const U32 index = fault.watchpoint.kind == Mem::WATCH_EXEC ? fault.watchpoint.instruction : no_resume_index;
+	fault.clear();
+	return index;
 }
 
 
 /**
- * Returns the size of an operand, using the size overrides of the instruction.
+ * Stops the execution before the instruction if it is watched for execution. Returns true if it was.
  */
-constexpr OpSize CPU::get_size(bit size_override, bit byte_size_override)
+template<typename ALU>
+bit CPU<ALU>::stop_at_exec_watchpoint(U32 index)
 {
-	if (byte_size_override) {
-		return OpSize::B;
-	}
-	else if (size_override) {
-		return OpSize::W;
-	}
-	else {
-		return OpSize::DW;
+	memory->check_execution(memory->text_pos + index, fault);
+	if (fault.is_set()) {
+		fault.watchpoint.instruction = index;
+		return true;
 	}
+	return false;
 }
 
 
 /**
- * Executes the instruction read the address pointed by the EIP.
- * Handles the common part of all instructions, which is operands fetching, flags update, and writing the results to their destination.
- * Actual instruction logic is delegated to CPU::execute_arithmetic_instruction(), CPU::execute_non_arithmetic_instruction() and
- * CPU::execute_non_arithmetic_instruction_with_state_machine().
+ * Enables or disables the JIT. Blocks are compiled once they were entered more than 'threshold' times.
+ * Does nothing if the JIT is not available on this host.
  */
-void CPU::execute_instruction()
+template<typename ALU>
+void CPU<ALU>::set_jit_enabled(bit enabled, U32 threshold)
 {
-    const Inst& inst = memory->fetch_instruction(registers.EIP);
-    current_instruction = &inst;
+	if (!enabled || !JIT::is_available()) {
+		jit.reset();
+		return;
+	}
 
-    if (Logger::get_mode() == Logger::Mode::DEBUG) {
-        print_instruction(registers.EIP, inst);
-    }
+	if (!jit) {
+		jit = std::make_unique<JIT>(*this, basic_blocks.size());
+	}
+	jit->set_threshold(threshold);
+}
 
-    InstData data{};
 
-	if (inst.compute_address) {
-        if (inst.op1.type == OpType::MEM) {
-            data.address = compute_address(static_cast<U8>(inst.op1.reg));
-        }
-        else if (inst.op2.type == OpType::MEM) {
-            data.address = compute_address(static_cast<U8>(inst.op2.reg));
-        }
-        else {
-            throw BadInstruction("'compute_address' is true, but there is no memory operand", registers.EIP);
-        }
-	}
-	else {
-		data.address = inst.address_value;
+/**
+ * Executes the block with the JIT, if it is enabled and the block is compiled. Returns true if the block was executed.
+ *
+ * Compiled blocks are always executed from their first instruction to their end, therefore the block is interpreted if
+ * the maximum number of cycles would be reached in the middle of it. The JIT is also not used when logging, as the
+ * compiled code doesn't print the instructions nor monitor the changes.
+ */
+template<typename ALU>
+bit CPU<ALU>::run_compiled_block(const BasicBlock* block, U32 index, size_t max_cycles)
+{
+	if (!jit || index != block->first || Logger::get_mode() != Logger::Mode::OFF
+		|| clock_cycle_count + size_t(block->end - block->first) > max_cycles) {
+		return false;
 	}
 
-	// Segment overrides for the operand and are always set to 32 bits, so they are ignored.
-	OpSize operand_size = get_size(inst.operand_size_override, inst.operand_byte_size_override);
+	JIT::BlockFunction function = jit->get_block_function(*this, block - basic_blocks.data());
+	if (function == nullptr) {
+		return false;
+	}
 
-    // TODO : missing data.op3 value
+	// The compiled code works directly on the flags register
+	materialize_flags();
 
-	bit immediate_loaded = false;
-	
-	// Read the operands
-	if (inst.op1.read) {
-        switch(inst.op1.type) {
-		case OpType::REG:
-			if (is_special_register(inst.op1.reg)) {
-				if (inst.op1.reg <= Register::GS) {
-					// All segment registers have a fixed length
-					data.op1_size = OpSize::W;
-				}
-				else {
-					// Control registers
-					data.op1_size = OpSize::DW;
-				}
-			}
-			else {
-				data.op1_size = operand_size;
-			}
-			
-			data.op1 = registers.read(inst.op1.reg, data.op1_size);
-			break;
+	if (function(this) != 0 && !fault.is_set()) {
+		jit->rethrow_pending_exception();
+	}
+	return true;
+}
 
-		case OpType::MEM:
-			data.op1_size = operand_size;
-            data.op1 = memory->read(data.address, data.op1_size);
-			break;
 
-		case OpType::IMM:
-			data.op1_size = operand_size;
-			data.op1 = inst.immediate_value;
-			immediate_loaded = true;
-			break;
+/**
+ * Executes the instruction read the address pointed by the EIP.
+ * Handles the common part of all instructions, which is operands fetching, flags update, and writing the results to their destination.
+ * Actual instruction logic is delegated to CPU::execute_arithmetic_instruction(), CPU::execute_non_arithmetic_instruction() and
+ * CPU::execute_non_arithmetic_instruction_with_state_machine().
+ */
+template<typename ALU>
+void CPU<ALU>::execute_instruction()
+{
+    execute_decoded_instruction(fetch_decoded_instruction(registers.EIP));
+}
 
-        case OpType::IMM_MEM:
-            data.op1_size = operand_size;
-            data.op1 = inst.address_value;
-			break;
-		}
-	}
 
-	if (inst.op2.read) {
-        switch(inst.op2.type) {
-		case OpType::REG:
-			if (is_special_register(inst.op2.reg)) {
-				if (inst.op2.reg <= Register::GS) {
-					// All segment registers have a fixed length
-					data.op2_size = OpSize::W;
-				}
-				else {
-					// Control registers
-					data.op2_size = OpSize::DW;
-				}
-			}
-			else {
-				data.op2_size = operand_size;
-			}
-			
-			data.op2 = registers.read(inst.op2.reg, data.op2_size);
-			break;
+/**
+ * Executes a pre-decoded instruction. All decisions which depend only on the instruction itself (operand types, sizes,
+ * opcode...) were already made by CPU::decode_instruction().
+ */
+template<typename ALU>
+void CPU<ALU>::execute_decoded_instruction(const DecodedInst& decoded)
+{
+    if (Logger::is_debug()) {
+        print_instruction(registers.EIP, *decoded.inst);
+    }
 
-		case OpType::MEM:
-			data.op2_size = operand_size;
-			data.op2 = memory->read(data.address, data.op2_size);
-			break;
+    execute_handlers(decoded);
+}
 
-		case OpType::IMM:
-			data.op2_size = operand_size;
-			data.op2 = inst.immediate_value;
-			immediate_loaded = true;
-			break;
 
-        case OpType::IMM_MEM:
-            data.op2_size = operand_size;
-			data.op2 = inst.address_value;
-            break;
-		}
-	}
-	
-	if (!immediate_loaded) {
-		// Load the immediate value only if it has not been stored in an operand already
-		data.imm = inst.immediate_value;
-	}
-	
-	// Get the flags registers if needed
-	EFLAGS flags;
-	if (inst.get_flags) {
-	    flags = registers.flags;
-	}
-	
-	// Execute the instruction
-	U32 return_value = 0;
-	U32 return_value_2 = 0;
-	if (inst.opcode & Opcodes::not_arithmetic) {
-		// Non-trivial op
-		data.op_size = operand_size;
-
-		if (inst.opcode & Opcodes::state_machine) {
-			// Include all state machine, jump and string instructions
-			execute_non_arithmetic_instruction_with_state_machine(inst.opcode, data, flags, return_value);
-		}
-		else {
-			execute_non_arithmetic_instruction(inst.opcode, data, flags, return_value, return_value_2);
-		}
-	}
-	else {
-		execute_arithmetic_instruction(inst.opcode, data, flags, return_value, return_value_2);
-	}
-	
-	if (inst.get_flags) {
-		// write the new flags
-		registers.flags.value = flags.value;
-	}
+/**
+ * Executes a Jcc to a static address with a valid condition. The operands and the state machine are skipped, with the
+ * same result.
+ */
+template<typename ALU>
+void CPU<ALU>::execute_direct_jcc(const DecodedInst& jump)
+{
+    const Inst& inst = *jump.inst;
+    current_instruction = &inst;
+    current_live_flags = jump.live_flags;
 
-	// Write the output of the instruction to its destination
-	if (inst.write_ret1_to_op1) {
-		switch (inst.op1.type) {
-		case OpType::REG:
-			registers.write(inst.op1.reg, return_value);
-			break;
-		case OpType::MEM:
-            memory->write(data.address, return_value, data.op1_size);
-			break;
-		default:
-			break;
-		}
-	}
+    if (pending_flags.mask & jump.flags_to_materialize) {
+        materialize_flags(jump.flags_to_materialize);
+    }
 
-    if (inst.write_ret2_to_register) {
-        if (inst.scale_output_override) {
-            registers.write(inst.register_out, return_value_2, data.op1_size);
-        }
-        else {
-            registers.write(inst.register_out, return_value_2);
-        }
+    if (check_jump_condition(U8(inst.immediate_value), registers.flags)) {
+        registers.write_EIP(inst.address_value);
+    }
+    else {
+        registers.write_EIP(ALU::add_no_carry(registers.EIP, 1));
     }
-    else if (inst.write_ret2_to_op2) {
-		switch (inst.op2.type) {
-		case OpType::REG:
-			registers.write(inst.op2.reg, return_value_2);
-			break;
-		case OpType::MEM:
-            memory->write(data.address, return_value_2, data.op2_size);
-			break;
-		default:
-			break;
-		}
-	}
 }
 
 
 /**
  * Computes the effective address of the address operand of the current instruction.
  */
-U32 CPU::compute_address(U8 register_field) const
+template<typename ALU>
+U32 CPU<ALU>::compute_address(U8 register_field) const
 {
 	U32 address = current_instruction->address_value;
 
@@ -309,12 +278,59 @@ U32 CPU::compute_address(U8 register_field) const
 }
 
 
+/**
+ * Reads from memory, storing the fault instead of throwing it if faults are not thrown. Watchpoint hits are always
+ * stored.
+ */
+template<typename ALU>
+U32 CPU<ALU>::memory_read(U32 address, OpSize size) const
+{
+    if (throw_faults) {
+        Fault access_fault;
+        const U32 value = memory->read(address, size, access_fault);
+        check_access_fault(access_fault);
+        return value;
+    }
+    return memory->read(address, size, fault);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::memory_write(U32 address, U32 value, OpSize size)
+{
+    if (throw_faults) {
+        Fault access_fault;
+        memory->write(address, value, size, access_fault);
+        check_access_fault(access_fault);
+    }
+    else {
+        memory->write(address, value, size, fault);
+    }
+}
+
+
+/**
+ * Throws the fault of a memory access, or keeps it if it is the first watchpoint hit of the instruction.
+ */
+template<typename ALU>
+void CPU<ALU>::check_access_fault(const Fault& access_fault) const
+{
+    if (access_fault.is_error()) {
+        access_fault.raise();
+    }
+    else if (access_fault.is_set() && !fault.is_set()) {
+        fault = access_fault;
+    }
+}
+
+
 /**
  * Push a value to the stack, of variable size.
  * @param value The value to push
  * @param size The size of the value
  */
-void CPU::push(U32 value, OpSize size)
+template<typename ALU>
+void CPU<ALU>::push(U32 value, OpSize size)
 {
     // TODO : move this function to Mem::Stack
 	U32 esp = registers.read(Register::ESP);
@@ -339,9 +355,9 @@ void CPU::push(U32 value, OpSize size)
 	
 	registers.write(Register::ESP, esp);
 
-    Logger::log() << "Pushed 0x" << std::hex << value << " at 0x" << esp << std::dec << std::endl;
+    LOG_EVENT(LogEvent::Push, value, esp);
 
-    memory->write(esp, value, size);
+    memory_write(esp, value, size);
 }
 
 
@@ -349,7 +365,8 @@ void CPU::push(U32 value, OpSize size)
  * Pop a value from the stack.
  * @param size The size of the value.
  */
-U32 CPU::pop(OpSize size)
+template<typename ALU>
+U32 CPU<ALU>::pop(OpSize size)
 {
     // TODO : move this function to Mem::Stack
 	U32 esp = registers.read(Register::ESP);
@@ -358,9 +375,12 @@ U32 CPU::pop(OpSize size)
 		size = get_size(current_instruction->operand_size_override, 0);
 	}
 
-    U32 val = memory->read(esp, size);
+    U32 val = memory_read(esp, size);
+    if (fault.is_set()) {
+        return 0;
+    }
 
-    Logger::log() << "Popped 0x" << std::hex << val << " at 0x" << esp << std::dec << std::endl;
+    LOG_EVENT(LogEvent::Pop, val, esp);
 
 	switch (size)
 	{
@@ -389,7 +409,8 @@ U32 CPU::pop(OpSize size)
  *
  * @param interrupt Interrupt info
  */
-void CPU::interrupt(Interrupts::Interrupt interrupt, U8 error_code)
+template<typename ALU>
+void CPU<ALU>::interrupt(Interrupts::Interrupt interrupt, U8 error_code)
 {
 	U8 index = 0;
 	bit repeat = 0, incr_index = 0;
@@ -453,11 +474,37 @@ void CPU::interrupt(Interrupts::Interrupt interrupt, U8 error_code)
 }
 
 
+/**
+ * Returns true if the access is entirely in the IO buffer. Otherwise, the fault is thrown or stored like the ones of
+ * the memory accesses.
+ */
+template<typename ALU>
+bit CPU<ALU>::check_io_access(U8 io_address, OpSize size)
+{
+    if (U32(io_address) + Mem::get_bytes_count(size) <= io.get_size()) {
+        return true;
+    }
+
+    const Fault access_fault = Fault::memory_access("Address out of bounds.", io_address);
+    if (throw_faults) {
+        check_access_fault(access_fault);
+    }
+    else {
+        fault = access_fault;
+    }
+    return false;
+}
+
+
 /**
  * Read bytes from the IO buffer.
  */
-U32 CPU::read_io(U8 io_address, OpSize size)
+template<typename ALU>
+U32 CPU<ALU>::read_io(U8 io_address, OpSize size)
 {
+    if (!check_io_access(io_address, size)) {
+        return 0;
+    }
     return io.read(io_address, size);
 }
 
@@ -465,7 +512,14 @@ U32 CPU::read_io(U8 io_address, OpSize size)
 /**
  * Write bytes to the IO buffer.
  */
-void CPU::write_io(U8 io_address, U32 value, OpSize size)
+template<typename ALU>
+void CPU<ALU>::write_io(U8 io_address, U32 value, OpSize size)
 {
-    io.write(io_address, value, size);
+    if (check_io_access(io_address, size)) {
+        io.write(io_address, value, size);
+    }
 }
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
@@ -1,43 +1,282 @@
 ﻿#pragma once
 
+#include <array>
 #include <stack>
 #include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #include "../data_types.h"
+#include "../ALU.hpp"
+#include "../NativeALU.hpp"
 #include "instructions.h"
 #include "registers.h"
 #include "memory/memory_manager.hpp"
-#include "memory/RAM.hpp"
-#include "memory/ROM.hpp"
-#include "memory/stack.hpp"
 #include "memory/buffer.hpp"
 #include "exceptions.h"
+#include "fault.h"
 #include "interrupts.h"
+#include "JIT.h"
 
 
+#if defined(__GNUC__) || defined(__clang__)
+#define MCX86_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define MCX86_ALWAYS_INLINE inline
+#endif
+
+
+/**
+ * The CPU, executing the instructions using the given ALU implementation: CircuitALU behaves exactly like the
+ * circuit, while NativeALU gives the same results using the arithmetic of the host.
+ */
+template<typename ALU = CircuitALU>
 class CPU
 {
+	friend class JIT;
+
 	Registers registers;
 
     Mem::Memory* const memory;
 
-    Mem::Buffer<128, U8> io = Mem::Buffer<128, U8>(new U8[128]{});
+    static constexpr U32 IO_SIZE = 128;
+    Mem::Buffer<IO_SIZE, U8> io = Mem::Buffer<IO_SIZE, U8>(new U8[IO_SIZE]{});
 
 	Interrupts::InterruptDescriptorTable<64>* interrupts_table = nullptr; // TODO
 
 	const Inst* current_instruction = nullptr;
 
+	/*
+	 * Pre-decoded instructions.
+	 *
+	 * Each instruction of the program is decoded once when the CPU is created: the type of the operands, their sizes
+	 * and the opcode are resolved into handlers, so that executing an instruction is only a matter of calling them in
+	 * order. Each opcode has its own execution handler, an instance of the function of its category for this opcode.
+	 */
+	using AddressHandler = U32 (CPU::*)(const Inst& inst) const;
+	using ReadHandler = U32 (CPU::*)(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+	using ExecuteHandler = void (CPU::*)(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
+	using WriteHandler = void (CPU::*)(const Inst& inst, const InstData& data, U32 value);
+
+	/**
+	 * How the instruction is executed by the run loops. All instructions can be executed by the generic path, the
+	 * others are shortcuts for common instructions which don't need to read their operands.
+	 */
+	enum class Dispatch : U8
+	{
+		Generic,   // CPU::execute_decoded_instruction()
+		FusedPair, // CMP, TEST, SUB or DEC followed by a direct Jcc, see CPU::fuse_compare_jumps()
+		DirectJcc, // Jcc to a static address with a valid condition, see CPU::execute_direct_jcc()
+		DirectJmp, // JMP to a static address
+	};
+
+	struct DecodedInst
+	{
+		const Inst* inst;
+
+		AddressHandler get_address;
+		ReadHandler read_op1;
+		ReadHandler read_op2;
+		ExecuteHandler execute;
+		WriteHandler write_ret1;
+		WriteHandler write_ret2;
+
+		OpSize operand_size;
+		OpSize op1_size;
+		OpSize op2_size;
+		bit load_immediate;
+
+		U32 flags_to_materialize; // Pending flags which must be computed before the instruction is executed
+		U32 live_flags; // Status flags which may be read after the instruction before being overwritten
+		Dispatch dispatch;
+	};
+
+	std::vector<DecodedInst> decoded_instructions;
+
+	/*
+	 * Basic blocks of the program.
+	 *
+	 * Since EIP is an index into the instructions, the program is split at the instructions which can change the
+	 * control flow and at the targets of the jumps. Each block is executed as a straight-line sequence, and its exits
+	 * are chained to the blocks of its static jump target and of the following instruction.
+	 */
+	struct BasicBlock
+	{
+		U32 first; // Index of the first instruction of the block
+		U32 end;   // Index after the last instruction of the block
+
+		const BasicBlock* taken; // Block of the static target of the last instruction, if any
+		const BasicBlock* next;  // Block following this one, if any
+	};
+
+	std::vector<BasicBlock> basic_blocks;
+	std::vector<U32> instructions_blocks; // Index of the block containing each instruction
+
+	bit macro_fusion = true;
+	size_t fused_pairs_count = 0;
+
+	std::unique_ptr<JIT> jit; // Only present if enabled
+
+	/*
+	 * Lazy flags.
+	 *
+	 * Most flags written by an instruction are overwritten by the next one before being read. In lazy mode, the most
+	 * common flag-producing instructions only record their operands and result, and the flags which depend on them
+	 * are computed only when an instruction reads them, or when the registers are inspected.
+	 * The carry flag and the flags which are only set or cleared are always updated immediately.
+	 */
+	enum class FlagsOp : U8
+	{
+		Arithmetic, // OF, SF, ZF, PF and AF, like EFLAGS::update_status_flags
+		Logic,      // SF, ZF and PF
+	};
+
+	struct PendingFlags
+	{
+		U32 mask = 0; // Flags of 'registers.flags' which are not up to date
+		FlagsOp op;
+		U32 op1, op2, result;
+		OpSize op1_size, op2_size, ret_size;
+		bit is_sub;
+	};
+
+	static constexpr U32 arithmetic_lazy_flags = EFLAGS::OF | EFLAGS::SF | EFLAGS::ZF | EFLAGS::PF | EFLAGS::AF;
+	static constexpr U32 logic_lazy_flags = EFLAGS::SF | EFLAGS::ZF | EFLAGS::PF;
+
+	bit lazy_flags = false;
+	PendingFlags pending_flags;
+
+	/*
+	 * Flags liveness.
+	 *
+	 * A status flag written by an instruction is dead if all paths from the instruction overwrite it before reading
+	 * it. The analysis is made once on the basic blocks, and the instructions then compute only their live flags.
+	 * Dead flags keep their previous value: the registers only match the eager execution at the points where the
+	 * flags are live, like at the end of the program.
+	 */
+	static constexpr U32 status_flags = EFLAGS::CF | EFLAGS::PF | EFLAGS::AF | EFLAGS::ZF | EFLAGS::SF | EFLAGS::OF;
+
+	bit flags_liveness = false;
+	U32 current_live_flags = status_flags;
+	size_t eliminated_flags_count = 0;
+
+	/*
+	 * Faults of the guest program (invalid memory accesses and processor exceptions) are thrown as exceptions by
+	 * default. Otherwise they are stored in 'fault', and the execution stops after the faulting instruction, with the
+	 * same state as when the exception is thrown.
+	 * Watchpoint hits of the memory are never thrown: the execution stops after the instruction which made the access,
+	 * or before the instruction watched for execution, and continues from there on the next run.
+	 */
+	bit throw_faults = true;
+	mutable Fault fault;
+
 	U32 clock_cycle_count = 0;
     bit halted = false;
 
-	[[nodiscard]] static constexpr OpSize get_size(bit size_override, bit byte_size_override);
-	
-	void execute_arithmetic_instruction(U8 opcode, const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
-	void execute_non_arithmetic_instruction(const U8 opcode, const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
-	void execute_non_arithmetic_instruction_with_state_machine(const U8 opcode, const InstData data, EFLAGS& flags, U32& ret);
+	/*
+	 * Snapshot of the state of the CPU, restored by CPU::restore(). The memory keeps its own snapshot.
+	 */
+	struct Snapshot
+	{
+		Registers registers;
+		PendingFlags pending_flags;
+		Fault fault;
+		const Inst* current_instruction;
+		U32 clock_cycle_count;
+		bit halted;
+		std::array<U8, IO_SIZE> io;
+	};
+
+	std::unique_ptr<Snapshot> saved_state;
+
+	/**
+	 * Returns the size of an operand, using the size overrides of the instruction.
+	 */
+	[[nodiscard]] static constexpr OpSize get_size(bit size_override, bit byte_size_override)
+	{
+		if (byte_size_override) {
+			return OpSize::B;
+		}
+		else if (size_override) {
+			return OpSize::W;
+		}
+		else {
+			return OpSize::DW;
+		}
+	}
+
+	void decode_instructions();
+	[[nodiscard]] static Dispatch get_dispatch(const Inst& inst);
+	[[nodiscard]] DecodedInst decode_instruction(const Inst& inst) const;
+	[[nodiscard]] const DecodedInst& fetch_decoded_instruction(U32 address) const;
+	void execute_decoded_instruction(const DecodedInst& decoded);
+	void execute_handlers(const DecodedInst& decoded);
+
+	[[nodiscard]] bit get_static_jump_target(const Inst& inst, U32& target) const;
+	void build_basic_blocks();
+	[[nodiscard]] const BasicBlock* get_next_block(const BasicBlock* previous, U32 index) const;
+	void fuse_compare_jumps();
+	void execute_direct_jcc(const DecodedInst& jump);
+
+	bit run_compiled_block(const BasicBlock* block, U32 index, size_t max_cycles);
+
+	[[nodiscard]] U32 address_from_op1(const Inst& inst) const;
+	[[nodiscard]] U32 address_from_op2(const Inst& inst) const;
+	[[nodiscard]] U32 address_from_value(const Inst& inst) const;
+	[[nodiscard]] U32 address_missing(const Inst& inst) const;
+
+	[[nodiscard]] U32 read_nothing(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+	[[nodiscard]] U32 read_register(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+	[[nodiscard]] U32 read_memory(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+	[[nodiscard]] U32 read_immediate(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+	[[nodiscard]] U32 read_immediate_address(const Inst& inst, const Inst::Operand& operand, U32 address, OpSize size) const;
+
+	void write_nothing(const Inst& inst, const InstData& data, U32 value);
+	void write_op1_register(const Inst& inst, const InstData& data, U32 value);
+	void write_op1_memory(const Inst& inst, const InstData& data, U32 value);
+	void write_op2_register(const Inst& inst, const InstData& data, U32 value);
+	void write_op2_memory(const Inst& inst, const InstData& data, U32 value);
+	void write_output_register(const Inst& inst, const InstData& data, U32 value);
+	void write_output_register_scaled(const Inst& inst, const InstData& data, U32 value);
+
+	[[nodiscard]] static ExecuteHandler get_arithmetic_handler(U8 opcode);
+	[[nodiscard]] static ExecuteHandler get_non_arithmetic_handler(U8 opcode);
+	[[nodiscard]] static ExecuteHandler get_state_machine_handler(U8 opcode);
+	void execute_unknown_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
+
+	template<U8 opcode>
+	void execute_state_machine_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
+
+	[[nodiscard]] static U32 get_flags_to_materialize(const Inst& inst);
+	void update_lazy_flags(EFLAGS& flags, FlagsOp op, U32 op1, U32 op2, U32 result,
+						   OpSize op1_size, OpSize op2_size, OpSize ret_size, bit is_sub = 0);
+	void compute_pending_flags(EFLAGS& flags, const PendingFlags& pending, U32 mask) const;
+	void materialize_flags(U32 mask = arithmetic_lazy_flags);
+
+	static void get_flags_usage(const Inst& inst, U32& used, U32& written);
+	[[nodiscard]] U32 get_block_live_out(const BasicBlock& block, const std::vector<U32>& blocks_live_in) const;
+	void analyze_flags_liveness();
+
+	template<U8 opcode>
+	void execute_arithmetic_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
+	template<U8 opcode>
+	void execute_non_arithmetic_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2);
+	template<U8 opcode>
+	void execute_non_arithmetic_instruction_with_state_machine(const InstData data, EFLAGS& flags, U32& ret);
+	[[nodiscard]] bit check_jump_condition(U8 condition, const EFLAGS& flags) const;
 	
 	[[nodiscard]] U32 compute_address(U8 register_field) const;
 	
+	[[nodiscard]] U32 memory_read(U32 address, OpSize size) const;
+	void memory_write(U32 address, U32 value, OpSize size);
+	void check_access_fault(const Fault& access_fault) const;
+	[[nodiscard]] bit check_io_access(U8 io_address, OpSize size);
+
+	static constexpr U32 no_resume_index = U32(-1);
+	[[nodiscard]] U32 resume_after_watchpoint();
+	[[nodiscard]] bit stop_at_exec_watchpoint(U32 index);
+
 	void push(U32 value, OpSize size = OpSize::UNKNOWN);
 	U32 pop(OpSize size = OpSize::UNKNOWN);
 
@@ -48,8 +287,16 @@ class CPU
         throw NotImplemented(current_instruction->opcode, registers.EIP, msg);
     }
 
+    /**
+     * Throws the processor exception, or stores it in the fault status if faults are not thrown. The instruction must
+     * then not write its results, which is handled by CPU::execute_decoded_instruction().
+     */
     void throw_exception(const Interrupts::Interrupt& interrupt) const
     {
+        if (!throw_faults) {
+            fault = Fault::processor(interrupt.mnemonic, registers.EIP, interrupt.vector);
+            return;
+        }
         throw ProcessorException(interrupt.mnemonic, registers.EIP, interrupt.vector);
     }
 
@@ -64,9 +311,40 @@ public:
 	void new_clock_cycle();
 	void startup();
 	void run(size_t max_cycles = std::numeric_limits<size_t>::max());
+	void run_threaded(size_t max_cycles = std::numeric_limits<size_t>::max());
 	void execute_instruction();
 
-	Registers& get_registers() { return registers; }
+	[[nodiscard]] size_t get_basic_blocks_count() const { return basic_blocks.size(); }
+
+	void snapshot();
+	void restore();
+	[[nodiscard]] bit has_snapshot() const { return saved_state != nullptr; }
+
+	void set_macro_fusion(bit enabled) { macro_fusion = enabled; }
+	[[nodiscard]] bit is_macro_fusion() const { return macro_fusion; }
+	[[nodiscard]] size_t get_fused_pairs_count() const { return fused_pairs_count; }
+
+	void set_jit_enabled(bit enabled, U32 threshold = JIT::default_threshold);
+	[[nodiscard]] const JIT* get_jit() const { return jit.get(); }
+
+	void set_lazy_flags(bit enabled);
+	[[nodiscard]] bit is_lazy_flags() const { return lazy_flags; }
+
+	/**
+	 * If disabled, faults of the guest program are no longer thrown, but stored in the status returned by get_fault().
+	 */
+	void set_throw_faults(bit enabled) { throw_faults = enabled; }
+	[[nodiscard]] bit is_throwing_faults() const { return throw_faults; }
+	[[nodiscard]] const Fault& get_fault() const { return fault; }
+
+	void set_flags_liveness(bit enabled);
+	[[nodiscard]] bit is_flags_liveness() const { return flags_liveness; }
+	[[nodiscard]] size_t get_eliminated_flags_count() const { return eliminated_flags_count; }
+
+	/**
+	 * Returns the registers, with all flags up to date.
+	 */
+	Registers& get_registers() { materialize_flags(); return registers; }
 	Mem::Memory& get_memory() { return *memory; }
 
     U32 read_io(U8 io_address, OpSize size);
@@ -78,3 +356,97 @@ public:
 	[[nodiscard]]
 	U32 get_clock_cycle() const { return clock_cycle_count; }
 };
+
+
+// ============================
+// ------ Implementation ------
+// ============================
+
+
+/**
+ * Utility to keep track of how many cycles elapsed
+ */
+template<typename ALU>
+inline void CPU<ALU>::new_clock_cycle()
+{
+	clock_cycle_count++;
+	// TODO : reset the branch monitor here
+}
+
+
+/**
+ * Calls the handlers of a pre-decoded instruction in order: operands fetching, execution of its opcode, flags update,
+ * and writing the results to their destination. Always inlined, so that each handler of CPU::run_threaded() makes
+ * its own calls to the handlers of the instruction.
+ */
+template<typename ALU>
+MCX86_ALWAYS_INLINE void CPU<ALU>::execute_handlers(const DecodedInst& decoded)
+{
+    const Inst& inst = *decoded.inst;
+    current_instruction = &inst;
+    current_live_flags = decoded.live_flags;
+
+    InstData data{};
+
+    data.address = (this->*decoded.get_address)(inst);
+
+    // TODO : missing data.op3 value
+
+    // Read the operands
+    data.op1_size = decoded.op1_size;
+    data.op1 = (this->*decoded.read_op1)(inst, inst.op1, data.address, decoded.op1_size);
+
+    data.op2_size = decoded.op2_size;
+    data.op2 = (this->*decoded.read_op2)(inst, inst.op2, data.address, decoded.op2_size);
+
+    if (decoded.load_immediate) {
+        // Load the immediate value only if it has not been stored in an operand already
+        data.imm = inst.immediate_value;
+    }
+
+    data.op_size = decoded.operand_size;
+
+    if (fault.is_error()) {
+        // Faults are only set when they are not thrown
+        return;
+    }
+
+	if (pending_flags.mask & decoded.flags_to_materialize) {
+		materialize_flags(decoded.flags_to_materialize);
+	}
+
+	// Get the flags registers if needed
+	EFLAGS flags;
+	if (inst.get_flags) {
+	    flags = registers.flags;
+	}
+
+	// Execute the instruction
+	U32 return_value = 0;
+	U32 return_value_2 = 0;
+	const U32 EIP = registers.EIP;
+    (this->*decoded.execute)(data, flags, return_value, return_value_2);
+
+    if (fault.is_error()) {
+        // Same state as when the exception is thrown from the instruction: EIP is not incremented
+        registers.EIP = EIP;
+        return;
+    }
+
+	if (inst.get_flags) {
+		// write the new flags
+		registers.flags.value = flags.value;
+	}
+
+	// Write the output of the instruction to its destination
+    (this->*decoded.write_ret1)(inst, data, return_value);
+    if (fault.is_error()) {
+        return;
+    }
+    (this->*decoded.write_ret2)(inst, data, return_value_2);
+
+    if (fault.is_set()) {
+        // A watchpoint was hit by one of the accesses of the instruction, which is complete
+        fault.watchpoint.instruction = EIP - memory->text_pos;
+    }
+}
@@ -12,7 +12,9 @@
  * @param ret Return value of the instruction
  * @param ret_2 Additional return value of the instruction
  */
-void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, EFLAGS& flags, U32& ret, U32& ret_2)
+template<typename ALU>
+template<U8 opcode>
+void CPU<ALU>::execute_arithmetic_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2)
 {
 	switch (opcode) // we could consider only the first 7 bits of the opcode
 	{
@@ -45,9 +47,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 
 		AL_val = ALU::add_no_carry(ALU::multiply_no_overflow(AH_val, (U8) 10), AL_val);
 
-		flags.update_sign_flag(AL_val, OpSize::B);
-		flags.update_zero_flag(AL_val);
-		flags.update_parity_flag(AL_val);
+		flags.update_sign_flag<ALU>(AL_val, OpSize::B);
+		flags.update_zero_flag<ALU>(AL_val);
+		flags.update_parity_flag<ALU>(AL_val);
 
 		ret = AL_val;
 		break;
@@ -60,9 +62,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 
 		ret = (q << 8) | r;
 
-        flags.update_sign_flag(r, OpSize::B);
-        flags.update_zero_flag(r);
-        flags.update_parity_flag(r);
+        flags.update_sign_flag<ALU>(r, OpSize::B);
+        flags.update_zero_flag<ALU>(r);
+        flags.update_parity_flag<ALU>(r);
 		break;
 	}
 	case Opcodes::AAS:
@@ -90,7 +92,10 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 	    bit carry = flags.get(EFLAGS::CF);
 		ret = ALU::add(data.op1, data.op2, carry);
 
-        flags.update_status_flags(data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size, carry);
+        if (current_live_flags & EFLAGS::CF) {
+            flags.update_carry_flag<ALU>(data.op1, data.op2, carry);
+        }
+        update_lazy_flags(flags, FlagsOp::Arithmetic, data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::ADD:
@@ -98,7 +103,10 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		bit carry = 0;
 		ret = ALU::add(data.op1, data.op2, carry);
 
-        flags.update_status_flags(data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size, carry);
+        if (current_live_flags & EFLAGS::CF) {
+            flags.update_carry_flag<ALU>(data.op1, data.op2, carry);
+        }
+        update_lazy_flags(flags, FlagsOp::Arithmetic, data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::AND:
@@ -106,9 +114,7 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		ret = ALU::and_(data.op1, data.op2);
 
 		flags.clear(EFLAGS::CF | EFLAGS::OF);
-        flags.update_sign_flag(ret, data.op1_size);
-        flags.update_zero_flag(ret);
-        flags.update_parity_flag(ret);
+        update_lazy_flags(flags, FlagsOp::Logic, data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::ARPL:
@@ -252,7 +258,10 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 	{
 		bit carry;
 		U32 val = ALU::sub(data.op1, data.op2, carry);
-        flags.update_status_flags(data.op1, data.op2, val, data.op1_size, data.op2_size, data.op1_size, carry, 1);
+        if (current_live_flags & EFLAGS::CF) {
+            flags.update_carry_flag<ALU>(data.op1, data.op2, carry, 1);
+        }
+        update_lazy_flags(flags, FlagsOp::Arithmetic, data.op1, data.op2, val, data.op1_size, data.op2_size, data.op1_size, 1);
 		break;
 	}
 	case Opcodes::CWD:
@@ -295,9 +304,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		    flags.clear(EFLAGS::CF);
 		}
 
-		flags.update_parity_flag(ret);
-		flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
+		flags.update_parity_flag<ALU>(ret);
+		flags.update_sign_flag<ALU>(ret, data.op1_size);
+		flags.update_zero_flag<ALU>(ret);
 		break;
 	}
 	case Opcodes::DAS:
@@ -320,20 +329,20 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
             flags.clear(EFLAGS::CF);
 		}
 
-        flags.update_parity_flag(ret);
-        flags.update_sign_flag(ret, data.op1_size);
-        flags.update_zero_flag(ret);
+        flags.update_parity_flag<ALU>(ret);
+        flags.update_sign_flag<ALU>(ret, data.op1_size);
+        flags.update_zero_flag<ALU>(ret);
 		break;
 	}
 	case Opcodes::DEC:
 	{
 		ret = ALU::sub_no_carry(data.op1, U8(1));
 
-        flags.update_overflow_flag(data.op1, U8(-1), ret, data.op1_size, OpSize::B, data.op1_size);
-		flags.update_parity_flag(ret);
-		flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-        flags.update_adjust_flag(data.op1, -1, 1);
+        flags.update_overflow_flag<ALU>(data.op1, U8(-1), ret, data.op1_size, OpSize::B, data.op1_size);
+		flags.update_parity_flag<ALU>(ret);
+		flags.update_sign_flag<ALU>(ret, data.op1_size);
+		flags.update_zero_flag<ALU>(ret);
+        flags.update_adjust_flag<ALU>(data.op1, -1, 1);
 		break;
 	}
 	case Opcodes::DIV:
@@ -395,11 +404,7 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 	{
 		ret = ALU::add_no_carry(data.op1, 1);
 
-        flags.update_overflow_flag(data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
-		flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-        flags.update_parity_flag(ret);
-        flags.update_adjust_flag(data.op1, data.op2);
+        update_lazy_flags(flags, FlagsOp::Arithmetic, data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::LAHF:
@@ -479,9 +484,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 
         flags.set_val(EFLAGS::CF, ALU::check_equal_zero(data.op1));
 		flags.clear(EFLAGS::OF); // no overflow is possible
-		flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-		flags.update_parity_flag(ret);
+		flags.update_sign_flag<ALU>(ret, data.op1_size);
+		flags.update_zero_flag<ALU>(ret);
+		flags.update_parity_flag<ALU>(ret);
 		break;
 	}
 	case Opcodes::NOP:
@@ -498,9 +503,7 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		ret = ALU::or_(data.op1, data.op2);
 
 		flags.clear(EFLAGS::CF | EFLAGS::OF);
-		flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-		flags.update_parity_flag(ret);
+		update_lazy_flags(flags, FlagsOp::Logic, data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::ROT:
@@ -608,9 +611,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 
         flags.set_val(EFLAGS::OF, overflow);
         flags.set_val(EFLAGS::CF, carry);
-        flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-		flags.update_parity_flag(ret);
+        flags.update_sign_flag<ALU>(ret, data.op1_size);
+		flags.update_zero_flag<ALU>(ret);
+		flags.update_parity_flag<ALU>(ret);
 		break;
     }
     case Opcodes::SBB:
@@ -621,7 +624,7 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
         op_2 = ALU::add(op_2, 0, carry);
 		ret = ALU::sub(data.op1, op_2, carry);
 
-        flags.update_status_flags(data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size, carry, 1);
+        flags.update_status_flags<ALU>(data.op1, data.op2, ret, data.op1_size, data.op2_size, data.op1_size, carry, 1);
 		break;
 	}
 	case Opcodes::SETcc:
@@ -685,9 +688,9 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		}
 
 		flags.set_val( EFLAGS::CF, carry);
-        flags.update_sign_flag(ret, data.op1_size);
-		flags.update_zero_flag(ret);
-		flags.update_parity_flag(ret);
+        flags.update_sign_flag<ALU>(ret, data.op1_size);
+		flags.update_zero_flag<ALU>(ret);
+		flags.update_parity_flag<ALU>(ret);
 		break;
 	}
 	case Opcodes::STC:
@@ -721,7 +724,10 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		bit carry = 0;
 		ret = ALU::sub(data.op1, op_2, carry);
 
-        flags.update_status_flags(data.op1, op_2, ret, data.op1_size, op_2_size, data.op1_size, carry, 1);
+        if (current_live_flags & EFLAGS::CF) {
+            flags.update_carry_flag<ALU>(data.op1, op_2, carry, 1);
+        }
+        update_lazy_flags(flags, FlagsOp::Arithmetic, data.op1, op_2, ret, data.op1_size, op_2_size, data.op1_size, 1);
 		break;
 	}
 	case Opcodes::TEST:
@@ -729,9 +735,7 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 		U32 result = data.op1 & data.op2;
 
 		flags.clear(EFLAGS::OF | EFLAGS::CF); // clear the OF and CF flags
-		flags.update_parity_flag(result);
-		flags.update_sign_flag(result, data.op1_size);
-		flags.update_zero_flag(result);
+		update_lazy_flags(flags, FlagsOp::Logic, data.op1, data.op2, result, data.op1_size, data.op2_size, data.op1_size);
 		break;
 	}
 	case Opcodes::XCHG:
@@ -764,3 +768,23 @@ void CPU::execute_arithmetic_instruction(const U8 opcode, const InstData data, E
 	// increment EIP at the end of those instructions
 	registers.write_EIP(ALU::add_no_carry(registers.EIP, 1));
 }
+
+
+/**
+ * Returns the instance of CPU::execute_arithmetic_instruction() for the opcode, or nullptr if it is not arithmetic.
+ */
+template<typename ALU>
+typename CPU<ALU>::ExecuteHandler CPU<ALU>::get_arithmetic_handler(U8 opcode)
+{
+    static constexpr auto handlers = []<size_t... opcodes>(std::index_sequence<opcodes...>) {
+        return std::array<ExecuteHandler, sizeof...(opcodes)>{ &CPU::execute_arithmetic_instruction<U8(opcodes)>... };
+    }(std::make_index_sequence<Opcodes::MULX + 1>());
+
+    if (opcode & Opcodes::not_arithmetic || opcode >= handlers.size()) {
+        return nullptr;
+    }
+    return handlers[opcode];
+}
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
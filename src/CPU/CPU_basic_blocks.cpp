@@ -0,0 +1,158 @@
+
+#include "CPU.h"
+#include "opcodes.h"
+
+
+/**
+ * Returns true if the instruction has a jump target known before execution, and sets 'target' to it.
+ * This follows how the jump instructions get their target in CPU::execute_non_arithmetic_instruction_with_state_machine():
+ * CALL and LOOP jump to the address operand, while JMP and Jcc jump to the value of their first operand.
+ * Targets of RET, IRET and INT, as well as jumps through a register or memory operand are only known at runtime.
+ */
+template<typename ALU>
+bit CPU<ALU>::get_static_jump_target(const Inst& inst, U32& target) const
+{
+    switch (inst.opcode)
+    {
+    case Opcodes::CALL:
+    case Opcodes::LOOP:
+        if (inst.compute_address) {
+            return false;
+        }
+        target = inst.address_value;
+        return true;
+
+    case Opcodes::JMP:
+    case Opcodes::Jcc:
+        if (!inst.op1.read) {
+            return false;
+        }
+        else if (inst.op1.type == OpType::IMM_MEM) {
+            target = inst.address_value;
+            return true;
+        }
+        else if (inst.op1.type == OpType::IMM) {
+            target = inst.immediate_value;
+            return true;
+        }
+        return false;
+
+    default:
+        return false;
+    }
+}
+
+
+/**
+ * Splits the decoded instructions into basic blocks, then links each block to its successors.
+ */
+template<typename ALU>
+void CPU<ALU>::build_basic_blocks()
+{
+    const U32 count = decoded_instructions.size();
+    const U32 text_pos = memory->text_pos;
+
+    // Find the first instruction of each block: the entry point, all jump targets and all instructions following an
+    // instruction which may not continue to the next one.
+    std::vector<bit> is_block_start(count + 1, false);
+    is_block_start[0] = true;
+    for (U32 i = 0; i < count; i++) {
+        const Inst& inst = *decoded_instructions[i].inst;
+
+        U32 target;
+        if (get_static_jump_target(inst, target) && target >= text_pos && target - text_pos < count) {
+            is_block_start[target - text_pos] = true;
+        }
+
+        if ((inst.opcode & Opcodes::not_arithmetic) && ((inst.opcode & Opcodes::jmp) || inst.opcode == Opcodes::HLT)) {
+            is_block_start[i + 1] = true;
+        }
+    }
+
+    basic_blocks.clear();
+    instructions_blocks.resize(count);
+    for (U32 i = 0; i < count; i++) {
+        if (is_block_start[i]) {
+            basic_blocks.push_back({ i, i, nullptr, nullptr });
+        }
+        basic_blocks.back().end = i + 1;
+        instructions_blocks[i] = basic_blocks.size() - 1;
+    }
+
+    // The blocks won't move anymore, we can link them together
+    for (U32 b = 0; b < basic_blocks.size(); b++) {
+        BasicBlock& block = basic_blocks[b];
+
+        if (b + 1 < basic_blocks.size()) {
+            block.next = &basic_blocks[b + 1];
+        }
+
+        U32 target;
+        const Inst& last = *decoded_instructions[block.end - 1].inst;
+        if (get_static_jump_target(last, target) && target >= text_pos && target - text_pos < count) {
+            block.taken = &basic_blocks[instructions_blocks[target - text_pos]];
+        }
+    }
+}
+
+
+/**
+ * Returns the block to execute for the instruction at 'index', by first following the links of the previous block.
+ * If the index is in the middle of a block, this block is returned and the execution starts from the index.
+ */
+template<typename ALU>
+const typename CPU<ALU>::BasicBlock* CPU<ALU>::get_next_block(const BasicBlock* previous, U32 index) const
+{
+    if (previous != nullptr) {
+        if (previous->taken != nullptr && previous->taken->first == index) {
+            return previous->taken;
+        }
+        else if (previous->next != nullptr && previous->next->first == index) {
+            return previous->next;
+        }
+    }
+
+    // Same bounds checks as Mem::Memory::fetch_instruction()
+    return &basic_blocks[instructions_blocks.at(index)];
+}
+
+
+
+/**
+ * Marks the CMP, TEST, SUB and DEC instructions directly followed by a Jcc in the same block, so that the jump is
+ * executed right after them by CPU::execute_direct_jcc(), without going through the generic instruction path.
+ * Only jumps to a static address and with a valid condition are fused.
+ */
+template<typename ALU>
+void CPU<ALU>::fuse_compare_jumps()
+{
+    fused_pairs_count = 0;
+    for (const BasicBlock& block : basic_blocks) {
+        if (block.end - block.first < 2) {
+            continue;
+        }
+
+        DecodedInst& first = decoded_instructions[block.end - 2];
+        if (decoded_instructions[block.end - 1].dispatch != Dispatch::DirectJcc) {
+            continue;
+        }
+
+        switch (first.inst->opcode)
+        {
+        case Opcodes::CMP:
+        case Opcodes::TEST:
+        case Opcodes::SUB:
+        case Opcodes::DEC:
+            break;
+
+        default:
+            continue;
+        }
+
+        first.dispatch = Dispatch::FusedPair;
+        fused_pairs_count++;
+    }
+}
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
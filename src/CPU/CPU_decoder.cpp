@@ -0,0 +1,315 @@
+
+#include "../ALU.hpp"
+#include "CPU.h"
+#include "opcodes.h"
+
+
+/**
+ * Decodes all instructions of the program once, before the execution starts.
+ */
+template<typename ALU>
+void CPU<ALU>::decode_instructions()
+{
+    const std::span<const Inst> instructions = memory->get_instructions();
+
+    decoded_instructions.clear();
+    decoded_instructions.reserve(instructions.size());
+    for (const Inst& inst : instructions) {
+        decoded_instructions.push_back(decode_instruction(inst));
+    }
+}
+
+
+/**
+ * Resolves the handlers of an instruction: how to get its address operand, how to read its operands, which instance
+ * of the execution units handles its opcode, and where to write its results.
+ */
+template<typename ALU>
+typename CPU<ALU>::DecodedInst CPU<ALU>::decode_instruction(const Inst& inst) const
+{
+    DecodedInst decoded{};
+    decoded.inst = &inst;
+
+    if (inst.compute_address) {
+        if (inst.op1.type == OpType::MEM) {
+            decoded.get_address = &CPU::address_from_op1;
+        }
+        else if (inst.op2.type == OpType::MEM) {
+            decoded.get_address = &CPU::address_from_op2;
+        }
+        else {
+            // Raised only if the instruction is executed
+            decoded.get_address = &CPU::address_missing;
+        }
+    }
+    else {
+        decoded.get_address = &CPU::address_from_value;
+    }
+
+    // Segment overrides for the operand and are always set to 32 bits, so they are ignored.
+    decoded.operand_size = get_size(inst.operand_size_override, inst.operand_byte_size_override);
+
+    bit immediate_loaded = false;
+
+    // Operands which are not read keep a null size, like in the circuit
+    auto decode_operand = [&](const Inst::Operand& operand, ReadHandler& handler, OpSize& size) {
+        handler = &CPU::read_nothing;
+        size = OpSize::DW;
+
+        if (!operand.read) {
+            return;
+        }
+
+        size = decoded.operand_size;
+
+        switch (operand.type) {
+        case OpType::REG:
+            if (is_special_register(operand.reg)) {
+                if (operand.reg <= Register::GS) {
+                    // All segment registers have a fixed length
+                    size = OpSize::W;
+                }
+                else {
+                    // Control registers
+                    size = OpSize::DW;
+                }
+            }
+            handler = &CPU::read_register;
+            break;
+
+        case OpType::MEM:
+            handler = &CPU::read_memory;
+            break;
+
+        case OpType::IMM:
+            handler = &CPU::read_immediate;
+            immediate_loaded = true;
+            break;
+
+        case OpType::IMM_MEM:
+            handler = &CPU::read_immediate_address;
+            break;
+        }
+    };
+
+    decode_operand(inst.op1, decoded.read_op1, decoded.op1_size);
+    decode_operand(inst.op2, decoded.read_op2, decoded.op2_size);
+
+    decoded.load_immediate = !immediate_loaded;
+
+    decoded.flags_to_materialize = get_flags_to_materialize(inst);
+    decoded.live_flags = status_flags;
+    decoded.dispatch = get_dispatch(inst);
+
+    if (inst.opcode & Opcodes::not_arithmetic) {
+        if (inst.opcode & Opcodes::state_machine) {
+            // Include all state machine, jump and string instructions
+            decoded.execute = get_state_machine_handler(inst.opcode);
+        }
+        else {
+            decoded.execute = get_non_arithmetic_handler(inst.opcode);
+        }
+    }
+    else {
+        decoded.execute = get_arithmetic_handler(inst.opcode);
+    }
+
+    if (decoded.execute == nullptr) {
+        // Raised only if the instruction is executed
+        decoded.execute = &CPU::execute_unknown_instruction;
+    }
+
+    decoded.write_ret1 = &CPU::write_nothing;
+    if (inst.write_ret1_to_op1) {
+        switch (inst.op1.type) {
+        case OpType::REG: decoded.write_ret1 = &CPU::write_op1_register; break;
+        case OpType::MEM: decoded.write_ret1 = &CPU::write_op1_memory;   break;
+        default: break;
+        }
+    }
+
+    decoded.write_ret2 = &CPU::write_nothing;
+    if (inst.write_ret2_to_register) {
+        if (inst.scale_output_override) {
+            decoded.write_ret2 = &CPU::write_output_register_scaled;
+        }
+        else {
+            decoded.write_ret2 = &CPU::write_output_register;
+        }
+    }
+    else if (inst.write_ret2_to_op2) {
+        switch (inst.op2.type) {
+        case OpType::REG: decoded.write_ret2 = &CPU::write_op2_register; break;
+        case OpType::MEM: decoded.write_ret2 = &CPU::write_op2_memory;   break;
+        default: break;
+        }
+    }
+
+    return decoded;
+}
+
+
+/**
+ * Returns how the instruction can be executed. Jumps use the shortcuts only when their target is static, and when they
+ * behave exactly like in CPU::execute_non_arithmetic_instruction_with_state_machine(): a Jcc must read its condition
+ * from the immediate value and the flags.
+ */
+template<typename ALU>
+typename CPU<ALU>::Dispatch CPU<ALU>::get_dispatch(const Inst& inst)
+{
+    if (inst.compute_address || inst.op2.read || !inst.op1.read || inst.op1.type != OpType::IMM_MEM) {
+        return Dispatch::Generic;
+    }
+
+    if (inst.opcode == Opcodes::JMP) {
+        return Dispatch::DirectJmp;
+    }
+    else if (inst.opcode == Opcodes::Jcc && inst.get_flags && U8(inst.immediate_value) <= 0b10001) {
+        return Dispatch::DirectJcc;
+    }
+
+    return Dispatch::Generic;
+}
+
+
+/**
+ * Returns the decoded instruction at the address, with the same bounds checks as Mem::Memory::fetch_instruction().
+ */
+template<typename ALU>
+const typename CPU<ALU>::DecodedInst& CPU<ALU>::fetch_decoded_instruction(U32 address) const
+{
+    return decoded_instructions.at(address - memory->text_pos);
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::address_from_op1(const Inst& inst) const
+{
+    return compute_address(static_cast<U8>(inst.op1.reg));
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::address_from_op2(const Inst& inst) const
+{
+    return compute_address(static_cast<U8>(inst.op2.reg));
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::address_from_value(const Inst& inst) const
+{
+    return inst.address_value;
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::address_missing(const Inst&) const
+{
+    throw BadInstruction("'compute_address' is true, but there is no memory operand", registers.EIP);
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::read_nothing(const Inst&, const Inst::Operand&, U32, OpSize) const
+{
+    return 0;
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::read_register(const Inst&, const Inst::Operand& operand, U32, OpSize size) const
+{
+    return registers.read(operand.reg, size);
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::read_memory(const Inst&, const Inst::Operand&, U32 address, OpSize size) const
+{
+    return memory_read(address, size);
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::read_immediate(const Inst& inst, const Inst::Operand&, U32, OpSize) const
+{
+    return inst.immediate_value;
+}
+
+
+template<typename ALU>
+U32 CPU<ALU>::read_immediate_address(const Inst& inst, const Inst::Operand&, U32, OpSize) const
+{
+    return inst.address_value;
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_nothing(const Inst&, const InstData&, U32)
+{ }
+
+
+template<typename ALU>
+void CPU<ALU>::write_op1_register(const Inst& inst, const InstData&, U32 value)
+{
+    registers.write(inst.op1.reg, value);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_op1_memory(const Inst&, const InstData& data, U32 value)
+{
+    memory_write(data.address, value, data.op1_size);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_op2_register(const Inst& inst, const InstData&, U32 value)
+{
+    registers.write(inst.op2.reg, value);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_op2_memory(const Inst&, const InstData& data, U32 value)
+{
+    memory_write(data.address, value, data.op2_size);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_output_register(const Inst& inst, const InstData&, U32 value)
+{
+    registers.write(inst.register_out, value);
+}
+
+
+template<typename ALU>
+void CPU<ALU>::write_output_register_scaled(const Inst& inst, const InstData& data, U32 value)
+{
+    registers.write(inst.register_out, value, data.op1_size);
+}
+
+
+/**
+ * Handler of the opcodes outside of the ranges of the execution units, with the same exceptions as their default case.
+ */
+template<typename ALU>
+void CPU<ALU>::execute_unknown_instruction(const InstData, EFLAGS&, U32&, U32&)
+{
+    const U8 opcode = current_instruction->opcode;
+    if (!(opcode & Opcodes::not_arithmetic)) {
+        throw UnknownInstruction("Unknown arithmetic instruction", opcode, registers.EIP);
+    }
+    else if (!(opcode & Opcodes::state_machine)) {
+        throw UnknownInstruction("Unknown Non-arithmetic instruction", opcode, registers.EIP);
+    }
+    else {
+        throw UnknownInstruction("Unknown Non-arithmetic state machine instruction", opcode, registers.EIP);
+    }
+}
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
@@ -0,0 +1,177 @@
+
+#include <bit>
+
+#include "CPU.h"
+#include "opcodes.h"
+
+
+/**
+ * Sets the status flags read and the status flags always overwritten by the instruction.
+ *
+ * Only the most common flag-producing instructions are known precisely, all others instructions accessing the flags
+ * are considered to read all of them without overwriting any.
+ */
+template<typename ALU>
+void CPU<ALU>::get_flags_usage(const Inst& inst, U32& used, U32& written)
+{
+    used = 0;
+    written = 0;
+
+    if (!inst.get_flags) {
+        return;
+    }
+
+    switch (inst.opcode)
+    {
+    case Opcodes::ADD:
+        written = status_flags;
+        break;
+
+    case Opcodes::SUB:
+    case Opcodes::CMP:
+        // The carry flag is only set, never cleared, see EFLAGS::update_carry_flag
+        used = EFLAGS::CF;
+        written = arithmetic_lazy_flags;
+        break;
+
+    case Opcodes::INC:
+        written = arithmetic_lazy_flags;
+        break;
+
+    case Opcodes::AND:
+    case Opcodes::OR:
+    case Opcodes::TEST:
+        written = logic_lazy_flags | EFLAGS::CF | EFLAGS::OF;
+        break;
+
+    default:
+        used = status_flags;
+        break;
+    }
+}
+
+
+/**
+ * Returns the status flags live at the exit of the block: the union of the flags live at the start of its successors.
+ * All flags are live if the block leaves the program, or if its successors are only known at runtime (RET, IRET, INT,
+ * jumps through a register or memory operand...).
+ */
+template<typename ALU>
+U32 CPU<ALU>::get_block_live_out(const BasicBlock& block, const std::vector<U32>& blocks_live_in) const
+{
+    const Inst& last = *decoded_instructions[block.end - 1].inst;
+    const U32 count = decoded_instructions.size();
+    const U32 text_pos = memory->text_pos;
+
+    bit can_jump = false;
+    bit can_continue = true;
+    switch (last.opcode)
+    {
+    case Opcodes::JMP:
+        can_jump = true;
+        can_continue = false;
+        break;
+
+    case Opcodes::Jcc:
+    case Opcodes::LOOP:
+    case Opcodes::CALL: // The called function returns to the next instruction
+        can_jump = true;
+        break;
+
+    default:
+        if ((last.opcode & Opcodes::not_arithmetic) && ((last.opcode & Opcodes::jmp) || last.opcode == Opcodes::HLT)) {
+            return status_flags;
+        }
+        break;
+    }
+
+    U32 live_out = 0;
+
+    if (can_jump) {
+        U32 target;
+        if (!get_static_jump_target(last, target) || target < text_pos || target - text_pos >= count) {
+            return status_flags;
+        }
+        live_out |= blocks_live_in[instructions_blocks[target - text_pos]];
+    }
+
+    if (can_continue) {
+        if (block.end >= count) {
+            return status_flags;
+        }
+        live_out |= blocks_live_in[instructions_blocks[block.end]];
+    }
+
+    return live_out;
+}
+
+
+/**
+ * Computes the live status flags after each instruction, and stores them in the decoded instructions.
+ * The live flags at the start of each block are propagated backwards through the control flow graph until nothing
+ * changes, then each block is walked backwards once more to get the flags live after each of its instructions.
+ */
+template<typename ALU>
+void CPU<ALU>::analyze_flags_liveness()
+{
+    std::vector<U32> blocks_live_in(basic_blocks.size(), 0);
+
+    bit changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = basic_blocks.size(); b-- > 0;) {
+            const BasicBlock& block = basic_blocks[b];
+
+            U32 live = get_block_live_out(block, blocks_live_in);
+            for (U32 i = block.end; i-- > block.first;) {
+                U32 used, written;
+                get_flags_usage(*decoded_instructions[i].inst, used, written);
+                live = used | (live & ~written);
+            }
+
+            if (live != blocks_live_in[b]) {
+                blocks_live_in[b] = live;
+                changed = true;
+            }
+        }
+    }
+
+    eliminated_flags_count = 0;
+    for (const BasicBlock& block : basic_blocks) {
+        U32 live = get_block_live_out(block, blocks_live_in);
+        for (U32 i = block.end; i-- > block.first;) {
+            DecodedInst& decoded = decoded_instructions[i];
+            decoded.live_flags = live;
+
+            U32 used, written;
+            get_flags_usage(*decoded.inst, used, written);
+            eliminated_flags_count += std::popcount(written & ~live);
+
+            live = used | (live & ~written);
+        }
+    }
+}
+
+
+/**
+ * Enables or disables the flags liveness analysis. When enabled, instructions skip the computation of dead flags.
+ */
+template<typename ALU>
+void CPU<ALU>::set_flags_liveness(bit enabled)
+{
+    flags_liveness = enabled;
+
+    if (enabled) {
+        analyze_flags_liveness();
+    }
+    else {
+        for (DecodedInst& decoded : decoded_instructions) {
+            decoded.live_flags = status_flags;
+        }
+        eliminated_flags_count = 0;
+    }
+}
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
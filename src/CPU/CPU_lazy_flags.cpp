@@ -0,0 +1,113 @@
+
+#include "CPU.h"
+#include "opcodes.h"
+
+
+/**
+ * Returns the pending flags which must be computed before executing the instruction.
+ *
+ * Instructions producing lazy flags only need the pending flags they don't overwrite. All other instructions accessing
+ * the flags need all of them, as well as jumps and interrupts, which can save or restore the flags by themselves.
+ */
+template<typename ALU>
+U32 CPU<ALU>::get_flags_to_materialize(const Inst& inst)
+{
+    if ((inst.opcode & Opcodes::not_arithmetic) && (inst.opcode & Opcodes::jmp)) {
+        return arithmetic_lazy_flags;
+    }
+
+    if (!inst.get_flags) {
+        return 0;
+    }
+
+    switch (inst.opcode)
+    {
+    case Opcodes::ADD:
+    case Opcodes::SUB:
+    case Opcodes::CMP:
+    case Opcodes::INC:
+        return 0;
+
+    case Opcodes::AND:
+    case Opcodes::OR:
+    case Opcodes::TEST:
+        // The overflow flag is cleared, only the adjust flag is kept
+        return arithmetic_lazy_flags & ~(logic_lazy_flags | EFLAGS::OF);
+
+    default:
+        return arithmetic_lazy_flags;
+    }
+}
+
+
+/**
+ * Updates the flags depending on the result of the operation, or records the operation to update them later if lazy
+ * flags are enabled. The pending flags which are not overwritten by the operation were already computed.
+ * Flags which are dead after the current instruction are not computed.
+ */
+template<typename ALU>
+void CPU<ALU>::update_lazy_flags(EFLAGS& flags, FlagsOp op, U32 op1, U32 op2, U32 result,
+                                 OpSize op1_size, OpSize op2_size, OpSize ret_size, bit is_sub)
+{
+    const U32 mask = (op == FlagsOp::Arithmetic ? arithmetic_lazy_flags : logic_lazy_flags) & current_live_flags;
+    const PendingFlags pending{ mask, op, op1, op2, result, op1_size, op2_size, ret_size, is_sub };
+
+    if (lazy_flags && current_instruction->get_flags) {
+        pending_flags = pending;
+    }
+    else {
+        compute_pending_flags(flags, pending, mask);
+    }
+}
+
+
+template<typename ALU>
+void CPU<ALU>::compute_pending_flags(EFLAGS& flags, const PendingFlags& pending, U32 mask) const
+{
+    if (mask & EFLAGS::OF) {
+        flags.update_overflow_flag<ALU>(pending.op1, pending.op2, pending.result,
+                                        pending.op1_size, pending.op2_size, pending.ret_size, pending.is_sub);
+    }
+    if (mask & EFLAGS::SF) {
+        flags.update_sign_flag<ALU>(pending.result, pending.ret_size);
+    }
+    if (mask & EFLAGS::ZF) {
+        flags.update_zero_flag<ALU>(pending.result);
+    }
+    if (mask & EFLAGS::PF) {
+        flags.update_parity_flag<ALU>(pending.result);
+    }
+    if (mask & EFLAGS::AF) {
+        flags.update_adjust_flag<ALU>(pending.op1, pending.op2, pending.is_sub);
+    }
+}
+
+
+/**
+ * Computes the pending flags in the mask and stores them in the flags register.
+ */
+template<typename ALU>
+void CPU<ALU>::materialize_flags(U32 mask)
+{
+    const U32 to_compute = pending_flags.mask & mask;
+    if (to_compute == 0) {
+        return;
+    }
+
+    compute_pending_flags(registers.flags, pending_flags, to_compute);
+    pending_flags.mask &= ~to_compute;
+}
+
+
+template<typename ALU>
+void CPU<ALU>::set_lazy_flags(bit enabled)
+{
+    if (!enabled) {
+        materialize_flags();
+    }
+    lazy_flags = enabled;
+}
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
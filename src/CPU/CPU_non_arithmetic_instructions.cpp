@@ -12,7 +12,9 @@
  * @param ret Return value of the instruction
  * @param ret_2 Additional return value of the instruction
  */
-void CPU::execute_non_arithmetic_instruction(const U8 opcode, const InstData data, EFLAGS& flags, U32& ret, U32& ret_2)
+template<typename ALU>
+template<U8 opcode>
+void CPU<ALU>::execute_non_arithmetic_instruction(const InstData data, EFLAGS& flags, U32& ret, U32& ret_2)
 {
 	// TODO : check if ret and ret2 are both needed
 
@@ -36,7 +38,7 @@ void CPU::execute_non_arithmetic_instruction(const U8 opcode, const InstData dat
                 throw_exception(Interrupts::GeneralProtection);
 			}
 		}
-		ret = io.read(data.op2, data.op1_size);
+		ret = read_io(data.op2, data.op1_size);
 		break;
 	}
 	case Opcodes::LAR:
@@ -171,3 +173,26 @@ void CPU::execute_non_arithmetic_instruction(const U8 opcode, const InstData dat
 	registers.write_EIP(ALU::add_no_carry(registers.EIP, 1));
 }
 
+
+/**
+ * Returns the instance of CPU::execute_non_arithmetic_instruction() for the opcode, or nullptr if it is not a
+ * non-arithmetic instruction without a state machine.
+ */
+template<typename ALU>
+typename CPU<ALU>::ExecuteHandler CPU<ALU>::get_non_arithmetic_handler(U8 opcode)
+{
+    static constexpr auto handlers = []<size_t... indexes>(std::index_sequence<indexes...>) {
+        return std::array<ExecuteHandler, sizeof...(indexes)>{
+            &CPU::execute_non_arithmetic_instruction<U8(Opcodes::HLT + indexes)>...
+        };
+    }(std::make_index_sequence<Opcodes::WAIT - Opcodes::HLT + 1>());
+
+    if (!(opcode & Opcodes::not_arithmetic) || (opcode & Opcodes::state_machine)
+        || U8(opcode - Opcodes::HLT) >= handlers.size()) {
+        return nullptr;
+    }
+    return handlers[opcode - Opcodes::HLT];
+}
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
@@ -0,0 +1,55 @@
+
+#include <cstring>
+
+#include "CPU.h"
+
+
+/**
+ * Saves the state of the CPU and of the memory, to be restored with CPU::restore(). Replaces the previous snapshot.
+ *
+ * The memory is saved with copy-on-write, therefore taking a snapshot copies no memory, and restoring it only
+ * rewrites the pages written since.
+ */
+template<typename ALU>
+void CPU<ALU>::snapshot()
+{
+    if (!saved_state) {
+        saved_state = std::make_unique<Snapshot>();
+    }
+
+    saved_state->registers = registers;
+    saved_state->pending_flags = pending_flags;
+    saved_state->fault = fault;
+    saved_state->current_instruction = current_instruction;
+    saved_state->clock_cycle_count = clock_cycle_count;
+    saved_state->halted = halted;
+    std::memcpy(saved_state->io.data(), io.get_bytes(), IO_SIZE);
+
+    memory->snapshot();
+}
+
+
+/**
+ * Restores the state of the last snapshot. The snapshot stays valid, and can be restored again.
+ */
+template<typename ALU>
+void CPU<ALU>::restore()
+{
+    if (!saved_state) {
+        throw std::logic_error("No snapshot to restore");
+    }
+
+    registers = saved_state->registers;
+    pending_flags = saved_state->pending_flags;
+    fault = saved_state->fault;
+    current_instruction = saved_state->current_instruction;
+    clock_cycle_count = saved_state->clock_cycle_count;
+    halted = saved_state->halted;
+    std::memcpy(io.get_bytes(), saved_state->io.data(), IO_SIZE);
+
+    memory->restore();
+}
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
@@ -4,6 +4,38 @@
 #include "opcodes.h"
 
 
+/**
+ * Returns true if the condition of a Jcc instruction is met.
+ */
+template<typename ALU>
+bit CPU<ALU>::check_jump_condition(U8 condition, const EFLAGS& flags) const
+{
+    switch (condition)
+    {
+    case 0b00000: return  flags.get(EFLAGS::OF);              // Overflow                   OF = 1
+    case 0b00001: return !flags.get(EFLAGS::OF);              // Not overflow               OF = 0
+    case 0b00010: return  flags.get(EFLAGS::CF);              // Below | Carry | Not above or equal     CF = 1
+    case 0b00011: return !flags.get(EFLAGS::CF);              // Above or equal | Not below | Not carry CF = 0
+    case 0b00100: return  flags.get(EFLAGS::ZF);              // Equal | Zero               ZF = 1
+    case 0b00101: return !flags.get(EFLAGS::ZF);              // Not equal | Not zero       ZF = 0
+    case 0b00110: return  flags.get(EFLAGS::ZF | EFLAGS::CF); // Below or equal | Not above ZF = 1 || CF = 1
+    case 0b00111: return !flags.get(EFLAGS::ZF | EFLAGS::CF); // Above | Not below or equal ZF = 0 && CF = 0
+    case 0b01000: return  flags.get(EFLAGS::SF);              // Sign                       SF = 1
+    case 0b01001: return !flags.get(EFLAGS::SF);              // Not sign                   SF = 0
+    case 0b01010: return  flags.get(EFLAGS::PF);              // Parity | Parity even       PF = 1
+    case 0b01011: return !flags.get(EFLAGS::PF);              // Not parity | Parity odd    PF = 0
+    case 0b01100: return   flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF);  // Less | Not greater or equal SF != OF
+    case 0b01101: return !(flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); // Greater or Equal | Not less SF == OF
+    case 0b01110: return   flags.get(EFLAGS::ZF) |  (flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); // Less or equal | Not greater ZF = 1 ||  SF != OF
+    case 0b01111: return  !flags.get(EFLAGS::ZF) & !(flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); // Greater | Not less or equal ZF = 0 && (SF == OF)
+    case 0b10000: return ALU::check_equal_zero(U16(registers.read(Register::CX))); // CX register is zero CX = 0
+    case 0b10001: return ALU::check_equal_zero(registers.read(Register::ECX));     // ECX register is zero ECX = 0
+    default:
+        throw BadInstruction("Invalid Jump Type", registers.EIP);
+    }
+}
+
+
 /**
  * Handles more complex instructions, which may require several clock cycles to execute, or modifies the instruction
  * pointer explicitly.
@@ -11,7 +43,9 @@
  * @param data Holds instruction information
  * @param flags EFLAGS register
  */
-void CPU::execute_non_arithmetic_instruction_with_state_machine(const U8 opcode, const InstData data, EFLAGS& flags, U32& ret)
+template<typename ALU>
+template<U8 opcode>
+void CPU<ALU>::execute_non_arithmetic_instruction_with_state_machine(const InstData data, EFLAGS& flags, U32& ret)
 {
 	// All parameters are stored on pseudo registers which are read
 	// each loop. Their values cannot change during execution.
@@ -171,11 +205,11 @@ void CPU::execute_non_arithmetic_instruction_with_state_machine(const U8 opcode,
 				// build stack frame levels
 				if (data.op_size == OpSize::DW) {
 					storage.enter.ebp = ALU::sub_no_carry(storage.enter.ebp, 4);
-					push(memory->read(storage.enter.ebp, data.op_size), data.op_size);
+					push(memory_read(storage.enter.ebp, data.op_size), data.op_size);
 				}
 				else {
 					storage.enter.ebp = ALU::sub_no_carry(storage.enter.ebp, 2);
-					push(memory->read(storage.enter.ebp, data.op_size), data.op_size);
+					push(memory_read(storage.enter.ebp, data.op_size), data.op_size);
 				}
 				incr_index = 1;
 			}
@@ -196,32 +230,7 @@ void CPU::execute_non_arithmetic_instruction_with_state_machine(const U8 opcode,
 	}
 	case Opcodes::Jcc:
 	{
-		U8 condition = data.imm;
-		bit jump = 0;
-		switch (condition)
-		{
-        case 0b00000: jump =  flags.get(EFLAGS::OF); break;              // Overflow                   OF = 1
-        case 0b00001: jump = !flags.get(EFLAGS::OF); break;              // Not overflow               OF = 0
-        case 0b00010: jump =  flags.get(EFLAGS::CF); break;              // Below | Carry | Not above or equal     CF = 1
-        case 0b00011: jump = !flags.get(EFLAGS::CF); break;              // Above or equal | Not below | Not carry CF = 0
-        case 0b00100: jump =  flags.get(EFLAGS::ZF); break;              // Equal | Zero               ZF = 1
-        case 0b00101: jump = !flags.get(EFLAGS::ZF); break;              // Not equal | Not zero       ZF = 0
-        case 0b00110: jump =  flags.get(EFLAGS::ZF | EFLAGS::CF); break; // Below or equal | Not above ZF = 1 || CF = 1
-		case 0b00111: jump = !flags.get(EFLAGS::ZF | EFLAGS::CF); break; // Above | Not below or equal ZF = 0 && CF = 0
-        case 0b01000: jump =  flags.get(EFLAGS::SF); break;              // Sign                       SF = 1
-        case 0b01001: jump = !flags.get(EFLAGS::SF); break;              // Not sign                   SF = 0
-        case 0b01010: jump =  flags.get(EFLAGS::PF); break;              // Parity | Parity even       PF = 1
-        case 0b01011: jump = !flags.get(EFLAGS::PF); break;              // Not parity | Parity odd    PF = 0
-        case 0b01100: jump =   flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF);  break; // Less | Not greater or equal SF != OF
-        case 0b01101: jump = !(flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); break; // Greater or Equal | Not less SF == OF
-        case 0b01110: jump =   flags.get(EFLAGS::ZF) |  (flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); break; // Less or equal | Not greater ZF = 1 ||  SF != OF
-		case 0b01111: jump =  !flags.get(EFLAGS::ZF) & !(flags.get(EFLAGS::SF) ^ flags.get(EFLAGS::OF)); break; // Greater | Not less or equal ZF = 0 && (SF == OF)
-		case 0b10000: jump = ALU::check_equal_zero(U16(registers.read(Register::CX))); break; // CX register is zero CX = 0
-		case 0b10001: jump = ALU::check_equal_zero(registers.read(Register::ECX));     break; // ECX register is zero ECX = 0
-        default:
-            throw BadInstruction("Invalid Jump Type", registers.EIP);
-		}
-		if (jump) {
+		if (check_jump_condition(data.imm, flags)) {
             registers.write_EIP(data.op1);
 		} else {
             registers.write_EIP(ALU::add_no_carry(registers.EIP, 1));
@@ -289,3 +298,41 @@ void CPU::execute_non_arithmetic_instruction_with_state_machine(const U8 opcode,
 		registers.write_EIP(ALU::add_no_carry(registers.EIP, 1));
 	}
 }
+
+
+/**
+ * State machine instructions have only one return value.
+ */
+template<typename ALU>
+template<U8 opcode>
+void CPU<ALU>::execute_state_machine_instruction(const InstData data, EFLAGS& flags, U32& ret, U32&)
+{
+    execute_non_arithmetic_instruction_with_state_machine<opcode>(data, flags, ret);
+}
+
+
+/**
+ * Returns the instance of CPU::execute_state_machine_instruction() for the opcode, or nullptr if it is not a state
+ * machine, jump or string instruction. Each of the three groups has up to 8 opcodes.
+ */
+template<typename ALU>
+typename CPU<ALU>::ExecuteHandler CPU<ALU>::get_state_machine_handler(U8 opcode)
+{
+    static constexpr U8 group_size = 8;
+    static constexpr auto handlers = []<size_t... indexes>(std::index_sequence<indexes...>) {
+        return std::array<ExecuteHandler, sizeof...(indexes)>{
+            &CPU::execute_state_machine_instruction<
+                U8(Opcodes::not_arithmetic | ((indexes / group_size + 1) << 5) | (indexes % group_size))>...
+        };
+    }(std::make_index_sequence<3 * group_size>());
+
+    const U8 group = (opcode & Opcodes::state_machine) >> 5;
+    const U8 index = opcode & 0b11111;
+    if (!(opcode & Opcodes::not_arithmetic) || group == 0 || index >= group_size) {
+        return nullptr;
+    }
+    return handlers[(group - 1) * group_size + index];
+}
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
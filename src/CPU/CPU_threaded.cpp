@@ -0,0 +1,171 @@
+#include <algorithm>
+
+#include "CPU.h"
+#include "opcodes.h"
+
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MCX86_THREADED_DISPATCH 1
+#else
+#define MCX86_THREADED_DISPATCH 0
+#endif
+
+
+/*
+ * All opcodes, each of them has its own handler in CPU::run_threaded().
+ */
+#define MCX86_OPCODES(X)                                                                                              \
+    X(AAA) X(AAD) X(AAM) X(AAS) X(ADC) X(ADD) X(AND) X(ARPL) X(BOUND) X(BSF) X(BSR) X(BT) X(BTC) X(BTR) X(BTS)       \
+    X(CBW) X(CLC) X(CLD) X(CLI) X(CLTS) X(CMC) X(CMP) X(CWD) X(DAA) X(DAS) X(DEC) X(DIV) X(IDIV) X(IMUL) X(INC)      \
+    X(LAHF) X(LEA) X(MOV) X(MOVSX) X(MOVZX) X(MUL) X(NEG) X(NOP) X(NOT) X(OR) X(ROT) X(SAHF) X(SHFT) X(SBB)          \
+    X(SETcc) X(SHD) X(STC) X(STD) X(STI) X(SUB) X(TEST) X(XCHG) X(XLAT) X(XOR) X(IMULX) X(MULX)                      \
+    X(HLT) X(IN) X(LAR) X(LGDT) X(LGS) X(LLDT) X(LMSW) X(LOCK) X(LSL) X(LTR) X(OUT) X(POP) X(POPF) X(PUSH) X(PUSHF)  \
+    X(SGDT) X(SLDT) X(SMSW) X(STR) X(VERR) X(WAIT)                                                                   \
+    X(CMPS) X(INS) X(LODS) X(MOVS) X(OUTS) X(SCAS) X(STOS)                                                           \
+    X(CALL) X(INT) X(IRET) X(Jcc) X(JMP) X(LOOP) X(REP) X(RET)                                                       \
+    X(ENTER) X(LEAVE) X(POPA) X(PUSHA)
+
+
+/**
+ * Executes the instructions until the end of the program or the maximum number of cycles is reached, like CPU::run().
+ *
+ * Each opcode has its own handler, as well as the shortcuts of the other dispatch kinds. Each handler ends by fetching
+ * the next instruction and jumping directly to its handler (with the labels-as-values extension of GCC and Clang),
+ * instead of going back to a single dispatch point. This gives one indirect jump per opcode to the branch predictor,
+ * which can then learn the common sequences of the program, and the calls to the handlers of the decoded instruction
+ * are made from each opcode handler, where they are much more predictable. Compilers without this extension use a
+ * switch in a loop.
+ *
+ * Blocks are not used here, therefore neither is the JIT. When logging, or when instructions are watched for execution,
+ * CPU::run() is used instead.
+ */
+template<typename ALU>
+void CPU<ALU>::run_threaded(size_t max_cycles)
+{
+    if (Logger::get_mode() != Logger::Mode::OFF || memory->has_exec_watchpoints()) {
+        run(max_cycles);
+        return;
+    }
+
+    (void) resume_after_watchpoint();
+
+    // Generic instructions use the handler of their opcode, the others the one of their dispatch kind
+    static constexpr U32 dispatch_handlers = 256;
+    auto get_handler_index = [](const DecodedInst& decoded) {
+        return decoded.dispatch == Dispatch::Generic ? U32(decoded.inst->opcode)
+                                                     : dispatch_handlers + U32(decoded.dispatch);
+    };
+
+    const DecodedInst* decoded = nullptr;
+    const U32 text_pos = memory->text_pos;
+
+#if MCX86_THREADED_DISPATCH
+    const void* handlers[dispatch_handlers + U32(Dispatch::DirectJmp) + 1];
+    std::fill(std::begin(handlers), std::begin(handlers) + dispatch_handlers, &&handler_unknown_opcode);
+#define SET_OPCODE_HANDLER(name) handlers[Opcodes::name] = &&handler_opcode_##name;
+    MCX86_OPCODES(SET_OPCODE_HANDLER)
+#undef SET_OPCODE_HANDLER
+    handlers[dispatch_handlers + U32(Dispatch::Generic)] = &&handler_unknown_opcode; // Unused
+    handlers[dispatch_handlers + U32(Dispatch::FusedPair)] = &&handler_FusedPair;
+    handlers[dispatch_handlers + U32(Dispatch::DirectJcc)] = &&handler_DirectJcc;
+    handlers[dispatch_handlers + U32(Dispatch::DirectJmp)] = &&handler_DirectJmp;
+
+#define OPCODE_HANDLER(name) handler_opcode_##name:
+#define UNKNOWN_OPCODE_HANDLER() handler_unknown_opcode:
+#define HANDLER(name) handler_##name:
+#define DISPATCH()                                                     \
+    if (halted || fault.is_set() || clock_cycle_count >= max_cycles) { \
+        goto end;                                                      \
+    }                                                                  \
+    decoded = &decoded_instructions.at(registers.EIP - text_pos);      \
+    goto *handlers[get_handler_index(*decoded)]
+#else
+#define OPCODE_HANDLER(name) case Opcodes::name:
+#define UNKNOWN_OPCODE_HANDLER() default:
+#define HANDLER(name) case dispatch_handlers + U32(Dispatch::name):
+#define DISPATCH() continue
+#endif
+
+#define EXECUTE_OPCODE(name)            \
+        OPCODE_HANDLER(name)            \
+        {                               \
+            new_clock_cycle();          \
+            execute_handlers(*decoded); \
+            DISPATCH();                 \
+        }
+
+    try {
+#if MCX86_THREADED_DISPATCH
+        DISPATCH();
+#else
+        while (!halted && !fault.is_set() && clock_cycle_count < max_cycles) {
+            decoded = &decoded_instructions.at(registers.EIP - text_pos);
+            switch (get_handler_index(*decoded))
+            {
+#endif
+
+        MCX86_OPCODES(EXECUTE_OPCODE)
+
+        UNKNOWN_OPCODE_HANDLER()
+        {
+            // Raises the exception of the unknown opcode
+            new_clock_cycle();
+            execute_handlers(*decoded);
+            DISPATCH();
+        }
+
+        HANDLER(FusedPair)
+        {
+            new_clock_cycle();
+            execute_handlers(*decoded);
+
+            if (macro_fusion && clock_cycle_count < max_cycles && !fault.is_set()) {
+                new_clock_cycle();
+                execute_direct_jcc(decoded[1]);
+            }
+            DISPATCH();
+        }
+
+        HANDLER(DirectJcc)
+        {
+            new_clock_cycle();
+            execute_direct_jcc(*decoded);
+            DISPATCH();
+        }
+
+        HANDLER(DirectJmp)
+        {
+            new_clock_cycle();
+            current_instruction = decoded->inst;
+            registers.write_EIP(decoded->inst->address_value);
+            DISPATCH();
+        }
+
+#if !MCX86_THREADED_DISPATCH
+            }
+        }
+#endif
+    }
+    catch (ExceptionWithMsg& e) {
+        LOG_ERROR(e.what() << "\n");
+    }
+
+#if MCX86_THREADED_DISPATCH
+end:
+#endif
+    if (clock_cycle_count >= max_cycles) {
+        LOG_DEBUG("Max cycles reached. Interrupting program.\n");
+    }
+
+    LOG_DEBUG("Program finished in " << clock_cycle_count << " cycles.\n");
+
+#undef OPCODE_HANDLER
+#undef UNKNOWN_OPCODE_HANDLER
+#undef HANDLER
+#undef DISPATCH
+#undef EXECUTE_OPCODE
+}
+
+
+template class CPU<CircuitALU>;
+template class CPU<NativeALU>;
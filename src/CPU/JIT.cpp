@@ -0,0 +1,394 @@
+
+#include "JIT.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if MCX86_JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "CPU.h"
+#include "opcodes.h"
+
+
+namespace
+{
+    /**
+     * Minimal x86-64 encoder, for the few instructions needed by the JIT.
+     * The CPU pointer is always in RBX, and the fields of the CPU are accessed with a 32 bit displacement from it.
+     */
+    class Emitter
+    {
+    public:
+        enum HostReg : U8 { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESI = 6, EDI = 7 };
+
+        std::vector<U8> code;
+
+        void byte(U8 b) { code.push_back(b); }
+
+        void dword(U32 dw)
+        {
+            for (int i = 0; i < 4; i++) {
+                code.push_back(U8(dw >> (8 * i)));
+            }
+        }
+
+        void qword(U64 qw)
+        {
+            dword(U32(qw));
+            dword(U32(qw >> 32));
+        }
+
+        // mov r32, [rbx + disp32]
+        void load(HostReg reg, I32 disp) { byte(0x8B); byte(0x83 | (reg << 3)); dword(disp); }
+
+        // mov [rbx + disp32], r32
+        void store(I32 disp, HostReg reg) { byte(0x89); byte(0x83 | (reg << 3)); dword(disp); }
+
+        // mov dword [rbx + disp32], imm32
+        void store_imm(I32 disp, U32 imm) { byte(0xC7); byte(0x83); dword(disp); dword(imm); }
+
+        // add dword [rbx + disp32], imm8
+        void increment(I32 disp) { byte(0x83); byte(0x83); dword(disp); byte(1); }
+
+        // mov r32, imm32
+        void load_imm(HostReg reg, U32 imm) { byte(0xB8 + reg); dword(imm); }
+
+        // <op> eax, ecx, with 'op' being the opcode of the 'r/m32, r32' form
+        void alu_eax_ecx(U8 op) { byte(op); byte(0xC8); }
+
+        // and r32, imm32
+        void and_imm(HostReg reg, U32 imm) { byte(0x81); byte(0xE0 | reg); dword(imm); }
+
+        // pushfq; pop rdx
+        void host_flags_to_edx() { byte(0x9C); byte(0x5A); }
+
+        // or esi, edx
+        void or_esi_edx() { byte(0x09); byte(0xD6); }
+
+        // mov rdi, rbx; mov esi, imm32; mov rax, imm64; call rax
+        void call_helper(const void* function, U32 arg)
+        {
+            byte(0x48); byte(0x89); byte(0xDF);
+            load_imm(ESI, arg);
+            byte(0x48); byte(0xB8); qword(reinterpret_cast<U64>(function));
+            byte(0xFF); byte(0xD0);
+        }
+
+        // test eax, eax; jnz rel32. Returns the position of the displacement to patch.
+        size_t jump_if_eax_not_zero()
+        {
+            byte(0x85); byte(0xC0);
+            byte(0x0F); byte(0x85);
+            size_t pos = code.size();
+            dword(0);
+            return pos;
+        }
+
+        void patch_jump(size_t pos, size_t target)
+        {
+            U32 rel = U32(target - (pos + 4));
+            std::memcpy(code.data() + pos, &rel, sizeof(rel));
+        }
+
+        // push rbx; mov rbx, rdi
+        void prologue() { byte(0x53); byte(0x48); byte(0x89); byte(0xFB); }
+
+        // mov eax, imm32; pop rbx; ret
+        void epilogue(U32 ret) { load_imm(EAX, ret); byte(0x5B); byte(0xC3); }
+    };
+
+
+    bit is_general_register(Register reg)
+    {
+        return reg <= Register::EDI;
+    }
+
+
+    /**
+     * Returns true if the instruction only works on 32 bit general purpose registers and immediate values, and has
+     * its result and flags computed the same way by the host.
+     */
+    bit can_compile_natively(const Inst& inst)
+    {
+        if (inst.compute_address || inst.operand_size_override || inst.operand_byte_size_override
+            || inst.write_ret2_to_op2 || inst.write_ret2_to_register) {
+            return false;
+        }
+
+        if (!inst.op2.read || !(inst.op2.type == OpType::IMM
+                                || (inst.op2.type == OpType::REG && is_general_register(inst.op2.reg)))) {
+            return false;
+        }
+
+        if (inst.op1.type != OpType::REG || !is_general_register(inst.op1.reg)) {
+            return false;
+        }
+
+        switch (inst.opcode)
+        {
+        case Opcodes::MOV:
+            return inst.write_ret1_to_op1;
+
+        case Opcodes::ADD:
+        case Opcodes::SUB:
+        case Opcodes::AND:
+        case Opcodes::OR:
+        case Opcodes::XOR:
+            return inst.op1.read;
+
+        case Opcodes::CMP:
+        case Opcodes::TEST:
+            // Those have no result, writing it would store 0 into the register
+            return inst.op1.read && !inst.write_ret1_to_op1;
+
+        default:
+            return false;
+        }
+    }
+}
+
+
+template<typename ALU>
+JIT::JIT(const CPU<ALU>& cpu, size_t blocks_count)
+    : blocks(blocks_count)
+{
+    auto offset = [&](const void* field) {
+        return I32(reinterpret_cast<const U8*>(field) - reinterpret_cast<const U8*>(&cpu));
+    };
+
+    registers_offset = offset(&cpu.registers.registers[0]);
+    flags_offset = offset(&cpu.registers.flags.value);
+    EIP_offset = offset(&cpu.registers.EIP);
+    clock_offset = offset(&cpu.clock_cycle_count);
+
+#if MCX86_JIT_AVAILABLE
+    void* buffer = mmap(nullptr, code_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        code_buffer = static_cast<U8*>(buffer);
+    }
+#endif
+}
+
+
+JIT::~JIT()
+{
+#if MCX86_JIT_AVAILABLE
+    if (code_buffer != nullptr) {
+        munmap(code_buffer, code_buffer_size);
+    }
+#endif
+}
+
+
+template<typename ALU>
+JIT::BlockFunction JIT::get_block_function(const CPU<ALU>& cpu, size_t block_index)
+{
+    if (disabled) {
+        return nullptr;
+    }
+
+    BlockState& state = blocks[block_index];
+    if (state.function != nullptr || state.failed) {
+        return state.function;
+    }
+
+    if (state.hits++ < threshold) {
+        return nullptr;
+    }
+
+    state.function = compile_block(cpu, block_index);
+    state.failed = state.function == nullptr;
+    return state.function;
+}
+
+
+void JIT::rethrow_pending_exception()
+{
+    std::exception_ptr exception = pending_exception;
+    pending_exception = nullptr;
+    std::rethrow_exception(exception);
+}
+
+
+/**
+ * Translates a block into machine code, which is appended to the code buffer.
+ * Native instructions update the clock cycle count and the registers themselves, while EIP is only stored before
+ * calling the interpreter and at the end of the block.
+ */
+template<typename ALU>
+JIT::BlockFunction JIT::compile_block(const CPU<ALU>& cpu, size_t block_index)
+{
+#if MCX86_JIT_AVAILABLE
+    if (code_buffer == nullptr) {
+        return nullptr;
+    }
+
+    const typename CPU<ALU>::BasicBlock& block = cpu.basic_blocks[block_index];
+    const U32 text_pos = cpu.memory->text_pos;
+
+    Emitter emitter;
+    std::vector<size_t> exit_jumps;
+    bit EIP_up_to_date = false;
+    size_t native_count = 0;
+
+    emitter.prologue();
+
+    for (U32 index = block.first; index < block.end; index++) {
+        const Inst& inst = *cpu.decoded_instructions[index].inst;
+
+        if (!can_compile_natively(inst)) {
+            // Let the interpreter handle it
+            emitter.store_imm(EIP_offset, text_pos + index);
+            emitter.call_helper(reinterpret_cast<const void*>(&JIT::execute_instruction<ALU>), index);
+            exit_jumps.push_back(emitter.jump_if_eax_not_zero());
+            EIP_up_to_date = true;
+            continue;
+        }
+
+        native_count++;
+        EIP_up_to_date = false;
+
+        emitter.increment(clock_offset);
+
+        const I32 op1_offset = registers_offset + I32(sizeof(U32) * inst.op1_reg_index());
+        if (inst.op2.type == OpType::IMM) {
+            emitter.load_imm(Emitter::ECX, inst.immediate_value);
+        }
+        else {
+            emitter.load(Emitter::ECX, registers_offset + I32(sizeof(U32) * inst.op2_reg_index()));
+        }
+
+        if (inst.opcode == Opcodes::MOV) {
+            emitter.store(op1_offset, Emitter::ECX);
+            continue;
+        }
+
+        emitter.load(Emitter::EAX, op1_offset);
+
+        // Opcode of the host instruction, and which flags are updated like the host does, and which are cleared
+        U8 host_op;
+        U32 host_flags;
+        U32 cleared_flags = 0;
+        switch (inst.opcode)
+        {
+        case Opcodes::ADD:
+            host_op = 0x01;
+            host_flags = EFLAGS::CF | EFLAGS::PF | EFLAGS::AF | EFLAGS::ZF | EFLAGS::SF | EFLAGS::OF;
+            break;
+
+        case Opcodes::SUB:
+        case Opcodes::CMP:
+            // The carry flag is only set by the circuit, never cleared, see EFLAGS::update_carry_flag
+            host_op = inst.opcode == Opcodes::SUB ? 0x29 : 0x39;
+            host_flags = EFLAGS::PF | EFLAGS::AF | EFLAGS::ZF | EFLAGS::SF | EFLAGS::OF;
+            break;
+
+        case Opcodes::AND:
+        case Opcodes::OR:
+        case Opcodes::TEST:
+            host_op = inst.opcode == Opcodes::AND ? 0x21 : inst.opcode == Opcodes::OR ? 0x09 : 0x85;
+            host_flags = EFLAGS::PF | EFLAGS::ZF | EFLAGS::SF;
+            cleared_flags = EFLAGS::CF | EFLAGS::OF;
+            break;
+
+        case Opcodes::XOR:
+        default:
+            // XOR does not change the flags
+            host_op = 0x31;
+            host_flags = 0;
+            break;
+        }
+
+        emitter.alu_eax_ecx(host_op);
+
+        if (inst.get_flags && host_flags != 0) {
+            bit carry_is_or = inst.opcode == Opcodes::SUB || inst.opcode == Opcodes::CMP;
+
+            emitter.host_flags_to_edx();
+            emitter.and_imm(Emitter::EDX, host_flags | (carry_is_or ? EFLAGS::CF : 0));
+            emitter.load(Emitter::ESI, flags_offset);
+            emitter.and_imm(Emitter::ESI, ~(host_flags | cleared_flags));
+            emitter.or_esi_edx();
+            emitter.store(flags_offset, Emitter::ESI);
+        }
+
+        if (inst.write_ret1_to_op1) {
+            emitter.store(op1_offset, Emitter::EAX);
+        }
+    }
+
+    if (!EIP_up_to_date) {
+        emitter.store_imm(EIP_offset, text_pos + block.end);
+    }
+
+    emitter.epilogue(0);
+
+    size_t exit_pos = emitter.code.size();
+    for (size_t pos : exit_jumps) {
+        emitter.patch_jump(pos, exit_pos);
+    }
+    emitter.epilogue(1);
+
+    if (code_size + emitter.code.size() > code_buffer_size) {
+        return nullptr;
+    }
+
+    // Only the pages of the new block are writable, and only while it is copied to them
+    const size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    const size_t pages_start = code_size & ~(page_size - 1);
+    const size_t pages_end = (code_size + emitter.code.size() + page_size - 1) & ~(page_size - 1);
+    U8* pages = code_buffer + pages_start;
+    const size_t pages_size = std::min(pages_end, code_buffer_size) - pages_start;
+
+    if (mprotect(pages, pages_size, PROT_READ | PROT_WRITE) != 0) {
+        return nullptr;
+    }
+
+    U8* function_code = code_buffer + code_size;
+    std::memcpy(function_code, emitter.code.data(), emitter.code.size());
+
+    if (mprotect(pages, pages_size, PROT_READ | PROT_EXEC) != 0) {
+        // The end of the previous block may be in the first page, which is no longer executable
+        disabled = true;
+        return nullptr;
+    }
+
+    code_size += emitter.code.size();
+
+    compiled_blocks_count++;
+    native_instructions_count += native_count;
+
+    return reinterpret_cast<BlockFunction>(function_code);
+#else
+    return nullptr;
+#endif
+}
+
+
+/**
+ * Called by the compiled code to execute an instruction with the interpreter. Exceptions cannot cross the compiled
+ * code, they are kept until the block returns. Faults which are not thrown also end the block.
+ */
+template<typename ALU>
+int JIT::execute_instruction(CPU<ALU>* cpu, U32 index)
+{
+    try {
+        cpu->new_clock_cycle();
+        cpu->execute_decoded_instruction(cpu->decoded_instructions[index]);
+        cpu->materialize_flags(); // The next native instructions may use the flags
+        return cpu->fault.is_set() ? 1 : 0;
+    }
+    catch (...) {
+        cpu->jit->pending_exception = std::current_exception();
+        return 1;
+    }
+}
+
+
+template JIT::JIT(const CPU<CircuitALU>& cpu, size_t blocks_count);
+template JIT::JIT(const CPU<NativeALU>& cpu, size_t blocks_count);
+template JIT::BlockFunction JIT::get_block_function(const CPU<CircuitALU>& cpu, size_t block_index);
+template JIT::BlockFunction JIT::get_block_function(const CPU<NativeALU>& cpu, size_t block_index);
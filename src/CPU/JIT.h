@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <exception>
+
+#include "../data_types.h"
+
+
+#if defined(__x86_64__) && defined(__unix__)
+#define MCX86_JIT_AVAILABLE 1
+#else
+#define MCX86_JIT_AVAILABLE 0
+#endif
+
+
+template<typename ALU>
+class CPU;
+
+
+/**
+ * Compiles the hot basic blocks of a CPU into x86-64 machine code.
+ *
+ * Simple register and immediate arithmetic is translated to native instructions, which work directly on the
+ * registers and flags of the CPU. All other instructions (memory operands, state machine instructions, jumps...) are
+ * compiled to a call to the interpreter. A block is always executed entirely, and faults are reported by returning
+ * from the block, with the exception stored to be re-thrown by the CPU.
+ */
+class JIT
+{
+public:
+    /**
+     * Compiled code of a block. Returns 0 if the block was executed entirely, or 1 if an exception was raised.
+     */
+    using BlockFunction = int (*)(void* cpu);
+
+    static constexpr U32 default_threshold = 16;
+    static constexpr size_t code_buffer_size = 1 << 20;
+
+    template<typename ALU>
+    explicit JIT(const CPU<ALU>& cpu, size_t blocks_count);
+    ~JIT();
+
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+
+    /**
+     * Returns true if the JIT can be used on this host.
+     */
+    static constexpr bit is_available() { return MCX86_JIT_AVAILABLE; }
+
+    /**
+     * Returns the compiled code of the block, compiling it if it has been entered more times than the threshold.
+     * Returns nullptr if the block should be interpreted.
+     */
+    template<typename ALU>
+    BlockFunction get_block_function(const CPU<ALU>& cpu, size_t block_index);
+
+    void set_threshold(U32 new_threshold) { threshold = new_threshold; }
+
+    /**
+     * Re-throws the exception raised by the last block which returned 1.
+     */
+    [[noreturn]] void rethrow_pending_exception();
+
+    /**
+     * Returns true if the code buffer could not be made executable again after adding a block to it. No compiled
+     * block is executed after that, the CPU only uses the interpreter.
+     */
+    [[nodiscard]] bit is_disabled() const { return disabled; }
+
+    [[nodiscard]] size_t get_compiled_blocks_count() const { return compiled_blocks_count; }
+    [[nodiscard]] size_t get_native_instructions_count() const { return native_instructions_count; }
+
+private:
+    struct BlockState
+    {
+        U32 hits = 0;
+        bit failed = false; // The block could not be compiled, don't try again
+        BlockFunction function = nullptr;
+    };
+
+    std::vector<BlockState> blocks;
+    U32 threshold = default_threshold;
+
+    U8* code_buffer = nullptr;
+    size_t code_size = 0;
+    bit disabled = false;
+
+    // Offsets of the fields of the CPU used by the compiled code
+    I32 registers_offset;
+    I32 flags_offset;
+    I32 EIP_offset;
+    I32 clock_offset;
+
+    std::exception_ptr pending_exception;
+
+    size_t compiled_blocks_count = 0;
+    size_t native_instructions_count = 0;
+
+    template<typename ALU>
+    BlockFunction compile_block(const CPU<ALU>& cpu, size_t block_index);
+
+    template<typename ALU>
+    static int execute_instruction(CPU<ALU>* cpu, U32 index);
+};
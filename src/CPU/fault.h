@@ -0,0 +1,121 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <stdexcept>
+
+#include "../data_types.h"
+#include "exceptions.h"
+#include "../memory/exceptions.hpp"
+
+
+enum class FaultKind : U8
+{
+    None,
+    MemoryAccess, // Mem::WrongMemoryAccess
+    Processor,    // ProcessorException
+    Watchpoint,   // Not an error: the access was made, and the execution can continue
+};
+
+
+/**
+ * Access which triggered a watchpoint.
+ */
+struct WatchpointHit
+{
+    U8 kind = 0;         // Mem::WatchKind of the access
+    U8 size = 0;         // Size of the access, in bytes
+    U32 old_value = 0;   // Value before the access, the same as the new value except for writes
+    U32 new_value = 0;
+    U32 instruction = 0; // Index of the instruction which made the access
+};
+
+
+/**
+ * Status record of a fault, used instead of an exception when the CPU doesn't throw on faults.
+ *
+ * Only the data needed to describe the fault is stored, the message is formatted when asked for, and is the same as
+ * the one of the equivalent exception.
+ */
+struct Fault
+{
+    FaultKind kind = FaultKind::None;
+    const char* msg = nullptr; // Static description of the memory fault, or the mnemonic of the processor exception
+    U32 address = 0;           // Address of the memory access, or position of the faulting instruction
+    U8 vector = 0;             // Vector of the processor exception
+    WatchpointHit watchpoint;  // Details of the access of a watchpoint hit
+
+    [[nodiscard]] static Fault memory_access(const char* msg, U32 address)
+    {
+        Fault fault;
+        fault.kind = FaultKind::MemoryAccess;
+        fault.msg = msg;
+        fault.address = address;
+        return fault;
+    }
+
+    [[nodiscard]] static Fault processor(const char* mnemonic, U32 address, U8 vector)
+    {
+        Fault fault;
+        fault.kind = FaultKind::Processor;
+        fault.msg = mnemonic;
+        fault.address = address;
+        fault.vector = vector;
+        return fault;
+    }
+
+    [[nodiscard]] static Fault watchpoint_hit(const char* msg, U32 address, const WatchpointHit& hit)
+    {
+        Fault fault;
+        fault.kind = FaultKind::Watchpoint;
+        fault.msg = msg;
+        fault.address = address;
+        fault.watchpoint = hit;
+        return fault;
+    }
+
+    [[nodiscard]] bit is_set() const { return kind != FaultKind::None; }
+
+    /**
+     * Returns true if the fault stops the instruction, which is the case of all faults except watchpoint hits.
+     */
+    [[nodiscard]] bit is_error() const { return kind != FaultKind::None && kind != FaultKind::Watchpoint; }
+
+    void clear() { kind = FaultKind::None; }
+
+    [[nodiscard]] std::string format() const
+    {
+        switch (kind)
+        {
+        case FaultKind::MemoryAccess: return Mem::WrongMemoryAccess(msg, address).what();
+        case FaultKind::Processor:    return ProcessorException(msg, address, vector).what();
+        case FaultKind::Watchpoint:   return format_watchpoint();
+        case FaultKind::None:
+        default:                      return "";
+        }
+    }
+
+    [[nodiscard]] std::string format_watchpoint() const
+    {
+        std::stringstream ss;
+        ss << msg << " hit at 0x" << std::hex << address << " by instruction " << std::dec << watchpoint.instruction
+           << " (" << int(watchpoint.size) << " bytes: 0x" << std::hex << watchpoint.old_value
+           << " -> 0x" << watchpoint.new_value << ")";
+        return ss.str();
+    }
+
+    /**
+     * Throws the exception equivalent to the fault.
+     */
+    [[noreturn]] void raise() const
+    {
+        switch (kind)
+        {
+        case FaultKind::MemoryAccess: throw Mem::WrongMemoryAccess(msg, address);
+        case FaultKind::Processor:    throw ProcessorException(msg, address, vector);
+        case FaultKind::Watchpoint:   throw std::logic_error("Watchpoint hits are not raised");
+        case FaultKind::None:
+        default:                      throw std::logic_error("No fault to raise");
+        }
+    }
+};
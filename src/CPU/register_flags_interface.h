@@ -67,24 +67,29 @@ public:
 
     /*
      * The following methods implements the most used logic for updating a flag after an instruction.
+     * They use the same ALU as the CPU executing the instruction.
      */
 
+    template<typename ALU = CircuitALU>
     constexpr void update_sign_flag(U32 result, OpSize size)
     {
         set_val(EFLAGS::SF, ALU::check_is_negative(result, size));
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_zero_flag(U32 result)
     {
         set_val(EFLAGS::ZF, ALU::check_equal_zero(result));
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_parity_flag(U32 result)
     {
         // Parity check is made only on the first byte
         set_val(EFLAGS::PF, ALU::check_parity(U8(result & 0xFF)));
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_carry_flag(U32 op_1, U32 op_2, bit carry, bit is_sub = 0)
     {
         if (is_sub) {
@@ -97,6 +102,7 @@ public:
         }
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_overflow_flag(U32 op1, U32 op2, U32 result, OpSize op1Size, OpSize op2Size, OpSize retSize,
                                         bit is_sub = 0)
     {
@@ -125,6 +131,7 @@ public:
         set_val(EFLAGS::OF, val);
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_adjust_flag(U32 op_1, U32 op_2, bit is_sub = 0)
     {
         // Adjust flag is set only if there were a carry from the first 4 bits of the AL register to the 4 other bits.
@@ -138,16 +145,17 @@ public:
         set_val(EFLAGS::AF, val);
     }
 
+    template<typename ALU = CircuitALU>
     constexpr void update_status_flags(U32 op_1, U32 op_2, U32 result,
                                        OpSize op_1_size, OpSize op_2_size, OpSize ret_size,
                                        bit carry, bit is_sub = 0)
     {
-        update_overflow_flag(op_1, op_2, result, op_1_size, op_2_size, ret_size, is_sub);
-        update_sign_flag(result, ret_size);
-        update_zero_flag(result);
-        update_parity_flag(result);
-        update_carry_flag(op_1, op_2, carry, is_sub);
-        update_adjust_flag(op_1, op_2, is_sub);
+        update_overflow_flag<ALU>(op_1, op_2, result, op_1_size, op_2_size, ret_size, is_sub);
+        update_sign_flag<ALU>(result, ret_size);
+        update_zero_flag<ALU>(result);
+        update_parity_flag<ALU>(result);
+        update_carry_flag<ALU>(op_1, op_2, carry, is_sub);
+        update_adjust_flag<ALU>(op_1, op_2, is_sub);
     }
 };
 
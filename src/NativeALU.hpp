@@ -0,0 +1,302 @@
+#pragma once
+
+#include <type_traits>
+
+#include "data_types.h"
+#include "ALU.hpp"
+
+
+/**
+ * Implementation of the ALU using the arithmetic of the host.
+ *
+ * All operations return the same results and flags as CircuitALU, including its quirks: the overflow of 'multiply'
+ * comes only from the partial sums, 'signed_divide' reverses the remainder, 'sign_extend' extends from the half of the
+ * given size, etc... Operations which are already cheap in the circuit model (bitwise operations, rotations, shifts)
+ * are inherited from it, as well as the 64 bit variants of the comparisons and of the division, which rely on the
+ * exact behaviour of the circuit for those sizes.
+ *
+ * All functions calling other ALU functions must be redefined here, so that they call the native versions.
+ */
+struct NativeALU : CircuitALU
+{
+    template<typename N>
+    static constexpr bit check_parity(const N n)
+    {
+        static_assert(std::is_integral<N>{}, "check_parity operand must be of integral type");
+
+        return !__builtin_parityll(U64(std::make_unsigned_t<N>(n)));
+    }
+
+
+    template<typename N>
+    static constexpr bit check_power_of_2(const N n)
+    {
+        static_assert(std::is_integral<N>{}, "check_power_of_2 operand must be of integral type");
+        static_assert(std::is_unsigned<N>{}, "check_power_of_2 operand must be an unsigned type");
+
+        return __builtin_popcountll(U64(n)) == 1;
+    }
+
+
+    template<typename A, typename B>
+    static constexpr bit compare_equal(const A a, const B b)
+    {
+        static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_equal operands must be of integral type");
+        static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_equal' must have read least the same bit length than the second");
+
+        using UA = std::make_unsigned_t<A>;
+        return UA(a) == UA(b);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr bit compare_greater_or_equal_with_eq(const A a, const B b, bit& equal)
+    {
+        if constexpr (sizeof(A) > sizeof(U32)) {
+            return CircuitALU::compare_greater_or_equal_with_eq(a, b, equal);
+        }
+        else {
+            static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_greater_or_equal operands must be of integral type");
+            static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_greater_or_equal' must have read least the same bit length than the second");
+
+            using UA = std::make_unsigned_t<A>;
+            equal = UA(a) == UA(b);
+            return UA(a) >= UA(b);
+        }
+    }
+
+
+    template<typename A, typename B>
+    static constexpr bit compare_greater_or_equal(const A a, const B b)
+    {
+        bit equal = 0;
+        return compare_greater_or_equal_with_eq(a, b, equal);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr bit compare_greater(const A a, const B b)
+    {
+        if constexpr (sizeof(A) > sizeof(U32)) {
+            return CircuitALU::compare_greater(a, b);
+        }
+        else {
+            static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "compare_greater operands must be of integral type");
+            static_assert(sizeof(A) >= sizeof(B), "First operand of 'compare_greater' must have read least the same bit length than the second");
+
+            using UA = std::make_unsigned_t<A>;
+            return UA(a) > UA(b);
+        }
+    }
+
+
+    template<typename N>
+    static constexpr N sign_extend(const N n, const OpSize prev_size = OpSize::UNKNOWN)
+    {
+        if constexpr (sizeof(N) > sizeof(U32)) {
+            return CircuitALU::sign_extend(n, prev_size);
+        }
+        else {
+            static_assert(std::is_integral<N>{}, "sign_extend operand must be of integral type");
+            static_assert(std::is_unsigned<N>{}, "sign_extend operand must be unsigned (to prevent auto-extend)");
+
+            const U8 half_bit_pos = get_half_bit_pos<N>(prev_size);
+            if (!(U32(n) & (U32(1) << half_bit_pos))) {
+                return n;
+            }
+
+            // All bits above the sign bit are set
+            return N(U32(n) | (~U32(0) << (half_bit_pos + 1)));
+        }
+    }
+
+
+    template<typename N>
+    static constexpr U8 get_first_set_bit_index(const N n, bit& is_zero)
+    {
+        static_assert(std::is_integral<N>{}, "get_first_set_bit_index operand must be of integral type");
+
+        const U64 n_bits = std::make_unsigned_t<N>(n);
+        is_zero = n_bits == 0;
+        return is_zero ? 0 : U8(__builtin_ctzll(n_bits));
+    }
+
+
+    template<typename N>
+    static constexpr U8 get_last_set_bit_index(const N n, bit& is_zero)
+    {
+        static_assert(std::is_integral<N>{}, "get_last_set_bit_index operand must be of integral type");
+
+        const U64 n_bits = std::make_unsigned_t<N>(n);
+        is_zero = n_bits == 0;
+        return is_zero ? 0 : U8(sizeof(U64) * 8 - 1 - __builtin_clzll(n_bits));
+    }
+
+
+    template<typename N>
+    static constexpr U8 get_last_set_bit_index_no_zero(const N n)
+    {
+        bit _ = 0;
+        return get_last_set_bit_index(n, _);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr A add(const A a, const B b, bit& carry)
+    {
+        static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "Add operands must be of integral type");
+        static_assert(sizeof(A) >= sizeof(B), "First operand of 'add' must have read least the same bit length than the second");
+
+        using UA = std::make_unsigned_t<A>;
+
+        // The second operand is converted to the size of the first, like the masks of the circuit do
+        UA sum;
+        bit carry_1 = __builtin_add_overflow(UA(a), UA(b), &sum);
+        bit carry_2 = __builtin_add_overflow(sum, UA(carry), &sum);
+
+        carry = carry_1 | carry_2;
+        return A(sum);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr A add_no_carry(const A a, const B b)
+    {
+        bit carry = 0;
+        return add(a, b, carry);
+    }
+
+
+    template<typename N>
+    static constexpr N negate(const N n)
+    {
+        static_assert(std::is_integral<N>{}, "negate operand must be of integral type");
+
+        using UN = std::make_unsigned_t<N>;
+        return N(UN(UN(0) - UN(n)));
+    }
+
+
+    template<typename A, typename B>
+    static constexpr A sub(const A a, const B b, bit& carry)
+    {
+        // The second operand is negated with its own size, then extended
+        B b_ = negate(b);
+        return add(a, b_, carry);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr A sub_no_carry(const A a, const B b)
+    {
+        bit carry = 0;
+        B b_ = negate(b);
+        return add(a, b_, carry);
+    }
+
+
+    template<typename N>
+    static constexpr N abs(const N n)
+    {
+        static_assert(std::is_integral<N>{}, "abs operand must be of integral type");
+
+        return check_is_negative(n, OpSize::UNKNOWN) ? negate(n) : n;
+    }
+
+
+    /**
+     * The circuit sets the overflow flag only when one of the partial sums has a carry, bits of 'a' shifted out of the
+     * operand size are ignored. If the full product fits in the result, none of the partial sums can have a carry.
+     */
+    template<typename A, typename B>
+    static constexpr A multiply(const A a, const B b, bit& overflow)
+    {
+        static_assert(std::is_integral<A>{} && std::is_integral<B>{}, "Multiply operands must be of integral type");
+        static_assert(sizeof(A) >= sizeof(B), "First operand of 'multiply' must have read least the same bit length than the second");
+
+        using UA = std::make_unsigned_t<A>;
+        const UA a_bits = a;
+        UA b_bits = b;
+
+        UA product;
+        if (!__builtin_mul_overflow(a_bits, b_bits, &product)) {
+            return A(product);
+        }
+
+        // Same partial sums as the circuit, for the set bits of 'b' only
+        UA stack_bits = 0;
+        while (b_bits != 0) {
+            const int i = __builtin_ctzll(U64(b_bits));
+            const UA partial = UA(a_bits << i);
+            const UA sum = UA(stack_bits + partial);
+            overflow |= sum < stack_bits;
+            stack_bits = sum;
+            b_bits &= UA(b_bits - 1);
+        }
+
+        return A(stack_bits);
+    }
+
+
+    template<typename A, typename B>
+    static constexpr A multiply_no_overflow(const A a, const B b)
+    {
+        bit overflow = 0;
+        return multiply(a, b, overflow);
+    }
+
+
+    template<typename N, typename D>
+    static constexpr void unsigned_divide(const N n, const D d, N& q, N& r, bit& divByZero)
+    {
+        if constexpr (sizeof(N) > sizeof(U32)) {
+            CircuitALU::unsigned_divide(n, d, q, r, divByZero);
+        }
+        else {
+            static_assert(std::is_integral<N>{} && std::is_integral<D>{}, "Division operands must be of integral type");
+            static_assert(std::is_unsigned<N>{} && std::is_unsigned<D>{}, "Unsigned Division operands must be unsigned");
+            static_assert(sizeof(N) >= sizeof(D), "Dividend must have read least the same bit length of the divisor");
+
+            const N _d = d;
+            if (_d == 0) {
+                divByZero = true;
+                q = r = 0;
+                return;
+            }
+
+            divByZero = false;
+            q = N(n / _d);
+            r = N(n % _d);
+        }
+    }
+
+
+    template<typename N, typename D>
+    static constexpr void signed_divide(const N n, const D d, N& q, N& r, bit& divByZero)
+    {
+        static_assert(std::is_integral<N>{} && std::is_integral<D>{}, "Division operands must be of integral type");
+
+        std::make_unsigned_t<N> n_unsigned = abs(n);
+        std::make_unsigned_t<D> d_unsigned = abs(d);
+
+        std::make_unsigned_t<N> q_unsigned = 0, r_unsigned = 0;
+
+        unsigned_divide(n_unsigned, d_unsigned, q_unsigned, r_unsigned, divByZero);
+
+        if (divByZero) {
+            return;
+        }
+
+        q = q_unsigned;
+        r = r_unsigned;
+
+        bit sign = check_is_negative(n, OpSize::UNKNOWN) ^ check_is_negative(d, OpSize::UNKNOWN);
+        if (sign) {
+            // the result is negative
+            q = negate(q);
+            if (check_different_than_zero(r)) {
+                r = add_no_carry(d, negate(r)); // reverse the remainder (r = d - r), like the circuit
+            }
+        }
+    }
+};
@@ -1,107 +1,278 @@
 ﻿
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include <cstdint>
+#include <memory>
+#include <system_error>
 #include <vector>
 
 #include "CPU/instructions.h"
 #include "memory/memory_manager.hpp"
+#include "load_program.h"
+#include "program_file.h"
 #include "logger.h"
 
 
-std::pair<U8*, U8*> load_memory_contents(std::filebuf& memory_file, uint32_t rom_size, uint32_t ram_size)
+/**
+ * Logs the regions whose contents are not entirely in the memory contents file. The missing bytes are left to zero.
+ */
+void check_memory_contents(const Mem::MappedFile& memory_file, const Mem::MemoryLayout& layout)
 {
-	U8* rom = new U8[Mem::ROM_SIZE] { };
-	U8* ram = new U8[Mem::RAM_SIZE] { };
-
-    memory_file.sgetn(reinterpret_cast<char*>(rom), rom_size);
-    memory_file.sgetn(reinterpret_cast<char*>(ram), ram_size);
-
-	return std::make_pair(rom, ram);
+    for (const Mem::RegionDesc& region : layout.regions) {
+        if (U64(region.contents_offset) + region.contents_size > memory_file.get_size()) {
+            Logger::err() << "Error while reading the contents of the region at 0x" << std::hex << region.base
+                          << ": the file has only 0x" << memory_file.get_size() << " bytes, expected 0x"
+                          << U64(region.contents_offset) + region.contents_size << " bytes.\n" << std::dec;
+        }
+    }
 }
 
 
-std::vector<Inst>* load_instructions(std::filebuf& instructions_file, uint32_t inst_start, uint32_t inst_end)
+/**
+ * Reads the optional region table at the end of the memory map:
+ *
+ *     regions_count
+ *     base size permissions contents_offset contents_size    (for each region)
+ *     stack_region_index
+ *     ram_region_index    (optional, region managed by the RAM allocator)
+ *
+ * All values are in hexadecimal, the permissions are a combination of Mem::PagePermissions.
+ * Returns false if there is no table.
+ */
+bool load_memory_layout(std::istream& memory_map_file, Mem::MemoryLayout& layout)
 {
-    uint32_t instructions_count = inst_end - inst_start;
-
-	auto* instructions = new std::vector<Inst>(instructions_count);
+    uint32_t regions_count;
+    if (!(memory_map_file >> regions_count)) {
+        return false;
+    }
 
-    auto expected_read_count = std::streamsize(instructions_count * sizeof(Inst));
-    auto read_count = instructions_file.sgetn(reinterpret_cast<char*>(instructions->data()), expected_read_count);
+    layout.regions.resize(regions_count);
+    for (Mem::RegionDesc& region : layout.regions) {
+        uint32_t permissions;
+        memory_map_file >> region.base >> region.size >> permissions >> region.contents_offset >> region.contents_size;
+        region.permissions = U8(permissions);
+    }
+    memory_map_file >> layout.stack_region;
 
-    if (read_count != expected_read_count) {
-        Logger::err() << "Error while reading instructions data: read only " << read_count << " bytes,"
-                      << " expected " << expected_read_count << " bytes.\n";
+    if (memory_map_file && !(memory_map_file >> layout.ram_region)) {
+        layout.ram_region = Mem::NO_REGION;
+        if (memory_map_file.eof()) {
+            memory_map_file.clear(); // No RAM region
+        }
     }
 
-    return instructions;
+    return true;
 }
 
 
-Mem::Memory* load_memory(const std::string& memory_map_filename,
-				 		 const std::string& memory_contents_filename,
-				 		 const std::string& instructions_filename)
+/**
+ * Reads the memory map file: the entry point, the bounds of the text, and the memory layout. Returns false and logs
+ * the error if the file is invalid.
+ */
+bool load_memory_map(const std::string& memory_map_filename, MemoryMap& map)
 {
 	std::ifstream memory_map_file(memory_map_filename);
 	if (!memory_map_file) {
         Logger::err() << "Could not open the memory map file '" << memory_map_filename << "'\n";
-		return nullptr;
+		return false;
 	}
 	
-	uint32_t entry_point, 
-			 inst_start, inst_end,
-			 rom_start,
+	uint32_t rom_start,
 			 ram_start,
              raw_rom_size,
              raw_ram_size;
 
     memory_map_file >> std::hex
-                    >> entry_point
-                    >> inst_start >> inst_end
+                    >> map.entry_point
+                    >> map.inst_start >> map.inst_end
                     >> rom_start
                     >> ram_start
                     >> raw_rom_size
                     >> raw_ram_size;
 
-	memory_map_file.close();
+    if (load_memory_layout(memory_map_file, map.layout)) {
+        if (memory_map_file.fail()) {
+            Logger::err() << "Invalid region table in the memory map file '" << memory_map_filename << "'\n";
+            return false;
+        }
+    }
+    else {
+        // No region table: default ROM, RAM and stack, the contents file has the ROM then the RAM
+        map.layout = Mem::MemoryLayout::default_layout(rom_start, ram_start);
+        map.layout.regions[0].contents_size = raw_rom_size;
+        map.layout.regions[1].contents_offset = raw_rom_size;
+        map.layout.regions[1].contents_size = raw_ram_size;
+    }
+
+    for (const Mem::RegionDesc& region : map.layout.regions) {
+        if (region.contents_size > region.size) {
+            Logger::err() << "The contents of the region at 0x" << std::hex << region.base
+                          << " are bigger than the region: 0x" << region.contents_size
+                          << " > 0x" << region.size << "\n" << std::dec;
+            return false;
+        }
+    }
+
+    return true;
+}
+
 
-    if (rom_start + Mem::ROM_SIZE != ram_start) {
-        Logger::err() << "The RAM should start where the ROM ends. "
-                      << "ROM start: 0x" << std::hex << rom_start
-                      << ", ROM end: 0x" << rom_start + Mem::ROM_SIZE
-                      << ", RAM start: 0x" << ram_start << "\n";
+/**
+ * Loads the program image from its memory map, memory contents and instructions files. The instructions and the
+ * contents of the regions are mapped from their files, which are kept by the image.
+ */
+std::shared_ptr<const Mem::ProgramImage> load_image(const std::string& memory_map_filename,
+                                                    const std::string& memory_contents_filename,
+                                                    const std::string& instructions_filename)
+{
+    MemoryMap map;
+    if (!load_memory_map(memory_map_filename, map)) {
         return nullptr;
     }
 
-	std::filebuf memory_file;
-	if (!memory_file.open(memory_contents_filename, std::ios::in | std::ios::binary)) {
-        Logger::err() << "Could not open the memory contents file '" << memory_contents_filename << "'\n";
+	std::shared_ptr<const Mem::MappedFile> instructions_file;
+	std::shared_ptr<const Mem::MappedFile> memory_file;
+	try {
+		instructions_file = std::make_shared<const Mem::MappedFile>(instructions_filename);
+		memory_file = std::make_shared<const Mem::MappedFile>(memory_contents_filename);
+	}
+	catch (std::system_error& e) {
+        Logger::err() << e.what() << "\n";
 		return nullptr;
 	}
 
-	auto&& [rom, ram] = load_memory_contents(memory_file, raw_rom_size, raw_ram_size);
-	
-	memory_file.close();
-	
-	std::filebuf instructions_file;
-	if (!instructions_file.open(instructions_filename, std::ios::in | std::ios::binary)) {
-        Logger::err() << "Could not open the instructions file '" << instructions_filename << "'\n";
+	check_memory_contents(*memory_file, map.layout);
+
+	try {
+		return std::make_shared<const Mem::ProgramImage>(map.inst_start, instructions_file, 0,
+		                                                 map.inst_end - map.inst_start, map.layout, memory_file);
+	}
+	catch (std::invalid_argument& e) {
+		Logger::err() << "Invalid program: " << e.what() << "\n";
 		return nullptr;
 	}
-	
-	std::vector<Inst>* instructions = load_instructions(instructions_file, inst_start, inst_end);
+}
 
-	instructions_file.close();
-	
-	Mem::Memory* memory = new Mem::Memory(inst_start, instructions->size() * sizeof(Inst), *instructions,
-                                          rom_start, rom, ram);
 
-    Logger::log() << "Allocated " << static_cast<double>(memory->get_RAM()->get_size()) / 1000000 << " MB of RAM"
-                  << ", with a "
-                  << static_cast<double>(Mem::StaticBinaryTreeManagedMemory<Mem::RAM_SIZE, sizeof(U32)>::get_tree_cells_size()) / 1000000
-                  << " MB allocator tree.\n";
+/**
+ * Loads the program image from a single program file. Only the header of the file is read, the instructions and the
+ * contents of the regions are mapped from it.
+ */
+std::shared_ptr<const Mem::ProgramImage> load_image_from_program_file(const std::string& program_filename)
+{
+    std::unique_ptr<ProgramFile::Reader> reader = ProgramFile::Reader::open(program_filename);
+    if (!reader) {
+        return nullptr;
+    }
+    return reader->create_image();
+}
+
+
+static Mem::Memory* create_memory(std::shared_ptr<const Mem::ProgramImage> image)
+{
+    if (!image) {
+        return nullptr;
+    }
+
+    auto* memory = new Mem::Memory(std::move(image));
+    LOG_DEBUG("Mapped " << memory->get_regions_count() << " memory regions.\n");
+    return memory;
+}
+
+
+Mem::Memory* load_memory(const std::string& memory_map_filename,
+				 		 const std::string& memory_contents_filename,
+				 		 const std::string& instructions_filename)
+{
+    return create_memory(load_image(memory_map_filename, memory_contents_filename, instructions_filename));
+}
+
+
+Mem::Memory* load_program_file(const std::string& program_filename)
+{
+    return create_memory(load_image_from_program_file(program_filename));
+}
+
+
+/**
+ * Reads the instructions map file, with one 'address, index' pair per line, in hexadecimal.
+ */
+bool load_instructions_map(const std::string& instructions_map_filename,
+                           std::vector<ProgramFile::InstructionsMapEntry>& instructions_map)
+{
+    std::ifstream instructions_map_file(instructions_map_filename);
+    if (!instructions_map_file) {
+        Logger::err() << "Could not open the instructions map file '" << instructions_map_filename << "'\n";
+        return false;
+    }
+
+    instructions_map_file >> std::hex;
+    while (instructions_map_file) {
+        U32 address, index;
+        instructions_map_file >> address;
+        instructions_map_file.ignore(1, ',');
+        instructions_map_file >> index;
+
+        if (!instructions_map_file) {
+            break;
+        }
+
+        instructions_map.push_back({ address, index });
+    }
+
+    return true;
+}
+
+
+/**
+ * Reads all the files of a program, to convert them to a single program file.
+ */
+bool load_program_contents(const std::string& memory_map_filename,
+                           const std::string& memory_contents_filename,
+                           const std::string& instructions_filename,
+                           const std::string& instructions_map_filename,
+                           ProgramFile::ProgramContents& program)
+{
+    MemoryMap map;
+    if (!load_memory_map(memory_map_filename, map)) {
+        return false;
+    }
+
+    try {
+        const Mem::MappedFile instructions_file(instructions_filename);
+        const Mem::MappedFile memory_file(memory_contents_filename);
+
+        const size_t instructions_size = size_t(map.inst_end - map.inst_start) * sizeof(Inst);
+        if (instructions_file.get_size() < instructions_size) {
+            Logger::err() << "The instructions file '" << instructions_filename << "' is too small: "
+                          << instructions_file.get_size() << " bytes, expected " << instructions_size << " bytes.\n";
+            return false;
+        }
+        program.instructions.resize(map.inst_end - map.inst_start);
+        std::memcpy(program.instructions.data(), instructions_file.get_bytes(), instructions_size);
+
+        program.regions_contents.resize(map.layout.regions.size());
+        for (size_t i = 0; i < map.layout.regions.size(); i++) {
+            const Mem::RegionDesc& region = map.layout.regions[i];
+            if (U64(region.contents_offset) + region.contents_size > memory_file.get_size()) {
+                Logger::err() << "The contents of the region at 0x" << std::hex << region.base
+                              << " are not in the memory contents file.\n" << std::dec;
+                return false;
+            }
+            const U8* contents = memory_file.get_bytes() + region.contents_offset;
+            program.regions_contents[i].assign(contents, contents + region.contents_size);
+        }
+    }
+    catch (std::system_error& e) {
+        Logger::err() << e.what() << "\n";
+        return false;
+    }
 
-	return memory;
+    program.entry_point = map.entry_point;
+    program.text_pos = map.inst_start;
+    program.layout = map.layout;
+    return load_instructions_map(instructions_map_filename, program.instructions_map);
 }
@@ -1,6 +1,45 @@
 #pragma once
 
+#include <memory>
+#include <string>
 
+#include "program_file.h"
+
+
+/**
+ * Contents of the memory map file of a program.
+ */
+struct MemoryMap
+{
+    U32 entry_point = 0;
+    U32 inst_start = 0;
+    U32 inst_end = 0;
+    Mem::MemoryLayout layout;
+};
+
+
+bool load_memory_map(const std::string& memory_map_filename, MemoryMap& map);
+
+std::shared_ptr<const Mem::ProgramImage> load_image(const std::string& memory_map_filename,
+                                                    const std::string& memory_contents_filename,
+                                                    const std::string& instructions_filename);
+
+std::shared_ptr<const Mem::ProgramImage> load_image_from_program_file(const std::string& program_filename);
+
+/*
+ * The memories returned by these functions use their own image.
+ */
 Mem::Memory* load_memory(const std::string& memory_map_filename,
                          const std::string& memory_contents_filename,
                          const std::string& instructions_filename);
+
+Mem::Memory* load_program_file(const std::string& program_filename);
+
+bool load_instructions_map(const std::string& instructions_map_filename,
+                           std::vector<ProgramFile::InstructionsMapEntry>& instructions_map);
+
+bool load_program_contents(const std::string& memory_map_filename,
+                           const std::string& memory_contents_filename,
+                           const std::string& instructions_filename,
+                           const std::string& instructions_map_filename,
+                           ProgramFile::ProgramContents& program);
@@ -25,3 +25,31 @@ private:
 
 Logger::Mode Logger::mode = Mode::OFF;
 std::ostream* Logger::null_ostream = new NullOutStream();
+BinaryLogSink* Logger::binary_sink = nullptr;
+
+
+void Logger::format_event(std::ostream& os, const LogRecord& record)
+{
+    switch (record.event)
+    {
+    case LogEvent::Block:
+        os << "Cycle " << record.arg_1 << ": block at 0x" << std::hex << record.arg_2 << std::dec << "\n";
+        break;
+
+    case LogEvent::Push:
+        os << "Pushed 0x" << std::hex << record.arg_1 << " at 0x" << record.arg_2 << std::dec << std::endl;
+        break;
+
+    case LogEvent::Pop:
+        os << "Popped 0x" << std::hex << record.arg_1 << " at 0x" << record.arg_2 << std::dec << std::endl;
+        break;
+    }
+}
+
+
+void BinaryLogSink::print(std::ostream& os) const
+{
+    for (const LogRecord& record : records) {
+        Logger::format_event(os, record);
+    }
+}
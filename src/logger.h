@@ -1,6 +1,64 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
+
+#include "data_types.h"
+
+
+/**
+ * Logging levels kept at compile time. Logs above MCX86_LOG_LEVEL are removed entirely, their arguments are never
+ * evaluated. By default, debug logs are only compiled in debug builds.
+ */
+#define MCX86_LOG_LEVEL_ERROR 0
+#define MCX86_LOG_LEVEL_DEBUG 1
+
+#ifndef MCX86_LOG_LEVEL
+#ifdef NDEBUG
+#define MCX86_LOG_LEVEL MCX86_LOG_LEVEL_ERROR
+#else
+#define MCX86_LOG_LEVEL MCX86_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+
+/**
+ * Events logged very often, which can be stored in a binary sink instead of being formatted.
+ */
+enum class LogEvent : U8
+{
+    Block, // Start of a block: cycle, EIP
+    Push,  // Value, address
+    Pop,   // Value, address
+};
+
+
+struct LogRecord
+{
+    LogEvent event;
+    U32 arg_1;
+    U32 arg_2;
+};
+
+
+/**
+ * Stores the events as fixed-size records, to be formatted later only if needed.
+ */
+class BinaryLogSink
+{
+    std::vector<LogRecord> records;
+
+public:
+    void write(LogEvent event, U32 arg_1, U32 arg_2) { records.push_back({ event, arg_1, arg_2 }); }
+
+    [[nodiscard]] const std::vector<LogRecord>& get_records() const { return records; }
+    void clear() { records.clear(); }
+
+    /**
+     * Writes all records as text, the same way they would have been logged without the sink.
+     */
+    void print(std::ostream& os) const;
+};
 
 
 /**
@@ -19,11 +77,26 @@ public:
 private:
     static Mode mode;
     static std::ostream* null_ostream;
+    static BinaryLogSink* binary_sink;
 
 public:
     static void set_mode(Mode new_mode) { mode = new_mode; }
     static Mode get_mode() { return mode; }
 
+    /**
+     * Debug events are written to the sink instead of the standard output while it is set.
+     */
+    static void set_binary_sink(BinaryLogSink* sink) { binary_sink = sink; }
+    static BinaryLogSink* get_binary_sink() { return binary_sink; }
+
+    /**
+     * Returns true if the debug logs are compiled and enabled.
+     */
+    static bool is_debug()
+    {
+        return MCX86_LOG_LEVEL >= MCX86_LOG_LEVEL_DEBUG && mode == Mode::DEBUG;
+    }
+
     static std::ostream& log()
     {
         switch (mode) {
@@ -46,4 +119,50 @@ public:
             return std::cerr;
         }
     }
+
+    static void format_event(std::ostream& os, const LogRecord& record);
+
+    static void event(LogEvent event, U32 arg_1, U32 arg_2)
+    {
+        if (binary_sink != nullptr) {
+            binary_sink->write(event, arg_1, arg_2);
+        }
+        else {
+            format_event(std::cout, { event, arg_1, arg_2 });
+        }
+    }
 };
+
+
+/**
+ * Logs the stream expression in debug mode. Nothing is evaluated if debug logs are disabled.
+ *
+ *     LOG_DEBUG("Value: " << value << "\n");
+ */
+#define LOG_DEBUG(expr)                                                 \
+    do {                                                                \
+        if constexpr (MCX86_LOG_LEVEL >= MCX86_LOG_LEVEL_DEBUG) {       \
+            if (Logger::is_debug()) {                                   \
+                Logger::log() << expr;                                  \
+            }                                                           \
+        }                                                               \
+    } while (false)
+
+
+/**
+ * Logs a debug event, to the binary sink if there is one.
+ */
+#define LOG_EVENT(log_event, arg_1, arg_2)                              \
+    do {                                                                \
+        if constexpr (MCX86_LOG_LEVEL >= MCX86_LOG_LEVEL_DEBUG) {       \
+            if (Logger::is_debug()) {                                   \
+                Logger::event(log_event, arg_1, arg_2);                 \
+            }                                                           \
+        }                                                               \
+    } while (false)
+
+
+/**
+ * Errors are always logged.
+ */
+#define LOG_ERROR(expr) (Logger::err() << expr)
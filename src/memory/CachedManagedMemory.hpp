@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#include "../data_types.h"
+#include "../CPU/exceptions.h"
+#include "StaticBinaryTreeManagedMemory.hpp"
+#include "allocator_stats.hpp"
+
+
+namespace Mem
+{
+
+/**
+ * Front end of an allocator keeping the recently freed cells of each layer in a small free list, to give them back
+ * without going through the tree. Each allocation of the same size as a cached cell is then done in constant time,
+ * as well as each deallocation while the free list of its layer is not full.
+ *
+ * The cached cells are still allocated for the tree: when a free list overflows, its oldest half is given back to the
+ * tree, and trim() gives back all of them.
+ *
+ * 'Allocator' is the managed memory doing the actual allocations, with the same template parameters.
+ */
+template<U32 memory_size, U8 granularity, template<U32, U8> class Allocator, U32 cache_size = 8>
+class CachedManagedMemory
+{
+    static_assert(cache_size >= 2);
+
+    static constexpr U32 cells_count = memory_size / (8 * granularity);
+    static constexpr U8 layers_count = std::bit_width(cells_count) - 1;
+    static constexpr U8 granularity_pow = std::bit_width(granularity) - 1;
+
+    struct FreeList
+    {
+        U32 count = 0;
+        std::array<void*, cache_size> cells{}; // The most recently freed cell is the last one
+    };
+
+    /**
+     * Same layer as the one of the allocator for a non-zero number of bytes.
+     */
+    static constexpr U8 get_allocation_layer(size_t bytes)
+    {
+        const size_t cells = (bytes + granularity - 1) >> granularity_pow;
+        return U8(std::bit_width(cells - 1));
+    }
+
+public:
+    explicit CachedManagedMemory(const U8* const memory_position)
+        : memory_position(memory_position), memory(memory_position)
+    { }
+
+    CachedManagedMemory(const CachedManagedMemory&) = delete;
+    CachedManagedMemory& operator=(const CachedManagedMemory&) = delete;
+
+    [[maybe_unused, nodiscard]] constexpr U32 get_memory_size()  const { return memory.get_memory_size();  }
+    [[maybe_unused, nodiscard]] constexpr U8  get_granularity()  const { return memory.get_granularity();  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_cells_count()  const { return memory.get_cells_count();  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_layers_count() const { return memory.get_layers_count(); }
+
+    [[maybe_unused, nodiscard]] bit is_tree_built() const { return memory.is_tree_built(); }
+
+    /**
+     * Returns the number of bytes currently allocated, excluding the cached cells.
+     */
+    [[maybe_unused, nodiscard]] U32 get_allocated_memory_size() const { return stats.allocated_bytes; }
+
+    /**
+     * Returns the number of bytes currently allocated by parsing the tree, excluding the cached cells. For debug only.
+     */
+    [[maybe_unused, nodiscard]]
+    U32 compute_allocated_memory_size() const
+    {
+        return memory.compute_allocated_memory_size() - get_cached_memory_size();
+    }
+
+    /**
+     * The statistics of the allocations given to the users of the cache. Those of the tree are in get_allocator().
+     */
+    [[maybe_unused, nodiscard]] const AllocatorStats& get_stats() const { return stats; }
+
+    /**
+     * Returns the size in bytes of the largest possible allocation, either from the tree or from the free lists.
+     */
+    [[maybe_unused, nodiscard]]
+    U32 get_largest_free_block() const
+    {
+        U32 largest = memory.get_largest_free_block();
+        for (U8 layer = 0; layer <= layers_count; layer++) {
+            if (free_lists[layer].count > 0) {
+                largest = std::max(largest, U32(granularity) << layer);
+            }
+        }
+        return largest;
+    }
+
+    /**
+     * Returns the free blocks of each layer of the tree, including the cached cells.
+     */
+    [[maybe_unused, nodiscard]]
+    FragmentationReport get_fragmentation_report() const
+    {
+        FragmentationReport report = memory.get_fragmentation_report();
+        for (U8 layer = 0; layer <= layers_count; layer++) {
+            report.free_bytes_per_layer[layer] += free_lists[layer].count * (U32(granularity) << layer);
+        }
+        report.largest_free_block = get_largest_free_block();
+        return report;
+    }
+
+    /**
+     * Returns the number of bytes of the cells in the free lists.
+     */
+    [[maybe_unused, nodiscard]]
+    U32 get_cached_memory_size() const
+    {
+        U32 size = 0;
+        for (U8 layer = 0; layer <= layers_count; layer++) {
+            size += free_lists[layer].count * (U32(granularity) << layer);
+        }
+        return size;
+    }
+
+    [[maybe_unused, nodiscard]] U64 get_cache_hits() const   { return cache_hits;   }
+    [[maybe_unused, nodiscard]] U64 get_cache_misses() const { return cache_misses; }
+
+    /**
+     * Proportion of the allocations which were given a cached cell, 0 if there was no allocation.
+     */
+    [[maybe_unused, nodiscard]]
+    double get_hit_rate() const
+    {
+        const U64 total = cache_hits + cache_misses;
+        return total == 0 ? 0.0 : double(cache_hits) / double(total);
+    }
+
+    [[maybe_unused]] void reset_cache_stats() { cache_hits = cache_misses = 0; }
+
+    [[nodiscard]] void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+    /**
+     * Resizes the allocation in place, if the allocator can do it. The cached cells are not free for the allocator,
+     * and prevent it from growing allocations.
+     */
+    [[nodiscard]]
+    bit try_resize(void* ptr, size_t old_bytes, size_t new_bytes)
+        requires requires (Allocator<memory_size, granularity> a) { a.try_resize(ptr, old_bytes, new_bytes); }
+    {
+        if (!memory.try_resize(ptr, old_bytes, new_bytes)) {
+            return false;
+        }
+        stats.resize_allocation(U32(granularity) << get_allocation_layer(old_bytes),
+                                U32(granularity) << get_allocation_layer(new_bytes));
+        return true;
+    }
+
+    /**
+     * Gives back all cached cells to the tree.
+     */
+    void trim();
+
+    [[maybe_unused, nodiscard]] const Allocator<memory_size, granularity>& get_allocator() const { return memory; }
+
+private:
+    const U8* const memory_position;
+    Allocator<memory_size, granularity> memory;
+    std::array<FreeList, layers_count + 1> free_lists{};
+    U64 cache_hits = 0;
+    U64 cache_misses = 0;
+    AllocatorStats stats;
+
+    void flush(FreeList& free_list, U8 layer, U32 count);
+};
+
+
+// ============================
+// ------ Implementation ------
+// ============================
+
+
+template<U32 memory_size, U8 granularity, template<U32, U8> class Allocator, U32 cache_size>
+void* CachedManagedMemory<memory_size, granularity, Allocator, cache_size>::allocate(size_t bytes)
+{
+    if (bytes == 0) {
+        return nullptr; // nothing to allocate
+    }
+
+    const U8 layer = get_allocation_layer(bytes);
+    if (layer <= layers_count) {
+        FreeList& free_list = free_lists[layer];
+        if (free_list.count > 0) {
+            cache_hits++;
+            stats.add_allocation(U32(granularity) << layer);
+            return free_list.cells[--free_list.count];
+        }
+    }
+
+    cache_misses++;
+    void* ptr = memory.allocate(bytes);
+    if (ptr != nullptr) {
+        stats.add_allocation(U32(granularity) << layer);
+    }
+    return ptr;
+}
+
+
+template<U32 memory_size, U8 granularity, template<U32, U8> class Allocator, U32 cache_size>
+void CachedManagedMemory<memory_size, granularity, Allocator, cache_size>::deallocate(void* ptr, size_t bytes)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    // Only cache the cells which the allocator could have given, at the start of a cell of their size
+    const U8 layer = get_allocation_layer(bytes);
+    const U64 effective_address = U64(std::uintptr_t(ptr) - std::uintptr_t(memory_position));
+    if (bytes == 0 || layer > layers_count
+        || std::uintptr_t(ptr) < std::uintptr_t(memory_position)
+        || effective_address >= (U64(cells_count) << granularity_pow)
+        || (effective_address & ((U64(granularity) << layer) - 1)) != 0) {
+        memory.deallocate(ptr, bytes); // Let the allocator handle the invalid deallocation
+        return;
+    }
+
+    FreeList& free_list = free_lists[layer];
+    for (U32 i = 0; i < free_list.count; i++) {
+        if (free_list.cells[i] == ptr) {
+            WARNING("Invalid pointer deallocation");
+            return; // Already freed
+        }
+    }
+
+    if (free_list.count == cache_size) {
+        flush(free_list, layer, cache_size / 2);
+    }
+    free_list.cells[free_list.count++] = ptr;
+    stats.remove_allocation(U32(granularity) << layer);
+}
+
+
+template<U32 memory_size, U8 granularity, template<U32, U8> class Allocator, U32 cache_size>
+void CachedManagedMemory<memory_size, granularity, Allocator, cache_size>::flush(FreeList& free_list, U8 layer,
+                                                                                 U32 count)
+{
+    // Give back the oldest cells to the tree, and keep the most recent ones
+    const size_t cell_size = size_t(granularity) << layer;
+    for (U32 i = 0; i < count; i++) {
+        memory.deallocate(free_list.cells[i], cell_size);
+    }
+    for (U32 i = count; i < free_list.count; i++) {
+        free_list.cells[i - count] = free_list.cells[i];
+    }
+    free_list.count -= count;
+}
+
+
+template<U32 memory_size, U8 granularity, template<U32, U8> class Allocator, U32 cache_size>
+void CachedManagedMemory<memory_size, granularity, Allocator, cache_size>::trim()
+{
+    for (U8 layer = 0; layer <= layers_count; layer++) {
+        flush(free_lists[layer], layer, free_lists[layer].count);
+    }
+}
+
+
+/**
+ * Cells tree of the circuit with a cache of the freed cells, to use as the allocator of a RAM.
+ */
+template<U32 memory_size, U8 granularity>
+using CachedStaticBinaryTreeManagedMemory = CachedManagedMemory<memory_size, granularity, StaticBinaryTreeManagedMemory>;
+
+}
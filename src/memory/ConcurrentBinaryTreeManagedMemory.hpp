@@ -0,0 +1,387 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "../data_types.h"
+#include "../CPU/exceptions.h"
+#include "allocator_stats.hpp"
+#include "region.hpp"
+
+
+namespace Mem
+{
+
+struct ConcurrentBinaryTreeManagedMemoryTest;
+
+
+/**
+ * Buddy allocator which can be used by many threads at the same time, without locks, with the same allocation rules
+ * as StaticBinaryTreeManagedMemory.
+ *
+ * This is the non-blocking buddy system of Marotta et al.: the tree is implicit, the node 'n' having the nodes '2n'
+ * (at the lowest address, the left one) and '2n+1' as children, the root being the node 1. Each node has a state
+ * byte, only modified by compare-and-swap:
+ *  - OCC is set if the node is allocated
+ *  - OCC_LEFT/OCC_RIGHT are set if there is an allocation below the left/right child
+ *  - COAL_LEFT/COAL_RIGHT are set while a deallocation below the left/right child is clearing the marks of its parents
+ *
+ * An allocation takes a free node of its layer, then marks all of its parents from the bottom, and gives up if one
+ * of them is allocated, undoing its marks. A deallocation first sets the coalescing bits of the parents, then frees
+ * the node and clears the marks of the parents as long as their coalescing bit is still set: if it was cleared, a
+ * concurrent allocation took the parent, and its marks must stay.
+ * Allocations and deallocations are linearizable, and a thread can only make another one retry if it modified the
+ * same node in the meantime.
+ *
+ * The allocations of each thread start at a different position, to avoid concurrent updates of the same nodes.
+ * The state bytes are in a Region, so only the nodes used take host memory.
+ *
+ * Like for 'memory_size' in StaticBinaryTreeManagedMemory, 'memory_size' is in bits and 'granularity' in bytes.
+ */
+template<U32 memory_size, U8 granularity>
+class ConcurrentBinaryTreeManagedMemory
+{
+    static_assert(std::has_single_bit(granularity));
+    static_assert(std::has_single_bit(memory_size));
+    static_assert(memory_size >= granularity * 8 * 2); // at least 2 cells
+    static_assert(std::atomic_ref<U8>::is_always_lock_free);
+
+    static constexpr U32 cells_count = memory_size / (8 * granularity);
+    static constexpr U8 layers_count = std::bit_width(cells_count) - 1;
+    static constexpr U8 granularity_pow = std::bit_width(granularity) - 1;
+
+    enum NodeState : U8
+    {
+        OCC_RIGHT  = 0x01,
+        OCC_LEFT   = 0x02,
+        COAL_RIGHT = 0x04,
+        COAL_LEFT  = 0x08,
+        OCC        = 0x10,
+        BUSY       = OCC | OCC_LEFT | OCC_RIGHT,
+    };
+
+    static constexpr U8 get_layer(U32 node) { return layers_count - (std::bit_width(node) - 1); }
+
+    static constexpr U8 occ_bit(U32 child)  { return (child & 1) ? OCC_RIGHT  : OCC_LEFT;  }
+    static constexpr U8 coal_bit(U32 child) { return (child & 1) ? COAL_RIGHT : COAL_LEFT; }
+    static constexpr bit is_occ_buddy(U8 state, U32 child) { return state & occ_bit(child ^ 1); }
+
+    /**
+     * Same layer as the other managed memories, for a non-zero number of bytes.
+     */
+    static constexpr U8 get_allocation_layer(size_t bytes)
+    {
+        const size_t cells = (bytes + granularity - 1) >> granularity_pow;
+        return U8(std::bit_width(cells - 1));
+    }
+
+public:
+    explicit ConcurrentBinaryTreeManagedMemory(const U8* const memory_position)
+        : memory_position(memory_position), nodes(2 * cells_count)
+    { }
+
+    ConcurrentBinaryTreeManagedMemory(const ConcurrentBinaryTreeManagedMemory&) = delete;
+    ConcurrentBinaryTreeManagedMemory& operator=(const ConcurrentBinaryTreeManagedMemory&) = delete;
+
+    [[maybe_unused, nodiscard]] constexpr U32 get_memory_size()  const { return memory_size;  }
+    [[maybe_unused, nodiscard]] constexpr U8  get_granularity()  const { return granularity;  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_cells_count()  const { return cells_count;  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_layers_count() const { return layers_count; }
+
+    /**
+     * The nodes are always there, but the host only commits their pages when they are first used.
+     */
+    [[maybe_unused, nodiscard]] bit is_tree_built() const { return true; }
+
+    /**
+     * Returns the number of bytes currently allocated.
+     */
+    [[maybe_unused, nodiscard]] U32 get_allocated_memory_size() const { return allocated_bytes.load(); }
+
+    /**
+     * Returns the number of bytes currently allocated by parsing the whole tree. For debug only, and not accurate
+     * while other threads use the memory.
+     */
+    [[maybe_unused, nodiscard]] U32 compute_allocated_memory_size() const;
+
+    /**
+     * Returns a copy of the counters. Each one is exact, but they may be from different times if other threads use
+     * the memory.
+     */
+    [[maybe_unused, nodiscard]]
+    AllocatorStats get_stats() const
+    {
+        return { allocated_bytes.load(), allocations_count.load(), peak_allocated_bytes.load() };
+    }
+
+    /**
+     * Returns the free blocks of each layer, by parsing the tree. Not accurate while other threads use the memory.
+     */
+    [[maybe_unused, nodiscard]] FragmentationReport get_fragmentation_report() const;
+
+    [[maybe_unused, nodiscard]] U32 get_largest_free_block() const { return get_fragmentation_report().largest_free_block; }
+
+    [[nodiscard]] void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+private:
+    friend struct ConcurrentBinaryTreeManagedMemoryTest;
+
+    const U8* const memory_position;
+    Region nodes; // State byte of each node, the node 0 is unused
+
+    std::atomic<U32> allocated_bytes = 0;
+    std::atomic<U32> allocations_count = 0;
+    std::atomic<U32> peak_allocated_bytes = 0;
+
+    [[nodiscard]] std::atomic_ref<U8> node_state(U32 node) const { return std::atomic_ref<U8>(nodes.get_bytes()[node]); }
+
+    [[nodiscard]] U32 find_and_allocate(U32 begin, U32 end, U8 layer);
+    [[nodiscard]] U32 try_allocate(U32 node);
+    void free_node(U32 node, U8 upper_layer);
+
+    // The two steps of free_node(), separated to test their interleavings with other threads
+    void mark_coalescing(U32 node, U8 upper_layer);
+    void release_node(U32 node, U8 upper_layer);
+    void unmark(U32 node, U8 upper_layer);
+
+    void add_free_blocks(U32 node, FragmentationReport& report) const;
+};
+
+
+// ============================
+// ------ Implementation ------
+// ============================
+
+
+template<U32 memory_size, U8 granularity>
+U32 ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::try_allocate(U32 node)
+{
+    // Returns 0 if the node was allocated, or the node which prevented it
+
+    U8 state = 0;
+    if (!node_state(node).compare_exchange_strong(state, BUSY)) {
+        return node;
+    }
+
+    // Mark all parents up to the root, unless one of them is allocated
+    U32 current = node;
+    while (current > 1) {
+        const U32 child = current;
+        current /= 2;
+
+        std::atomic_ref<U8> current_state = node_state(current);
+        state = current_state.load();
+        U8 new_state;
+        do {
+            if (state & OCC) {
+                free_node(node, get_layer(child));
+                return current;
+            }
+            new_state = U8((state & ~coal_bit(child)) | occ_bit(child));
+        } while (!current_state.compare_exchange_weak(state, new_state));
+    }
+
+    return 0;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::free_node(U32 node, U8 upper_layer)
+{
+    mark_coalescing(node, upper_layer);
+    release_node(node, upper_layer);
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::mark_coalescing(U32 node, U8 upper_layer)
+{
+    // Tell the parents up to 'upper_layer' that their marks are going to be removed
+    U32 current = node / 2;
+    U32 runner = node;
+    while (get_layer(runner) < upper_layer) {
+        std::atomic_ref<U8> current_state = node_state(current);
+        U8 state = current_state.load();
+        U8 new_state;
+        do {
+            new_state = state | coal_bit(runner);
+        } while (!current_state.compare_exchange_weak(state, new_state));
+
+        if (is_occ_buddy(new_state, runner) && !(new_state & coal_bit(runner ^ 1))) {
+            break; // the parents above stay marked by the buddy, unless it is being freed at the same time
+        }
+        runner = current;
+        current /= 2;
+    }
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::release_node(U32 node, U8 upper_layer)
+{
+    node_state(node).store(0);
+
+    if (get_layer(node) != upper_layer) {
+        unmark(node, upper_layer);
+    }
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::unmark(U32 node, U8 upper_layer)
+{
+    U32 current = node;
+    U32 child;
+    U8 new_state;
+    do {
+        child = current;
+        current /= 2;
+
+        std::atomic_ref<U8> current_state = node_state(current);
+        U8 state = current_state.load();
+        do {
+            if (!(state & coal_bit(child))) {
+                return; // an allocation marked the parent again
+            }
+            new_state = U8(state & ~(occ_bit(child) | coal_bit(child)));
+        } while (!current_state.compare_exchange_weak(state, new_state));
+    } while (get_layer(current) < upper_layer && !is_occ_buddy(new_state, child));
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::find_and_allocate(U32 begin, U32 end, U8 layer)
+{
+    for (U32 node = begin; node < end;) {
+        if (node_state(node).load() != 0) {
+            node++;
+            continue;
+        }
+
+        const U32 failed_at = try_allocate(node);
+        if (failed_at == 0) {
+            return node;
+        }
+
+        // Skip all nodes below the one which is allocated
+        node = (failed_at + 1) << (get_layer(failed_at) - layer);
+    }
+    return 0;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void* ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::allocate(size_t bytes)
+{
+    if (bytes == 0) {
+        return nullptr; // nothing to allocate
+    }
+
+    const U8 layer = get_allocation_layer(bytes);
+    if (layer > layers_count) {
+        return nullptr; // we don't have enough memory for this allocation
+    }
+
+    // Each thread starts at its own position in the layer, then wraps around
+    static thread_local const size_t thread_hash = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    const U32 first = U32(1) << (layers_count - layer);
+    const U32 start = first + U32(thread_hash % first);
+
+    U32 node = find_and_allocate(start, 2 * first, layer);
+    if (node == 0) {
+        node = find_and_allocate(first, start, layer);
+    }
+    if (node == 0) {
+        return nullptr; // no space in memory for this allocation
+    }
+
+    const U32 size = U32(granularity) << layer;
+    const U32 total = allocated_bytes.fetch_add(size) + size;
+    allocations_count.fetch_add(1);
+    U32 peak = peak_allocated_bytes.load();
+    while (peak < total && !peak_allocated_bytes.compare_exchange_weak(peak, total));
+
+    return (void*) (memory_position + (size_t(node - first) << (layer + granularity_pow)));
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::deallocate(void* ptr, size_t bytes)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    const U8 layer = get_allocation_layer(bytes);
+    const U64 effective_address = U64((const U8*) ptr - memory_position);
+    const U8 cell_size_pow = layer + granularity_pow;
+
+    if (bytes == 0 || layer > layers_count
+        || effective_address >= (U64(cells_count) << granularity_pow)
+        || (effective_address & ((U64(1) << cell_size_pow) - 1)) != 0) {
+        WARNING("Invalid pointer deallocation");
+        return; // This pointer couldn't have been allocated by us
+    }
+
+    const U32 node = (U32(1) << (layers_count - layer)) + U32(effective_address >> cell_size_pow);
+    if (!(node_state(node).load() & OCC)) {
+        WARNING("Invalid pointer deallocation");
+        return; // Not allocated
+    }
+
+    allocated_bytes.fetch_sub(U32(granularity) << layer);
+    allocations_count.fetch_sub(1);
+
+    free_node(node, layers_count);
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::compute_allocated_memory_size() const
+{
+    U32 size = 0;
+    for (U32 node = 1; node < 2 * cells_count; node++) {
+        if (node_state(node).load() & OCC) {
+            size += U32(granularity) << get_layer(node);
+        }
+    }
+    return size;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::add_free_blocks(U32 node,
+                                                                                  FragmentationReport& report) const
+{
+    const U8 state = node_state(node).load();
+    if (state & OCC) {
+        return;
+    }
+
+    const U8 layer = get_layer(node);
+    if (!(state & (OCC_LEFT | OCC_RIGHT))) {
+        const U32 size = U32(granularity) << layer;
+        report.free_bytes_per_layer[layer] += size;
+        report.largest_free_block = std::max(report.largest_free_block, size);
+    }
+    else if (layer > 0) {
+        add_free_blocks(2 * node, report);
+        add_free_blocks(2 * node + 1, report);
+    }
+}
+
+
+template<U32 memory_size, U8 granularity>
+FragmentationReport ConcurrentBinaryTreeManagedMemory<memory_size, granularity>::get_fragmentation_report() const
+{
+    FragmentationReport report;
+    report.free_bytes_per_layer.resize(layers_count + 1, 0);
+    add_free_blocks(1, report);
+    return report;
+}
+
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <vector>
+
+#include "../data_types.h"
+#include "../CPU/exceptions.h"
+#include "allocator_stats.hpp"
+
+
+namespace Mem
+{
+
+/**
+ * Buddy allocator with the same allocation rules as StaticBinaryTreeManagedMemory, but with its tree stored as
+ * bitmaps instead of cells with pointers to their children.
+ *
+ * The tree is implicit: the cell 'i' of a layer has the cells '2i' and '2i+1' of the layer below as children, the
+ * first one being at the lowest address. Each layer has a bitmap of its free blocks, where a bit is set only if the
+ * cell is free and its parent is not (the largest free blocks). An allocation takes the first free block of the
+ * smallest layer having one, splitting it down to the requested layer, and a deallocation merges the freed cell with
+ * its buddy as long as it is free.
+ *
+ * Each bitmap is summarized by smaller bitmaps, one bit per word of the level below, up to a single word: the first
+ * free block is found by descending the levels with a count of trailing zeros, and the smallest layer having a free
+ * block from another mask of the non-empty layers. This takes 2 bits per cell, instead of the 2^16 cells limit of
+ * the cells tree, which uses tens of bytes per cell.
+ *
+ * Like for 'memory_size' in StaticBinaryTreeManagedMemory, 'memory_size' is in bits and 'granularity' in bytes.
+ */
+template<U32 memory_size, U8 granularity>
+class ImplicitBinaryTreeManagedMemory
+{
+    static_assert(std::has_single_bit(granularity));
+    static_assert(std::has_single_bit(memory_size));
+    static_assert(memory_size >= granularity * 8 * 2); // at least 2 cells
+
+    static constexpr U32 cells_count = memory_size / (8 * granularity);
+    static constexpr U8 layers_count = std::bit_width(cells_count) - 1;
+    static constexpr U8 granularity_pow = std::bit_width(granularity) - 1;
+
+    static constexpr size_t MAX_LEVELS = 6; // 64^6 bits is more than enough for the bottom layer
+
+    struct LayerBitmap
+    {
+        U8 levels_count = 0;
+        std::array<size_t, MAX_LEVELS> offsets{}; // Index of the first word of each level, from the bottom one
+    };
+
+    static constexpr size_t words_count(size_t bits) { return (bits + 63) / 64; }
+
+    /**
+     * Number of words of the bitmaps of all layers, with their summaries.
+     */
+    static constexpr size_t compute_tree_words_count()
+    {
+        size_t count = 0;
+        for (U8 layer = 0; layer <= layers_count; layer++) {
+            size_t words = words_count(size_t(cells_count) >> layer);
+            count += words;
+            while (words > 1) {
+                words = words_count(words);
+                count += words;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Returns the layer at which an allocation of this number of bytes takes place: the power of 2 of the number of
+     * cells it needs.
+     */
+    static constexpr U8 get_allocation_layer(size_t bytes)
+    {
+        const size_t cells = (bytes + granularity - 1) >> granularity_pow;
+        return U8(std::bit_width(cells - 1));
+    }
+
+public:
+    /**
+     * Returns the number of bytes taken by the bitmaps of the tree. For debug only.
+     */
+    static constexpr U32 get_tree_cells_size() { return U32(compute_tree_words_count() * sizeof(U64)); }
+
+    /**
+     * The bitmaps are only allocated at the first allocation, as most memories are never used for allocations.
+     */
+    explicit ImplicitBinaryTreeManagedMemory(const U8* const memory_position)
+        : memory_position(memory_position)
+    { }
+
+    ImplicitBinaryTreeManagedMemory(const ImplicitBinaryTreeManagedMemory&) = delete;
+    ImplicitBinaryTreeManagedMemory& operator=(const ImplicitBinaryTreeManagedMemory&) = delete;
+
+    [[maybe_unused, nodiscard]] constexpr U32 get_memory_size()  const { return memory_size;  }
+    [[maybe_unused, nodiscard]] constexpr U8  get_granularity()  const { return granularity;  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_cells_count()  const { return cells_count;  }
+    [[maybe_unused, nodiscard]] constexpr U32 get_layers_count() const { return layers_count; }
+
+    /**
+     * Returns the number of bytes currently allocated.
+     */
+    [[maybe_unused, nodiscard]] U32 get_allocated_memory_size() const { return stats.allocated_bytes; }
+
+    /**
+     * Returns the number of bytes currently allocated by counting the free blocks of all layers. For debug only.
+     */
+    [[maybe_unused, nodiscard]] U32 compute_allocated_memory_size() const;
+
+    [[maybe_unused, nodiscard]] const AllocatorStats& get_stats() const { return stats; }
+
+    /**
+     * Returns the size in bytes of the largest possible allocation, from the mask of the non-empty layers.
+     */
+    [[maybe_unused, nodiscard]]
+    U32 get_largest_free_block() const
+    {
+        if (!is_tree_built()) {
+            return U32(granularity) << layers_count;
+        }
+        return non_empty_layers == 0 ? 0 : U32(granularity) << (std::bit_width(non_empty_layers) - 1);
+    }
+
+    /**
+     * Returns the free blocks of each layer, by counting the bits of their bitmaps.
+     */
+    [[maybe_unused, nodiscard]] FragmentationReport get_fragmentation_report() const;
+
+    [[nodiscard]] void* allocate(size_t bytes);
+    void deallocate(void* ptr, size_t bytes);
+
+    /**
+     * Changes the size of an allocation without moving it. Shrinking always succeeds, by freeing the upper halves of
+     * the cell. Growing takes the following cells, and only succeeds if the cell is the first half of each of the
+     * larger cells, and the other halves are free. Returns false if the allocation is unchanged.
+     */
+    [[nodiscard]] bit try_resize(void* ptr, size_t old_bytes, size_t new_bytes);
+
+    [[maybe_unused, nodiscard]] bit is_tree_built() const { return !tree_words.empty(); }
+
+private:
+    const U8* const memory_position;
+    std::vector<U64> tree_words;
+    std::array<LayerBitmap, layers_count + 1> layers{};
+    U64 non_empty_layers = 0; // Bit 'i' is set if the layer 'i' has at least one free block
+    AllocatorStats stats;
+
+    void build_tree();
+
+    [[nodiscard]] bit is_free(U8 layer, U32 index) const
+    {
+        return (tree_words[layers[layer].offsets[0] + index / 64] >> (index % 64)) & 1;
+    }
+
+    [[nodiscard]] bit get_allocated_cell(void* ptr, size_t bytes, U8& layer, U32& index) const;
+    [[nodiscard]] U32 count_free(U8 layer) const;
+    [[nodiscard]] U32 find_free(U8 layer) const;
+    void set_free(U8 layer, U32 index);
+    void clear_free(U8 layer, U32 index);
+};
+
+
+// ============================
+// ------ Implementation ------
+// ============================
+
+
+template<U32 memory_size, U8 granularity>
+void ImplicitBinaryTreeManagedMemory<memory_size, granularity>::build_tree()
+{
+    tree_words.resize(compute_tree_words_count(), 0);
+
+    size_t offset = 0;
+    for (U8 layer = 0; layer <= layers_count; layer++) {
+        LayerBitmap& bitmap = layers[layer];
+        size_t words = words_count(size_t(cells_count) >> layer);
+        bitmap.offsets[bitmap.levels_count++] = offset;
+        offset += words;
+        while (words > 1) {
+            words = words_count(words);
+            bitmap.offsets[bitmap.levels_count++] = offset;
+            offset += words;
+        }
+    }
+
+    // The whole memory is free
+    set_free(layers_count, 0);
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 ImplicitBinaryTreeManagedMemory<memory_size, granularity>::find_free(U8 layer) const
+{
+    // Descend from the single word of the top level, each set bit pointing to a non-empty word of the level below
+    const LayerBitmap& bitmap = layers[layer];
+    U32 index = 0;
+    for (U8 level = bitmap.levels_count; level-- > 0;) {
+        const U64 word = tree_words[bitmap.offsets[level] + index];
+        index = index * 64 + std::countr_zero(word);
+    }
+    return index;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ImplicitBinaryTreeManagedMemory<memory_size, granularity>::set_free(U8 layer, U32 index)
+{
+    const LayerBitmap& bitmap = layers[layer];
+    for (U8 level = 0; level < bitmap.levels_count; level++) {
+        U64& word = tree_words[bitmap.offsets[level] + index / 64];
+        const bit was_empty = word == 0;
+        word |= U64(1) << (index % 64);
+        if (!was_empty) {
+            break; // The summary levels already have this word
+        }
+        index /= 64;
+    }
+    non_empty_layers |= U64(1) << layer;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ImplicitBinaryTreeManagedMemory<memory_size, granularity>::clear_free(U8 layer, U32 index)
+{
+    const LayerBitmap& bitmap = layers[layer];
+    for (U8 level = 0; level < bitmap.levels_count; level++) {
+        U64& word = tree_words[bitmap.offsets[level] + index / 64];
+        word &= ~(U64(1) << (index % 64));
+        if (word != 0) {
+            return;
+        }
+        index /= 64;
+    }
+    non_empty_layers &= ~(U64(1) << layer); // The top word is empty
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 ImplicitBinaryTreeManagedMemory<memory_size, granularity>::count_free(U8 layer) const
+{
+    const size_t first = layers[layer].offsets[0];
+    const size_t last = first + words_count(size_t(cells_count) >> layer);
+    U32 count = 0;
+    for (size_t i = first; i < last; i++) {
+        count += std::popcount(tree_words[i]);
+    }
+    return count;
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 ImplicitBinaryTreeManagedMemory<memory_size, granularity>::compute_allocated_memory_size() const
+{
+    if (!is_tree_built()) {
+        return 0;
+    }
+
+    // Everything which is not in a free block is allocated
+    U64 free_cells = 0;
+    for (U8 layer = 0; layer <= layers_count; layer++) {
+        free_cells += U64(count_free(layer)) << layer;
+    }
+    return U32((cells_count - free_cells) * granularity);
+}
+
+
+template<U32 memory_size, U8 granularity>
+FragmentationReport ImplicitBinaryTreeManagedMemory<memory_size, granularity>::get_fragmentation_report() const
+{
+    FragmentationReport report;
+    report.free_bytes_per_layer.resize(layers_count + 1, 0);
+    for (U8 layer = 0; layer <= layers_count; layer++) {
+        const U32 free_blocks = is_tree_built() ? count_free(layer) : (layer == layers_count);
+        report.free_bytes_per_layer[layer] = free_blocks * (U32(granularity) << layer);
+    }
+    report.largest_free_block = get_largest_free_block();
+    return report;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void* ImplicitBinaryTreeManagedMemory<memory_size, granularity>::allocate(size_t bytes)
+{
+    if (bytes == 0) {
+        return nullptr; // nothing to allocate
+    }
+
+    const U8 alloc_layer = get_allocation_layer(bytes);
+    if (alloc_layer > layers_count) {
+        return nullptr; // we don't have enough memory for this allocation
+    }
+
+    if (!is_tree_built()) {
+        build_tree();
+    }
+
+    // The smallest layer, at or above the allocation one, which has a free block
+    const U64 candidate_layers = non_empty_layers >> alloc_layer;
+    if (candidate_layers == 0) {
+        return nullptr; // no space in memory for this allocation
+    }
+    U8 layer = alloc_layer + std::countr_zero(candidate_layers);
+
+    U32 index = find_free(layer);
+    clear_free(layer, index);
+
+    // Split the block until the allocation layer, keeping the first half each time
+    while (layer > alloc_layer) {
+        layer--;
+        index *= 2;
+        set_free(layer, index + 1);
+    }
+
+    stats.add_allocation(U32(granularity) << alloc_layer);
+    return (void*) (memory_position + (size_t(index) << (alloc_layer + granularity_pow)));
+}
+
+
+template<U32 memory_size, U8 granularity>
+bit ImplicitBinaryTreeManagedMemory<memory_size, granularity>::get_allocated_cell(void* ptr, size_t bytes, U8& layer,
+                                                                                  U32& index) const
+{
+    layer = get_allocation_layer(bytes);
+    const U64 effective_address = U64((const U8*) ptr - memory_position);
+    const U8 cell_size_pow = layer + granularity_pow;
+
+    if (bytes == 0 || layer > layers_count || !is_tree_built()
+        || effective_address >= (U64(cells_count) << granularity_pow)
+        || (effective_address & ((U64(1) << cell_size_pow) - 1)) != 0) {
+        return false; // This pointer couldn't have been allocated by us
+    }
+
+    index = U32(effective_address >> cell_size_pow);
+
+    // The cell cannot be part of a free block
+    for (U8 parent_layer = layer; parent_layer <= layers_count; parent_layer++) {
+        if (is_free(parent_layer, index >> (parent_layer - layer))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+template<U32 memory_size, U8 granularity>
+void ImplicitBinaryTreeManagedMemory<memory_size, granularity>::deallocate(void* ptr, size_t bytes)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    U8 layer;
+    U32 index;
+    if (!get_allocated_cell(ptr, bytes, layer, index)) {
+        WARNING("Invalid pointer deallocation");
+        return;
+    }
+
+    stats.remove_allocation(U32(granularity) << layer);
+
+    // Merge the cell with its buddy while it is free
+    while (layer < layers_count && is_free(layer, index ^ 1)) {
+        clear_free(layer, index ^ 1);
+        index /= 2;
+        layer++;
+    }
+    set_free(layer, index);
+}
+
+
+template<U32 memory_size, U8 granularity>
+bit ImplicitBinaryTreeManagedMemory<memory_size, granularity>::try_resize(void* ptr, size_t old_bytes,
+                                                                          size_t new_bytes)
+{
+    if (ptr == nullptr || new_bytes == 0) {
+        return false;
+    }
+
+    U8 layer;
+    U32 index;
+    if (!get_allocated_cell(ptr, old_bytes, layer, index)) {
+        WARNING("Invalid pointer resize");
+        return false;
+    }
+
+    const U8 new_layer = get_allocation_layer(new_bytes);
+    if (new_layer > layers_count) {
+        return false; // we don't have enough memory for this allocation
+    }
+
+    if (new_layer < layer) {
+        // Keep the first half of the cell until the new layer, freeing the other half each time
+        for (U8 split_layer = layer; split_layer > new_layer; split_layer--) {
+            set_free(split_layer - 1, (index << (layer - split_layer + 1)) + 1);
+        }
+    }
+    else if (new_layer > layer) {
+        // The cell must stay at the start of the larger cell, and all other halves must be free
+        for (U8 merge_layer = layer; merge_layer < new_layer; merge_layer++) {
+            const U32 merge_index = index >> (merge_layer - layer);
+            if ((merge_index & 1) != 0 || !is_free(merge_layer, merge_index ^ 1)) {
+                return false;
+            }
+        }
+        for (U8 merge_layer = layer; merge_layer < new_layer; merge_layer++) {
+            clear_free(merge_layer, (index >> (merge_layer - layer)) ^ 1);
+        }
+    }
+
+    stats.resize_allocation(U32(granularity) << layer, U32(granularity) << new_layer);
+    return true;
+}
+
+}
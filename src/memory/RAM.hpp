@@ -1,32 +1,39 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <memory>
 
 #include "memory_interfaces.hpp"
 
 #include "../ALU.hpp"
 #include "StaticBinaryTreeManagedMemory.hpp"
+#include "ImplicitBinaryTreeManagedMemory.hpp"
 
 
 namespace Mem
 {
 
-template<U32 N, typename Granularity>
+/**
+ * 'Allocator' is the allocator managing the RAM: StaticBinaryTreeManagedMemory represents how the circuit works, while
+ * ImplicitBinaryTreeManagedMemory has the same behaviour but is able to manage much larger memories.
+ */
+template<U32 N, typename Granularity, template<U32, U8> class Allocator = StaticBinaryTreeManagedMemory>
 class RAM : public ReadWriteMemoryInterface
 {
 	static_assert(std::is_integral_v<Granularity>);
 	static_assert(N % 8 == 0);
 
 private:
-	StaticBinaryTreeManagedMemory<N, sizeof(Granularity)> memory;
+	Allocator<N, sizeof(Granularity)> memory;
 
 public:
 	explicit RAM(U8* bytes)
-		: ReadWriteMemoryInterface(bytes),
+		: ReadWriteMemoryInterface(bytes, N),
 		  memory(bytes)
 	{ }
 
-    [[maybe_unused, nodiscard]] constexpr U32 get_size() const { return N; }
     [[maybe_unused, nodiscard]] constexpr U32 get_granularity() const { return sizeof(Granularity); }
 
 	template<class T, class... Args>
@@ -50,7 +57,65 @@ public:
         memory.deallocate((U8*) ptr, sizeof(T));
 	}
 
+    /**
+     * Allocates 'n' consecutive value-initialized T, or returns nullptr.
+     */
+	template<class T>
+	T* allocate_array(size_t n)
+	{
+        if (n == 0 || n > SIZE_MAX / sizeof(T)) {
+            return nullptr;
+        }
+        T* t = static_cast<T*>(memory.allocate(n * sizeof(T)));
+        if (t != nullptr) {
+            std::uninitialized_value_construct_n(t, n);
+        }
+        return t;
+	}
+
+	template<class T>
+	void deallocate_array(T* const ptr, size_t n)
+	{
+        memory.deallocate((U8*) ptr, n * sizeof(T));
+	}
+
+    /**
+     * Allocates 'bytes' bytes at an address which is a multiple of 'alignment' from the start of the RAM, or returns
+     * nullptr. 'alignment' must be a power of 2.
+     * All allocations are aligned on their size rounded to the next power of 2, therefore this allocates at least
+     * 'alignment' bytes, which must also be given to deallocate_aligned().
+     */
+    void* allocate_aligned(size_t bytes, size_t alignment)
+    {
+        if (bytes == 0 || !std::has_single_bit(alignment)) {
+            return nullptr;
+        }
+        return memory.allocate(std::max(bytes, alignment));
+    }
+
+    void deallocate_aligned(void* const ptr, size_t bytes, size_t alignment)
+    {
+        memory.deallocate(ptr, std::max(bytes, alignment));
+    }
+
+    /**
+     * Changes the size of the allocation of 'old_bytes' at 'ptr' to 'new_bytes' without moving it, so that growing
+     * buffers don't need to be copied. Returns false if the allocation is unchanged: either the allocator cannot
+     * resize allocations, or the cells after the allocation are not free.
+     * The allocation must then be deallocated with its new size.
+     */
+    bool try_resize(void* const ptr, size_t old_bytes, size_t new_bytes)
+    {
+        if constexpr (requires { memory.try_resize(ptr, old_bytes, new_bytes); }) {
+            return memory.try_resize(ptr, old_bytes, new_bytes);
+        }
+        else {
+            return false;
+        }
+    }
+
 	const auto& get_memory_manager() const { return memory; }
+	auto& get_memory_manager() { return memory; }
 };
 
 }
@@ -1,8 +1,12 @@
 ﻿#pragma once
 
+#include <optional>
+#include <vector>
+
 #include "../data_types.h"
 #include "../ALU.hpp"
 #include "../CPU/exceptions.h"
+#include "allocator_stats.hpp"
 
 
 namespace Mem
@@ -98,21 +102,26 @@ struct TreeCell<1>
 	const U32 mask;
 	U32 alloc_slots;
 	bit right_slot;
+	bit left_slot;
 
     TreeCell(U8*, U32 cell_size, const U8* const memory_position)
             : cell_size(cell_size), memory_position(memory_position),
-              mask(0b11), alloc_slots(0), right_slot(0)
+              mask(0b11), alloc_slots(0), right_slot(0), left_slot(0)
     { }
 
 	// Did you know? Explicit template class methods must be marked with inline if they use a different definition
     inline const U8* allocate_for(U8 alloc_size);
     inline void deallocate(U32 cell_index, U8 target_layer);
+    inline void update_alloc_slots();
 };
 
 
 template<U8 layer>
 constexpr U32 get_cell_allocated_size(const TreeCell<layer>* cell);
 
+template<U8 layer>
+void add_cell_free_blocks(const TreeCell<layer>* cell, U32 granularity, std::vector<U32>& free_bytes_per_layer);
+
 
 template<U32 memory_size, U8 granularity>
 class StaticBinaryTreeManagedMemory
@@ -138,13 +147,18 @@ public:
      */
     static constexpr U32 get_tree_cells_size();
 
+    /**
+     * The tree is only built at the first allocation: most memories are never used for allocations, and building the
+     * tree touches all of its cells.
+     */
 	explicit StaticBinaryTreeManagedMemory(const U8* const memory_position)
-		: tree_bytes(new U8[get_tree_cells_size()]),
-          memory_position(memory_position),
-		  layers_count(get_max_layer()), cells_count(compute_cells_count()),
-		  allocator_tree_root(tree_bytes, granularity << layers_count, memory_position)
+		: memory_position(memory_position),
+		  layers_count(get_max_layer()), cells_count(compute_cells_count())
 	{ }
 
+	StaticBinaryTreeManagedMemory(const StaticBinaryTreeManagedMemory&) = delete;
+	StaticBinaryTreeManagedMemory& operator=(const StaticBinaryTreeManagedMemory&) = delete;
+
 	~StaticBinaryTreeManagedMemory()
     {
         delete[] tree_bytes;
@@ -156,19 +170,48 @@ public:
 	[[maybe_unused, nodiscard]] constexpr U32 get_layers_count() const { return layers_count; }
 
     /**
-     * Returns the number of bytes currently allocated. For debug only.
+     * Returns the number of bytes currently allocated.
+     */
+    [[maybe_unused, nodiscard]] U32 get_allocated_memory_size() const { return stats.allocated_bytes; }
+
+    /**
+     * Returns the number of bytes currently allocated by parsing the whole tree. For debug only.
+     */
+    [[maybe_unused, nodiscard]] U32 compute_allocated_memory_size() const;
+
+    [[maybe_unused, nodiscard]] const AllocatorStats& get_stats() const { return stats; }
+
+    /**
+     * Returns the size in bytes of the largest possible allocation, from the slots of the root.
+     */
+    [[maybe_unused, nodiscard]] U32 get_largest_free_block() const;
+
+    /**
+     * Returns the free blocks of each layer, by parsing the tree.
      */
-    [[maybe_unused, nodiscard]] U32 get_allocated_memory_size() const;
+    [[maybe_unused, nodiscard]] FragmentationReport get_fragmentation_report() const;
 
     [[nodiscard]] void* allocate(size_t bytes);
     void deallocate(void* ptr, size_t bytes);
 
+    [[maybe_unused, nodiscard]] bit is_tree_built() const { return allocator_tree_root.has_value(); }
+
 private:
-    U8* const tree_bytes;
+    U8* tree_bytes = nullptr;
     const U8* const memory_position;
 	const U8 layers_count;
 	const U32 cells_count;
-	TreeCell<get_max_layer()> allocator_tree_root;
+	std::optional<TreeCell<get_max_layer()>> allocator_tree_root;
+	AllocatorStats stats;
+
+    TreeCell<get_max_layer()>& get_tree_root()
+    {
+        if (!allocator_tree_root) {
+            tree_bytes = new U8[get_tree_cells_size()];
+            allocator_tree_root.emplace(tree_bytes, granularity << layers_count, memory_position);
+        }
+        return *allocator_tree_root;
+    }
 };
 
 
@@ -262,12 +305,71 @@ constexpr U32 get_cell_allocated_size(const TreeCell<1>* cell)
 }
 
 
+template<U8 layer>
+void add_cell_free_blocks(const TreeCell<layer>* cell, U32 granularity, std::vector<U32>& free_bytes_per_layer)
+{
+	if (cell->alloc_slots == 0) {
+		free_bytes_per_layer[layer] += granularity << layer;
+	}
+	else if (cell->alloc_slots != cell->mask) {
+		add_cell_free_blocks(cell->right, granularity, free_bytes_per_layer);
+		add_cell_free_blocks(cell->left, granularity, free_bytes_per_layer);
+	}
+}
+
+
+template<>
+inline void add_cell_free_blocks(const TreeCell<1>* cell, U32 granularity, std::vector<U32>& free_bytes_per_layer)
+{
+	if (cell->alloc_slots == 0) {
+		free_bytes_per_layer[1] += granularity << 1;
+	}
+	else if (cell->alloc_slots != cell->mask) {
+		free_bytes_per_layer[0] += granularity; // only one of the children is allocated
+	}
+}
+
+
 template<U32 memory_size, U8 granularity>
-U32 StaticBinaryTreeManagedMemory<memory_size, granularity>::get_allocated_memory_size() const
+U32 StaticBinaryTreeManagedMemory<memory_size, granularity>::compute_allocated_memory_size() const
 {
 	// Parse through the tree and count the number of bytes allocated
 	// This is intended to be only used for testing purposes
-	return get_cell_allocated_size(&allocator_tree_root);
+	if (!allocator_tree_root) {
+		return 0;
+	}
+	return get_cell_allocated_size(&*allocator_tree_root);
+}
+
+
+template<U32 memory_size, U8 granularity>
+U32 StaticBinaryTreeManagedMemory<memory_size, granularity>::get_largest_free_block() const
+{
+	if (!allocator_tree_root) {
+		return U32(granularity) << layers_count;
+	}
+
+	// The i-th bit of the slots is cleared if a cell of the i-th layer can be allocated
+	const U32 free_layers = ~allocator_tree_root->alloc_slots & allocator_tree_root->mask;
+	bit is_zero = 0;
+	const U8 largest_layer = ALU::get_last_set_bit_index(free_layers, is_zero);
+	return is_zero ? 0 : U32(granularity) << largest_layer;
+}
+
+
+template<U32 memory_size, U8 granularity>
+FragmentationReport StaticBinaryTreeManagedMemory<memory_size, granularity>::get_fragmentation_report() const
+{
+	FragmentationReport report;
+	report.free_bytes_per_layer.resize(layers_count + 1, 0);
+	if (!allocator_tree_root) {
+		report.free_bytes_per_layer[layers_count] = U32(granularity) << layers_count;
+	}
+	else {
+		add_cell_free_blocks(&*allocator_tree_root, granularity, report.free_bytes_per_layer);
+	}
+	report.largest_free_block = get_largest_free_block();
+	return report;
 }
 
 
@@ -286,19 +388,22 @@ void* StaticBinaryTreeManagedMemory<memory_size, granularity>::allocate(size_t b
 		return nullptr; // we don't have enough memory for this allocation
 	}
 
-	if (ALU::get_bit_at(allocator_tree_root.alloc_slots, alloc_size)) {
+	TreeCell<get_max_layer()>& root = get_tree_root();
+	if (ALU::get_bit_at(root.alloc_slots, alloc_size)) {
 		return nullptr; // no space in memory for this allocation
 	}
 
 	// there is enough space in memory for this allocation, now perform it.
-	return (void*) allocator_tree_root.allocate_for(alloc_size);
+	stats.add_allocation(U32(granularity) << alloc_size);
+	return (void*) root.allocate_for(alloc_size);
 }
 
 
 template<U32 memory_size, U8 granularity>
 void StaticBinaryTreeManagedMemory<memory_size, granularity>::deallocate(void* ptr, size_t bytes)
 {
-	static constexpr U32 ptr_mask = U32(U64(U32(-1)) << granularity);
+	static constexpr U8 granularity_pow = ALU::get_last_set_bit_index_no_zero(granularity);
+	static constexpr U32 ptr_mask = granularity - 1;
 
 	if (ptr == nullptr) {
 		return;
@@ -309,7 +414,8 @@ void StaticBinaryTreeManagedMemory<memory_size, granularity>::deallocate(void* p
 	// Get the 'true' address in the memory we manage, in order to check if it is a correctly allocated pointer.
 	// Here we cast to U64 to not have any precision loss, but we use 32-bit addressing in the circuit implementation.
 	const U32 effective_address = U32(U64(ptr) - U64(memory_position)); 
-	if (ALU::check_different_than_zero(ALU::and_(effective_address, ptr_mask))) {
+	if (ALU::check_different_than_zero(ALU::and_(effective_address, ptr_mask))
+	    || U64(effective_address) >= U64(cells_count) * granularity) {
 		WARNING("Invalid pointer deallocation");
 		return; // This pointer couldn't have been allocated by us, since it is not a multiple of the granularity
 	}
@@ -322,16 +428,23 @@ void StaticBinaryTreeManagedMemory<memory_size, granularity>::deallocate(void* p
 		return;
 	}
 
-	U8 cell_size = ALU::add_no_carry(alloc_size, granularity);
-	U32 cell_index = ALU::shift_right_no_carry(effective_address, cell_size, OpSize::DW);
-	U32 remainder = (effective_address << cell_size) >> cell_size; // remainder from the previous shift operation
+	// 'cell_index' is the index of the first cell of the allocation, its bits give the path from the root to it
+	U8 cell_size = ALU::add_no_carry(alloc_size, granularity_pow);
+	U32 cell_index = ALU::shift_right_no_carry(effective_address, granularity_pow, OpSize::DW);
+	U32 remainder = effective_address & ((U32(1) << cell_size) - 1); // the allocation must be aligned on its size
 
 	if (ALU::check_different_than_zero(remainder)) {
 		WARNING("Invalid pointer deallocation");
 		return; // The pointer is not at the start of the expected cell
 	}
 
-	allocator_tree_root.deallocate(cell_index, alloc_size);
+	if (!allocator_tree_root) {
+		WARNING("Invalid pointer deallocation");
+		return; // nothing was allocated
+	}
+
+	allocator_tree_root->deallocate(cell_index, alloc_size);
+	stats.remove_allocation(U32(granularity) << alloc_size);
 }
 
 
@@ -383,19 +496,14 @@ const U8* TreeCell<1>::allocate_for(U8 alloc_size)
         if (right_slot == 0) {
             // allocate the right cell
             right_slot = 1;
-
-            if (alloc_slots == 0b10) {
-                alloc_slots = mask; // the left cell is also allocated, this cell is full
-            }
-            else {
-                alloc_slots = 0b10;
-            }
+            update_alloc_slots();
 
             return memory_position;
         }
         else {
-            // allocate the left cell, which makes this cell filled
-            alloc_slots = mask;
+            // allocate the left cell
+            left_slot = 1;
+            update_alloc_slots();
 
             return memory_position + cell_size / 2;
         }
@@ -411,7 +519,7 @@ void TreeCell<layer>::deallocate(U32 cell_index, U8 target_layer)
 		alloc_slots = 0;
 	}
 	else {
-		if (((cell_index >> layer) & 0b1) == 0b1) {
+		if (((cell_index >> (layer - 1)) & 0b1) == 0b1) {
 			left->deallocate(cell_index, target_layer);
 		} 
 		else {
@@ -433,13 +541,23 @@ void TreeCell<1>::deallocate(U32 cell_index, U8 target_layer)
         if ((cell_index & 0b1) == 0b0) {
             right_slot = 0; // deallocate the right cell
         }
+        else {
+            left_slot = 0; // deallocate the left cell
+        }
 
-        // deallocate the child cell, while taking into account that the other child cell might be still allocated
-        alloc_slots = right_slot << 1;
+        // the other child cell might be still allocated
+        update_alloc_slots();
     }
 }
 
 
+void TreeCell<1>::update_alloc_slots()
+{
+    // no more cell of the layer 0 if both are allocated, and the whole cell cannot be allocated if any of them is
+    alloc_slots = ALU::and_(right_slot, left_slot) | (ALU::or_(right_slot, left_slot) << 1);
+}
+
+
 template<U8 layer>
 void TreeCell<layer>::update_alloc_slots()
 {
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "../data_types.h"
+
+
+namespace Mem
+{
+
+/**
+ * Counters of a managed memory, updated at each allocation and deallocation. All sizes are in bytes, and count whole
+ * cells: an allocation of 3 bytes in 4 bytes cells counts for 4 bytes.
+ */
+struct AllocatorStats
+{
+    U32 allocated_bytes = 0;
+    U32 allocations_count = 0;
+    U32 peak_allocated_bytes = 0;
+
+    void add_allocation(U32 bytes)
+    {
+        allocated_bytes += bytes;
+        allocations_count++;
+        peak_allocated_bytes = std::max(peak_allocated_bytes, allocated_bytes);
+    }
+
+    void remove_allocation(U32 bytes)
+    {
+        allocated_bytes -= bytes;
+        allocations_count--;
+    }
+
+    void resize_allocation(U32 old_bytes, U32 new_bytes)
+    {
+        allocated_bytes = allocated_bytes - old_bytes + new_bytes;
+        peak_allocated_bytes = std::max(peak_allocated_bytes, allocated_bytes);
+    }
+};
+
+
+/**
+ * Free blocks of a managed memory. A free block is the largest free cell of the tree containing a free position, its
+ * layer is the power of 2 of its number of cells.
+ */
+struct FragmentationReport
+{
+    std::vector<U32> free_bytes_per_layer; // Total size of the free blocks of each layer
+    U32 largest_free_block = 0;
+
+    [[nodiscard]]
+    U32 get_free_bytes() const
+    {
+        U32 total = 0;
+        for (U32 bytes : free_bytes_per_layer) {
+            total += bytes;
+        }
+        return total;
+    }
+
+    /**
+     * Proportion of the free memory which cannot be used by an allocation of the size of the largest free block: 0
+     * when all of it is in a single block, close to 1 when it is split into many small blocks.
+     */
+    [[nodiscard]]
+    double get_fragmentation() const
+    {
+        const U32 free_bytes = get_free_bytes();
+        return free_bytes == 0 ? 0.0 : 1.0 - double(largest_free_block) / double(free_bytes);
+    }
+};
+
+}
@@ -16,7 +16,7 @@ class Buffer : public ReadWriteMemoryInterface
 
 public:
     explicit Buffer(U8* const bytes)
-            : ReadWriteMemoryInterface(bytes)
+            : ReadWriteMemoryInterface(bytes, N)
     { }
 };
 
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cerrno>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "region.hpp"
+
+#if MCX86_MMAP_REGIONS
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include "../data_types.h"
+
+
+namespace Mem
+{
+
+/**
+ * Read-only view of the whole contents of a file.
+ *
+ * The file is mapped privately: its pages are read from the page cache only when they are touched, and are shared by
+ * all processes mapping the same file. The file stays open so that parts of it can be mapped again in the regions,
+ * with Region::map_file().
+ * Without mmap, the file is read entirely into memory.
+ */
+class MappedFile
+{
+    const U8* bytes = nullptr;
+    size_t size = 0;
+#if MCX86_MMAP_REGIONS
+    int fd = -1;
+#else
+    std::vector<U8> buffer;
+#endif
+
+public:
+    explicit MappedFile(const std::string& path)
+    {
+#if MCX86_MMAP_REGIONS
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "Could not open '" + path + "'");
+        }
+
+        struct stat file_stat{};
+        if (fstat(fd, &file_stat) != 0) {
+            const int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "Could not stat '" + path + "'");
+        }
+        size = size_t(file_stat.st_size);
+
+        if (size > 0) {
+            void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                const int error = errno;
+                close(fd);
+                throw std::system_error(error, std::generic_category(), "Could not map '" + path + "'");
+            }
+            bytes = static_cast<const U8*>(ptr);
+        }
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::system_error(ENOENT, std::generic_category(), "Could not open '" + path + "'");
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = buffer.data();
+        size = buffer.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if MCX86_MMAP_REGIONS
+        if (bytes != nullptr) {
+            munmap(const_cast<U8*>(bytes), size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] const U8* get_bytes() const { return bytes; }
+    [[nodiscard]] size_t get_size() const { return size; }
+
+    /**
+     * Descriptor of the open file, or -1 if the file is not mapped.
+     */
+    [[nodiscard]]
+    int get_fd() const
+    {
+#if MCX86_MMAP_REGIONS
+        return fd;
+#else
+        return -1;
+#endif
+    }
+};
+
+}
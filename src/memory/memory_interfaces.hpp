@@ -1,93 +1,216 @@
 ﻿#pragma once
 
+#include <bit>
+#include <cstring>
 #include <stdexcept>
 
 #include "../data_types.h"
+#include "exceptions.hpp"
 
 
 namespace Mem
 {
 
+/**
+ * Number of bytes accessed for an operand size, 0 if the size is unknown.
+ */
+[[nodiscard]]
+constexpr U32 get_bytes_count(OpSize size)
+{
+	switch (size)
+	{
+	case OpSize::B:  return 1;
+	case OpSize::W:  return 2;
+	case OpSize::DW: return 4;
+	default:         return 0;
+	}
+}
+
+
+/**
+ * Unsigned integer type of an operand size.
+ */
+template<OpSize size> struct OpSizeType;
+template<> struct OpSizeType<OpSize::B>  { using type = U8;  };
+template<> struct OpSizeType<OpSize::W>  { using type = U16; };
+template<> struct OpSizeType<OpSize::DW> { using type = U32; };
+
+
+/**
+ * Converts between the little-endian order of the guest memory and the order of the host.
+ */
+template<typename T>
+[[nodiscard]]
+constexpr T to_little_endian(T value)
+{
+	if constexpr (std::endian::native == std::endian::little || sizeof(T) == 1) {
+		return value;
+	}
+	else {
+		T swapped = 0;
+		for (size_t i = 0; i < sizeof(T); i++) {
+			swapped = (swapped << 8) | ((value >> (8 * i)) & 0xFF);
+		}
+		return swapped;
+	}
+}
+
+
+/**
+ * Reads a little-endian value at the host address, with a single load of the size of the value.
+ */
+template<OpSize size>
+[[nodiscard]]
+inline U32 read_bytes(const U8* bytes)
+{
+	using T = typename OpSizeType<size>::type;
+	T value;
+	std::memcpy(&value, bytes, sizeof(T));
+	return to_little_endian(value);
+}
+
+
+/**
+ * Writes a little-endian value at the host address, with a single store of the size of the value.
+ */
+template<OpSize size>
+inline void write_bytes(U8* bytes, U32 value)
+{
+	using T = typename OpSizeType<size>::type;
+	const T packed = to_little_endian(static_cast<T>(value));
+	std::memcpy(bytes, &packed, sizeof(T));
+}
+
+
+[[nodiscard]]
+inline U32 read_bytes(const U8* bytes, OpSize size)
+{
+	switch (size)
+	{
+	case OpSize::B:  return read_bytes<OpSize::B>(bytes);
+	case OpSize::W:  return read_bytes<OpSize::W>(bytes);
+	case OpSize::DW: return read_bytes<OpSize::DW>(bytes);
+	default:
+		throw std::logic_error("Wrong memory size");
+	}
+}
+
+
+inline void write_bytes(U8* bytes, U32 value, OpSize size)
+{
+	switch (size)
+	{
+	case OpSize::B:  write_bytes<OpSize::B>(bytes, value);  break;
+	case OpSize::W:  write_bytes<OpSize::W>(bytes, value);  break;
+	case OpSize::DW: write_bytes<OpSize::DW>(bytes, value); break;
+	default:
+		throw std::logic_error("Wrong memory size");
+	}
+}
+
+
 class ReadMemoryInterface
 {
 protected:
 	U8* const bytes;
+	const U32 size;
 
-	explicit ReadMemoryInterface(U8* bytes)
-		: bytes(bytes)
+	ReadMemoryInterface(U8* bytes, U32 size)
+		: bytes(bytes), size(size)
 	{ }
 
+	void check_bounds(U32 address, U32 count) const
+	{
+		if (U64(address) + count > size) {
+			throw WrongMemoryAccess("Address out of bounds.", address);
+		}
+	}
+
 public:
 	[[nodiscard]]
-	U32 read(U32 address, OpSize size) const
+	U32 read(U32 address, OpSize op_size) const
 	{
-		// TODO : bounds check if N < max_U32
-		switch (size)
-		{
-		case OpSize::B:
-			return bytes[address];
-			
-		case OpSize::W:
-			return (bytes[address + 1] << 8) | 
-					bytes[address];
-			
-		case OpSize::DW:
-			return (bytes[address + 3] << 24) |
-				   (bytes[address + 2] << 16) |
-				   (bytes[address + 1] <<  8) |
-				    bytes[address];
-			
-		default:
-			throw std::logic_error("Wrong memory size");
-		}
+		return read_bytes(bytes + address, op_size);
+	}
+
+	template<OpSize op_size>
+	[[nodiscard]]
+	U32 read(U32 address) const
+	{
+		return read_bytes<op_size>(bytes + address);
+	}
+
+	/**
+	 * Same as read(), but throws if the value is not entirely in the memory.
+	 */
+	[[nodiscard]]
+	U32 read_checked(U32 address, OpSize op_size) const
+	{
+		check_bounds(address, get_bytes_count(op_size));
+		return read(address, op_size);
+	}
+
+	/**
+	 * Copies 'count' contiguous bytes starting at 'address' to 'dest'.
+	 */
+	void read_block(U32 address, U8* dest, U32 count) const
+	{
+		check_bounds(address, count);
+		std::memcpy(dest, bytes + address, count);
 	}
 
     [[nodiscard]]
     U8* get_bytes() const { return bytes; }
+
+	[[nodiscard]]
+	U32 get_size() const { return size; }
 };
 
 
 class ReadWriteMemoryInterface : public ReadMemoryInterface
 {
 protected:
-	explicit ReadWriteMemoryInterface(U8* bytes)
-		: ReadMemoryInterface(bytes)
+	ReadWriteMemoryInterface(U8* bytes, U32 size)
+		: ReadMemoryInterface(bytes, size)
 	{ }
 	
 public:
-	void write(U32 address, U32 value, OpSize size)
+	void write(U32 address, U32 value, OpSize op_size)
 	{
-		// TODO : maybe optimize this with some packed assignments
-		switch (size)
-		{
-		case OpSize::B:
-			bytes[address] = value & 0xFF;
-			break;
-			
-		case OpSize::W:
-			bytes[address + 1] = (value & 0xFF00) >> 8;
-			bytes[address + 0] = (value & 0x00FF) >> 0;
-			break;
-			
-		case OpSize::DW:
-			bytes[address + 3] = (value & 0xFF000000) >> 24;
-			bytes[address + 2] = (value & 0x00FF0000) >> 16;
-			bytes[address + 1] = (value & 0x0000FF00) >>  8;
-			bytes[address + 0] = (value & 0x000000FF) >>  0;
-			break;
-			
-		default:
-			throw std::logic_error("Wrong memory size");
-		}
+		write_bytes(bytes + address, value, op_size);
+	}
+
+	template<OpSize op_size>
+	void write(U32 address, U32 value)
+	{
+		write_bytes<op_size>(bytes + address, value);
+	}
+
+	/**
+	 * Same as write(), but throws if the value is not entirely in the memory.
+	 */
+	void write_checked(U32 address, U32 value, OpSize op_size)
+	{
+		check_bounds(address, get_bytes_count(op_size));
+		write(address, value, op_size);
+	}
+
+	/**
+	 * Copies 'count' contiguous bytes from 'src' to the memory, starting at 'address'.
+	 */
+	void write_block(U32 address, const U8* src, U32 count)
+	{
+		check_bounds(address, count);
+		std::memcpy(bytes + address, src, count);
 	}
 
     [[nodiscard]]
-	U32 read_and_write(U32 address, U32 value, OpSize size)
+	U32 read_and_write(U32 address, U32 value, OpSize op_size)
 	{
 		// In the actual circuit implementation, this is done without temporary variables or anything else.
 		// This is possible by design.
-		U32 tmp = read(address, size);
-		write(address, value, size);
+		U32 tmp = read(address, op_size);
+		write(address, value, op_size);
 		return tmp;
 	}
 };
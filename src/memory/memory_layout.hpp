@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "../data_types.h"
+#include "page_table.hpp"
+
+
+namespace Mem
+{
+
+// Layout used by memory maps without a region table: 1MB of ROM, 1MB of RAM, 1MB of stack
+const U32 ROM_SIZE = 0x100000;
+const U32 RAM_SIZE = 0x100000;
+const U32 STACK_SIZE = 0x100000;
+const U32 STACK_POS = 0xffffd6ec - STACK_SIZE;
+const bool USE_STACK_POS = true;
+
+const U32 NO_REGION = U32(-1);
+
+
+/**
+ * A region of the guest memory.
+ *
+ * Regions are backed by zero-initialized host memory. The loader copies the initial contents of the region from the
+ * memory contents file, at 'contents_offset' for 'contents_size' bytes (which may be 0).
+ */
+struct RegionDesc
+{
+    U32 base = 0;
+    U32 size = 0;
+    U8 permissions = PAGE_READ | PAGE_WRITE;
+    U32 contents_offset = 0;
+    U32 contents_size = 0;
+
+    [[nodiscard]] U64 end() const { return U64(base) + size; }
+    [[nodiscard]] bit contains(U32 address) const { return address >= base && address < end(); }
+};
+
+
+struct MemoryLayout
+{
+    std::vector<RegionDesc> regions;
+    U32 stack_region = 0; // Index of the region of the stack: ESP is initialized to its end
+    U32 ram_region = NO_REGION; // Index of the region managed by the RAM allocator, of RAM_SIZE bytes, if any
+
+    /**
+     * Layout of the ROM, RAM and stack with their default sizes. The RAM is placed right after the ROM if 'ram_pos' is 0.
+     */
+    static MemoryLayout default_layout(U32 rom_pos, U32 ram_pos = 0)
+    {
+        if (ram_pos == 0) {
+            ram_pos = rom_pos + ROM_SIZE;
+        }
+        const U32 stack_pos = USE_STACK_POS ? STACK_POS : ram_pos + RAM_SIZE;
+
+        return {
+            .regions = {
+                { .base = rom_pos,   .size = ROM_SIZE,   .permissions = PAGE_READ },
+                { .base = ram_pos,   .size = RAM_SIZE,   .permissions = PAGE_READ | PAGE_WRITE },
+                { .base = stack_pos, .size = STACK_SIZE, .permissions = PAGE_READ | PAGE_WRITE },
+            },
+            .stack_region = 2,
+            .ram_region = 1,
+        };
+    }
+};
+
+}
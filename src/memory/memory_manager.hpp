@@ -1,25 +1,61 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
 
 #include "../data_types.h"
 #include "../cycle_changes_monitor.h"
+#include "../CPU/instructions.h"
 #include "exceptions.hpp"
+#include "../CPU/fault.h"
 #include "descriptor_table.hpp"
+#include "memory_interfaces.hpp"
+#include "memory_layout.hpp"
+#include "program_image.hpp"
+#include "page_table.hpp"
 #include "RAM.hpp"
-#include "ROM.hpp"
-#include "stack.hpp"
+#include "region.hpp"
 
 
 namespace Mem
 {
 
-// 1MB of ROM, 1MB of RAM, 1MB of stack
-const U32 ROM_SIZE = 0x100000;
-const U32 RAM_SIZE = 0x100000;
-const U32 STACK_SIZE = 0x100000;
-const U32 STACK_POS = 0xffffd6ec - STACK_SIZE;
-const bool USE_STACK_POS = true;
+const U32 TLB_SIZE = 64;
+
+
+struct MemoryRange
+{
+    U32 address;
+    U32 size;
+};
+
+
+enum WatchKind : U8
+{
+    WATCH_READ  = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+    WATCH_EXEC  = 1 << 2, // Instructions of the text, one address per instruction
+};
+
+
+struct Watchpoint
+{
+    U32 id;
+    U32 address;
+    U32 size;
+    U8 kinds; // WatchKind flags
+
+    [[nodiscard]] bit overlaps(U32 start, U32 bytes) const
+    {
+        return U64(start) + bytes > address && U64(address) + size > start;
+    }
+};
+
 
 class Memory
 {
@@ -27,119 +63,723 @@ class Memory
 
 public:
 	const U32 text_pos, text_end;
-	const U32 rom_pos, rom_end;
-	const U32 ram_pos, ram_end;
 	const U32 stack_pos, stack_end;
 
 private:
-	std::unique_ptr<U8[]> rom_bytes;
-	std::unique_ptr<U8[]> ram_bytes;
-	std::unique_ptr<U8[]> stack_bytes;
-	
-	ROM<ROM_SIZE> rom;
-	RAM<RAM_SIZE, U32> ram;
-	Stack<STACK_SIZE> stack;
-	
-	const std::vector<Inst> instructions;
-	
+	const std::shared_ptr<const ProgramImage> image;
+	const std::vector<RegionDesc>& regions_desc;
+	const std::span<const Inst> instructions;
+
+	// Each region is either a writable region of this memory, or a read-only region shared by the image
+	std::vector<std::optional<Region>> own_regions;
+	std::vector<const Region*> regions;
+
+	std::optional<RAM<RAM_SIZE, U32>> ram; // Allocator of the RAM region of the layout, if it has one
+
+	PageTable page_table;
+	mutable TLB<TLB_SIZE> read_tlb;
+	TLB<TLB_SIZE> write_tlb;
+
+	/*
+	 * Tracking of the writes to the regions.
+	 *
+	 * Writes are tracked in epochs: the first write to each page in an epoch is logged, and the modified ranges since
+	 * any epoch are found from the log, in a time proportional to the number of pages written. Optionally, the
+	 * cache lines written in each page are also recorded, with a bitmap of the 64 lines of the page. The records of
+	 * the old epochs are kept until they are retired.
+	 *
+	 * Snapshots of the regions use page-granular copy-on-write: the first write to each page after the snapshot saves
+	 * its original bytes, and restoring the snapshot only copies back the saved pages.
+	 *
+	 * Both rely on the page table: a page is only writable by the fast path once it has been written in the current
+	 * epoch and saved for the current snapshot. Until then writes to the page go through the slow path, which records
+	 * them and makes the page writable again. Accesses to pages already written pay nothing more.
+	 */
+	static constexpr U32 NO_EPOCH = U32(-1);
+	static constexpr U32 CACHE_LINE_BITS = 6;
+	static constexpr U64 ALL_LINES = U64(-1);
+	static_assert(PAGE_SIZE >> CACHE_LINE_BITS == 64, "The cache lines bitmap of a page must have 64 bits");
+
+	struct PageState
+	{
+		U32 dirty_epoch = NO_EPOCH; // Last epoch in which the page was written
+		U32 log_index = 0;          // Index in the dirty log of the record of the page for its last epoch
+		bit saved = false;          // If the page has been saved for the current snapshot
+		U8 watched = 0;             // Read and write kinds of the watchpoints overlapping the page
+	};
+
+	struct DirtyRecord
+	{
+		U16 region;
+		U32 page;  // Guest page number
+		U64 lines; // Cache lines of the page written during the epoch, all of them if they are not tracked
+	};
+
+	struct SavedPage
+	{
+		U16 region;
+		U32 page;   // Guest page number
+		U32 offset; // Offset of the saved bytes in the region
+		std::vector<U8> bytes;
+	};
+
+	std::vector<std::vector<PageState>> pages_state; // For each region, the state of each of its guest pages
+
+	U32 current_epoch = 0;
+	U32 oldest_epoch = 0; // Epochs before it are retired, their records are no longer in the log
+	std::vector<DirtyRecord> dirty_log;
+	std::vector<size_t> epochs_start; // Index of the first record of each epoch since the oldest one in the dirty log
+	bit track_cache_lines = false;
+
+	bit snapshot_taken = false;
+	std::vector<SavedPage> saved_pages;
+
+	/*
+	 * Watchpoints.
+	 *
+	 * The pages overlapping a read or write watchpoint lose the matching permission in the page table, so only their
+	 * accesses go through the slow path, which checks them against the watchpoints. Accesses to other pages pay
+	 * nothing more. A hit is reported in the fault status of the access, which is still made.
+	 */
+	std::vector<Watchpoint> watchpoints;
+	U32 next_watchpoint_id = 0;
+	U32 exec_watchpoints_count = 0;
+
+	[[nodiscard]] static U32 get_first_page(const RegionDesc& region) { return region.base >> PAGE_BITS; }
+	[[nodiscard]] static U32 get_last_page(const RegionDesc& region) { return U32((region.end() - 1) >> PAGE_BITS); }
+
+	[[nodiscard]]
+	PageState& get_page_state(U16 region, U32 page)
+	{
+		return pages_state[region][page - get_first_page(regions_desc[region])];
+	}
+
+	/**
+	 * Allows writes to the page through the fast path only if there is nothing to record for its next write, and
+	 * reads only if they are not watched.
+	 * When the page becomes protected, the TLBs must be flushed by the caller.
+	 */
+	void update_page_protection(U16 region, U32 page)
+	{
+		PageEntry* entry = page_table.find(page << PAGE_BITS);
+		if (entry == nullptr || entry->region != region) {
+			return; // This part of the page is always accessed through the slow path
+		}
+
+		const PageState& state = get_page_state(region, page);
+		const bit readable = (regions_desc[region].permissions & PAGE_READ) && !(state.watched & WATCH_READ);
+		const bit writable = (regions_desc[region].permissions & PAGE_WRITE)
+							 && state.dirty_epoch == current_epoch
+							 && (!snapshot_taken || state.saved)
+							 && !(state.watched & WATCH_WRITE);
+		entry->permissions = (readable ? PAGE_READ : PAGE_NONE) | (writable ? PAGE_WRITE : PAGE_NONE);
+	}
+
+	[[nodiscard]]
+	static U64 get_lines_mask(U32 page, U32 address, U32 bytes)
+	{
+		const U64 page_start = U64(page) << PAGE_BITS;
+		const U64 start = std::max(U64(address), page_start) - page_start;
+		const U64 end = std::min(U64(address) + std::max(bytes, U32(1)), page_start + PAGE_SIZE) - page_start;
+		const U32 first_line = U32(start >> CACHE_LINE_BITS);
+		const U32 last_line = U32((end - 1) >> CACHE_LINE_BITS);
+		const U64 lines_after_last = last_line == 63 ? 0 : ALL_LINES << (last_line + 1);
+		return (ALL_LINES << first_line) & ~lines_after_last;
+	}
+
+	void mark_page_written(U16 region, U32 page, U64 lines)
+	{
+		PageState& state = get_page_state(region, page);
+		if (state.dirty_epoch != current_epoch) {
+			state.dirty_epoch = current_epoch;
+			state.log_index = U32(dirty_log.size());
+			dirty_log.push_back({ region, page, 0 });
+		}
+		dirty_log[state.log_index].lines |= lines;
+	}
+
+	void save_page(U16 region_index, U32 page)
+	{
+		const RegionDesc& region = regions_desc[region_index];
+		const U64 start = std::max(U64(page) << PAGE_BITS, U64(region.base));
+		const U64 end = std::min((U64(page) + 1) << PAGE_BITS, region.end());
+		const U8* page_bytes = regions[region_index]->get_bytes() + (start - region.base);
+
+		saved_pages.push_back({
+			.region = region_index,
+			.page = page,
+			.offset = U32(start - region.base),
+			.bytes = std::vector<U8>(page_bytes, page_bytes + (end - start)),
+		});
+		get_page_state(region_index, page).saved = true;
+	}
+
+	/**
+	 * Records a write to the region, before it is made.
+	 */
+	void on_write(U16 region, U32 address, U32 bytes)
+	{
+		const U32 last_page = U32((U64(address) + (bytes > 0 ? bytes - 1 : 0)) >> PAGE_BITS);
+		for (U32 page = address >> PAGE_BITS; page <= last_page; page++) {
+			if (snapshot_taken && !get_page_state(region, page).saved) {
+				save_page(region, page);
+			}
+			mark_page_written(region, page, track_cache_lines ? get_lines_mask(page, address, bytes) : ALL_LINES);
+			update_page_protection(region, page);
+		}
+	}
+
+	/**
+	 * Forgets the saved pages, and protects them again.
+	 */
+	void reset_saved_pages()
+	{
+		for (const SavedPage& saved : saved_pages) {
+			get_page_state(saved.region, saved.page).saved = false;
+			update_page_protection(saved.region, saved.page);
+		}
+		saved_pages.clear();
+		write_tlb.flush();
+	}
+
+	void protect_all_pages()
+	{
+		for (size_t i = 0; i < regions.size(); i++) {
+			const RegionDesc& region = regions_desc[i];
+			for (U32 page = get_first_page(region); page <= get_last_page(region); page++) {
+				update_page_protection(U16(i), page);
+			}
+		}
+		write_tlb.flush();
+	}
+
+	/**
+	 * Updates the watched kinds of the pages in the range, and their protection.
+	 */
+	void update_watched_pages(U32 address, U32 size)
+	{
+		const U64 end = U64(address) + size;
+		for (size_t i = 0; i < regions.size(); i++) {
+			const RegionDesc& region = regions_desc[i];
+			const U64 start = std::max(U64(address), U64(region.base));
+			const U64 last = std::min(end, region.end());
+			if (start >= last) {
+				continue;
+			}
+
+			for (U32 page = U32(start >> PAGE_BITS); page <= U32((last - 1) >> PAGE_BITS); page++) {
+				// Only the part of the page in the region matters
+				const U64 page_start = std::max(U64(page) << PAGE_BITS, U64(region.base));
+				const U64 page_end = std::min((U64(page) + 1) << PAGE_BITS, region.end());
+
+				U8 watched = 0;
+				for (const Watchpoint& watchpoint : watchpoints) {
+					if (watchpoint.overlaps(U32(page_start), U32(page_end - page_start))) {
+						watched |= watchpoint.kinds & (WATCH_READ | WATCH_WRITE);
+					}
+				}
+				get_page_state(U16(i), page).watched = watched;
+				update_page_protection(U16(i), page);
+			}
+		}
+		read_tlb.flush();
+		write_tlb.flush();
+	}
+
+	/**
+	 * Sets the fault status to a hit if the access overlaps a watchpoint of its kind. Only the first fault of the
+	 * status is kept.
+	 */
+	void check_watchpoints(U8 kind, U32 address, U32 bytes, U32 old_value, U32 new_value, Fault& fault) const
+	{
+		if (fault.is_set()) {
+			return;
+		}
+
+		for (const Watchpoint& watchpoint : watchpoints) {
+			if ((watchpoint.kinds & kind) && watchpoint.overlaps(address, bytes)) {
+				const char* msg = kind == WATCH_READ ? "Read watchpoint"
+								: kind == WATCH_WRITE ? "Write watchpoint" : "Execution watchpoint";
+				WatchpointHit hit;
+				hit.kind = kind;
+				hit.size = U8(bytes);
+				hit.old_value = old_value;
+				hit.new_value = new_value;
+				fault = Fault::watchpoint_hit(msg, address, hit);
+				return;
+			}
+		}
+	}
+
+	/**
+	 * Returns the index of the region containing the address, or -1. Only used when the address is not in the page
+	 * table.
+	 */
+	[[nodiscard]]
+	I32 find_region_slow(U32 address) const
+	{
+		for (size_t i = 0; i < regions_desc.size(); i++) {
+			if (regions_desc[i].contains(address)) {
+				return I32(i);
+			}
+		}
+		return -1;
+	}
+
+	/**
+	 * Returns the index of the region containing the address, or -1. The page table gives the region in O(1), except
+	 * for the pages shared by two regions.
+	 */
+	[[nodiscard]]
+	I32 find_region(U32 address) const
+	{
+		const PageEntry* page = page_table.find(address);
+		if (page != nullptr && regions_desc[page->region].contains(address)) {
+			return page->region;
+		}
+		return find_region_slow(address);
+	}
+
+	/**
+	 * Returns the host address of an access fully contained in a mapped page with the permission, or nullptr.
+	 * The text is never mapped, and the accesses crossing a page are not translated: in both cases the regions are
+	 * checked by the caller.
+	 */
+	template<U32 N>
+	[[nodiscard]]
+	U8* translate(U32 address, U32 bytes, U8 permission, TLB<N>& tlb) const
+	{
+		if (U8* host = tlb.lookup(address, bytes)) {
+			return host;
+		}
+
+		const PageEntry* page = page_table.find(address);
+		if (page == nullptr || !(page->permissions & permission)) {
+			return nullptr;
+		}
+		tlb.insert(address, *page);
+		return tlb.lookup(address, bytes);
+	}
+
+	/**
+	 * Returns the host address of an access not translated by translate(), or nullptr and sets the fault.
+	 * 'region_index' is set to the region of the access.
+	 */
+	[[nodiscard]]
+	U8* translate_slow(U32 address, U32 bytes, U8 permission, Fault& fault, I32& region_index) const
+	{
+		if (address >= text_pos && address < text_end) {
+			fault = Fault::memory_access(permission == PAGE_WRITE ? "Text cannot be written to." : "Text cannot be read.",
+										 address);
+			return nullptr;
+		}
+
+		I32 index = find_region(address);
+		if (index < 0 || U64(address) + bytes > regions_desc[index].end()) {
+			fault = Fault::memory_access("Address out of bounds.", address);
+			return nullptr;
+		}
+
+		region_index = index;
+		const RegionDesc& region = regions_desc[index];
+		if (!(region.permissions & permission)) {
+			fault = Fault::memory_access(permission == PAGE_WRITE ? "ROM is read-only." : "Region cannot be read.", address);
+			return nullptr;
+		}
+
+		return regions[index]->get_bytes() + (address - region.base);
+	}
+
 public:
 	/**
-	 * The memory manager takes ownership of the ROM and RAM data, as well as all the instructions.
+	 * Memory running the program of the image. Only the writable regions are allocated, with their initial contents.
 	 */
-	Memory(U32 text_pos, U32 text_size, std::vector<Inst>& instructions,
-		   U32 rom_pos, U8* rom_bytes, U8* ram_bytes)
-		: text_pos(text_pos), text_end(text_pos + text_size),
-		  rom_pos(rom_pos), rom_end(rom_pos + ROM_SIZE),
-		  ram_pos(rom_end), ram_end(ram_pos + RAM_SIZE),
-		  stack_pos(USE_STACK_POS ? STACK_POS : ram_end), stack_end(stack_pos + STACK_SIZE),
-		  rom_bytes(rom_bytes), ram_bytes(ram_bytes),
-          stack_bytes(std::make_unique<U8[]>(STACK_SIZE)),
-		  rom(rom_bytes),
-		  ram(ram_bytes),
-		  stack(stack_bytes.get()),
-		  instructions(std::move(instructions))
+	explicit Memory(std::shared_ptr<const ProgramImage> program_image)
+		: text_pos(program_image->get_text_pos()), text_end(text_pos + program_image->get_text_size()),
+		  stack_pos(program_image->get_layout().regions[program_image->get_layout().stack_region].base),
+		  stack_end(stack_pos + program_image->get_layout().regions[program_image->get_layout().stack_region].size),
+		  image(std::move(program_image)),
+		  regions_desc(image->get_layout().regions),
+		  instructions(image->get_instructions()),
+		  own_regions(regions_desc.size())
+	{
+		for (size_t i = 0; i < regions_desc.size(); i++) {
+			const RegionDesc& desc = regions_desc[i];
+			const Region* region = image->get_read_only_region(i);
+			if (region == nullptr) {
+				image->load_initial_contents(i, own_regions[i].emplace(desc.size));
+				region = &*own_regions[i];
+			}
+			regions.push_back(region);
+
+			page_table.map(desc.base, desc.size, region->get_bytes(), desc.permissions, U16(i));
+			pages_state.emplace_back(get_last_page(desc) - get_first_page(desc) + 1);
+		}
+		if (image->get_layout().ram_region != NO_REGION) {
+			ram.emplace(own_regions[image->get_layout().ram_region]->get_bytes());
+		}
+		epochs_start.push_back(0);
+		protect_all_pages();
+	}
+
+	/**
+	 * The memory manager takes ownership of all the instructions, in an image used only by this memory. All regions of
+	 * the layout are initially zero.
+	 */
+	Memory(U32 text_pos, U32 text_size, std::vector<Inst>& instructions, const MemoryLayout& layout)
+		: Memory(std::make_shared<const ProgramImage>(text_pos, text_size, std::move(instructions), layout))
+	{ }
+
+	/**
+	 * Memory with the default layout: ROM at 'rom_pos', followed by the RAM, and the stack.
+	 */
+	Memory(U32 text_pos, U32 text_size, std::vector<Inst>& instructions, U32 rom_pos)
+		: Memory(text_pos, text_size, instructions, MemoryLayout::default_layout(rom_pos))
 	{ }
 	
 	Memory(const Memory&) = delete;
 	Memory& operator=(const Memory&) = delete;
 
-    ROM<ROM_SIZE>* get_ROM()                    { return &rom; }
-    RAM<RAM_SIZE, U32>* get_RAM()               { return &ram; }
-    Stack<STACK_SIZE>* get_stack()              { return &stack; }
-    const std::vector<Inst>* get_instructions() { return &instructions; }
+    [[nodiscard]] const std::shared_ptr<const ProgramImage>& get_image() const { return image; }
+    [[nodiscard]] std::span<const Inst> get_instructions() const { return instructions; }
+
+    /**
+     * Allocator of the RAM region, or nullptr if the layout has none. It uses the host bytes of the region directly,
+     * therefore its writes are not tracked by the epochs and snapshots.
+     */
+    [[nodiscard]] RAM<RAM_SIZE, U32>* get_RAM() { return ram ? &*ram : nullptr; }
+
+    [[nodiscard]] size_t get_regions_count() const                 { return regions.size(); }
+    [[nodiscard]] const RegionDesc& get_region_desc(size_t i) const { return regions_desc.at(i); }
+    [[nodiscard]] const Region& get_region(size_t i) const          { return *regions.at(i); }
+
+    /**
+     * Host bytes of the region. The bytes of the read-only regions are shared by all memories of the image.
+     * They are read-only: writes must go through write(), to be checked, tracked and kept out of the image.
+     */
+    [[nodiscard]] const U8* get_region_bytes(size_t i) const        { return regions.at(i)->get_bytes(); }
+
+    /**
+     * Takes a snapshot of the contents of all regions, replacing the previous one. Only the pages saved for the
+     * previous snapshot need to be protected again.
+     * Writes made through the host addresses of the regions are not tracked.
+     */
+    void snapshot()
+    {
+        if (snapshot_taken) {
+            reset_saved_pages();
+            return;
+        }
+
+        snapshot_taken = true;
+        protect_all_pages();
+    }
+
+    /**
+     * Restores the contents of the regions to the last snapshot, in a time proportional to the number of pages written
+     * since. The snapshot stays valid. The restored pages are considered written in the current epoch.
+     */
+    void restore()
+    {
+        if (!snapshot_taken) {
+            throw std::logic_error("No memory snapshot to restore");
+        }
+
+        for (const SavedPage& saved : saved_pages) {
+            std::memcpy(own_regions[saved.region]->get_bytes() + saved.offset, saved.bytes.data(), saved.bytes.size());
+            mark_page_written(saved.region, saved.page, ALL_LINES);
+        }
+        reset_saved_pages();
+    }
+
+    [[nodiscard]] bit has_snapshot() const { return snapshot_taken; }
+
+    /**
+     * Returns the number of pages written since the last snapshot or restore.
+     */
+    [[nodiscard]] size_t get_snapshot_dirty_pages_count() const { return saved_pages.size(); }
+
+    [[nodiscard]] U32 get_epoch() const { return current_epoch; }
+
+    /**
+     * Ends the current epoch and starts a new one, whose number is returned. Only the pages written during the previous
+     * epoch need to be protected again.
+     */
+    U32 new_epoch()
+    {
+        const size_t previous_start = epochs_start.back();
+        current_epoch++;
+        epochs_start.push_back(dirty_log.size());
+
+        for (size_t i = previous_start; i < dirty_log.size(); i++) {
+            update_page_protection(dirty_log[i].region, dirty_log[i].page);
+        }
+        write_tlb.flush();
+        return current_epoch;
+    }
+
+    /**
+     * Oldest epoch which can be given to get_modified_ranges().
+     */
+    [[nodiscard]] U32 get_oldest_epoch() const { return oldest_epoch; }
+
+    /**
+     * Drops the records of the epochs before 'before', in a time proportional to the number of records kept. Their
+     * modified ranges can no longer be queried. Without it, the log grows with the pages written in each epoch.
+     */
+    void retire_epochs(U32 before)
+    {
+        if (before > current_epoch) {
+            throw std::logic_error("Cannot retire the current epoch");
+        }
+        if (before <= oldest_epoch) {
+            return;
+        }
+
+        const size_t retired_epochs = before - oldest_epoch;
+        const size_t retired_records = epochs_start[retired_epochs];
+        dirty_log.erase(dirty_log.begin(), dirty_log.begin() + retired_records);
+        epochs_start.erase(epochs_start.begin(), epochs_start.begin() + retired_epochs);
+        for (size_t& start : epochs_start) {
+            start -= retired_records;
+        }
+
+        // The last record of each page written since is kept, after the others of the same page
+        for (size_t i = 0; i < dirty_log.size(); i++) {
+            get_page_state(dirty_log[i].region, dirty_log[i].page).log_index = U32(i);
+        }
+        oldest_epoch = before;
+    }
+
+    /**
+     * If enabled, the modified ranges are precise to the cache line (64 bytes) instead of the page. Every write then
+     * needs to update the bitmap of its page.
+     */
+    void set_track_cache_lines(bit enabled) { track_cache_lines = enabled; }
+    [[nodiscard]] bit is_tracking_cache_lines() const { return track_cache_lines; }
+
+    /**
+     * Returns the ranges of guest memory written since the start of the epoch, sorted by address.
+     * Throws if the epoch has been retired.
+     */
+    [[nodiscard]]
+    std::vector<MemoryRange> get_modified_ranges(U32 since_epoch) const
+    {
+        std::vector<MemoryRange> ranges;
+        if (since_epoch < oldest_epoch) {
+            throw std::out_of_range("The epoch has been retired");
+        }
+        if (since_epoch > current_epoch) {
+            return ranges;
+        }
+
+        std::vector<DirtyRecord> records(dirty_log.begin() + epochs_start[since_epoch - oldest_epoch],
+                                         dirty_log.end());
+        std::sort(records.begin(), records.end(), [](const DirtyRecord& a, const DirtyRecord& b) {
+            return a.page != b.page ? a.page < b.page : a.region < b.region;
+        });
+
+        for (size_t i = 0; i < records.size();) {
+            const DirtyRecord& record = records[i];
+            U64 lines = 0;
+            for (; i < records.size() && records[i].page == record.page && records[i].region == record.region; i++) {
+                lines |= records[i].lines;
+            }
+
+            const RegionDesc& region = regions_desc[record.region];
+            const U64 page_start = U64(record.page) << PAGE_BITS;
+            const U64 region_start = std::max(page_start, U64(region.base));
+            const U64 region_end = std::min(page_start + PAGE_SIZE, region.end());
+
+            for (U32 line = 0; line < 64; line++) {
+                if (!((lines >> line) & 1)) {
+                    continue;
+                }
+                const U64 start = std::max(page_start + (line << CACHE_LINE_BITS), region_start);
+                const U64 end = std::min(page_start + ((line + 1) << CACHE_LINE_BITS), region_end);
+                if (start >= end) {
+                    continue;
+                }
+
+                if (!ranges.empty() && U64(ranges.back().address) + ranges.back().size == start) {
+                    ranges.back().size += U32(end - start);
+                }
+                else {
+                    ranges.push_back({ U32(start), U32(end - start) });
+                }
+            }
+        }
+
+        return ranges;
+    }
+
+    /**
+     * Returns the number of host pages touched by the guest in all regions.
+     */
+    [[nodiscard]]
+    U32 get_resident_pages_count() const
+    {
+        U32 count = 0;
+        for (const Region* region : regions) {
+            count += region->get_resident_pages_count();
+        }
+        return count;
+    }
+
+    /**
+     * Adds a watchpoint on the guest range, for the WatchKind flags in 'kinds'. Returns its id.
+     * Execution watchpoints are for the addresses of the text. Hits are only reported to the accesses made with a
+     * fault status.
+     */
+    U32 add_watchpoint(U32 address, U32 size, U8 kinds)
+    {
+        if (size == 0 || kinds == 0 || (kinds & ~(WATCH_READ | WATCH_WRITE | WATCH_EXEC))) {
+            throw std::invalid_argument("Invalid watchpoint");
+        }
+
+        const U32 id = next_watchpoint_id++;
+        watchpoints.push_back({ id, address, size, kinds });
+        if (kinds & WATCH_EXEC) {
+            exec_watchpoints_count++;
+        }
+        update_watched_pages(address, size);
+        return id;
+    }
+
+    /**
+     * Removes the watchpoint. Returns false if there is no watchpoint with this id.
+     */
+    bit remove_watchpoint(U32 id)
+    {
+        auto it = std::find_if(watchpoints.begin(), watchpoints.end(),
+                               [id](const Watchpoint& watchpoint) { return watchpoint.id == id; });
+        if (it == watchpoints.end()) {
+            return false;
+        }
+
+        const Watchpoint removed = *it;
+        watchpoints.erase(it);
+        if (removed.kinds & WATCH_EXEC) {
+            exec_watchpoints_count--;
+        }
+        update_watched_pages(removed.address, removed.size);
+        return true;
+    }
+
+    [[nodiscard]] const std::vector<Watchpoint>& get_watchpoints() const { return watchpoints; }
+    [[nodiscard]] bit has_exec_watchpoints() const { return exec_watchpoints_count > 0; }
+
+    /**
+     * Sets the fault status to a hit if the instruction at the address is watched for execution.
+     */
+    void check_execution(U32 address, Fault& fault) const
+    {
+        check_watchpoints(WATCH_EXEC, address, 1, 0, 0, fault);
+    }
 
     // TODO : low-level logic for memory accesses
 
     [[nodiscard]]
     const Inst& fetch_instruction(U32 address) const
     {
-        return instructions.at(address - text_pos);
+        const U32 index = address - text_pos;
+        if (index >= instructions.size()) {
+            throw std::out_of_range("Instruction address out of range");
+        }
+        return instructions[index];
     }
 
 
 	[[nodiscard]]
-    U8* physical_at(U32 address) const
+    const U8* physical_at(U32 address) const
 	{
-		// All of those checks can be parallelized
 		if (address >= text_pos && address < text_end) {
 			throw WrongMemoryAccess("Text is read-only.", address);
 		}
-		else if (address >= rom_pos && address < rom_end) {
-			return rom_bytes.get() + (address - rom_pos);
-		}
-		else if (address >= ram_pos && address < ram_end) {
-			return ram_bytes.get() + (address - ram_pos);
-		}
-		else if (address >= stack_pos && address < stack_end) {
-			return stack_bytes.get() + (address - stack_pos);
-		}
-		else {
+
+		I32 index = find_region(address);
+		if (index < 0) {
 			throw WrongMemoryAccess("Address out of bounds.", address);
 		}
+		return regions[index]->get_bytes() + (address - regions_desc[index].base);
 	}
 
 
     [[nodiscard]]
     U32 read(U32 address, OpSize size) const
     {
-        // All of those checks can be parallelized using bit checks at the right places
-        if (address >= text_pos && address < text_end) {
-            throw WrongMemoryAccess("Text cannot be read.", address);
-        }
-        else if (address >= rom_pos && address < rom_end) {
-            return rom.read(address - rom_pos, size);
-        }
-        else if (address >= ram_pos && address < ram_end) {
-            return ram.read(address - ram_pos, size);
-        }
-        else if (address >= stack_pos && address < stack_end) {
-            return stack.read(address - stack_pos, size);
-        }
-        else {
-            throw WrongMemoryAccess("Address out of bounds.", address);
+        Fault fault;
+        U32 value = read(address, size, fault);
+        if (fault.is_error()) {
+            fault.raise();
         }
+        return value;
     }
 
 
     void write(U32 address, U32 value, OpSize size)
     {
-        memory_change(address, size);
-        // All of those checks can be parallelized using bit checks at the right places
-        if (address >= text_pos && address < text_end) {
-            throw WrongMemoryAccess("Text cannot be written to.", address);
+        Fault fault;
+        write(address, value, size, fault);
+        if (fault.is_error()) {
+            fault.raise();
         }
-        else if (address >= rom_pos && address < rom_end) {
-            throw WrongMemoryAccess("ROM is read-only.", address);
-        }
-        else if (address >= ram_pos && address < ram_end) {
-            ram.write(address - ram_pos, value, size);
+    }
+
+
+    /**
+     * Reads from memory without throwing: an invalid access is recorded in 'fault', and 0 is returned. A watchpoint
+     * hit is also recorded in 'fault'.
+     */
+    [[nodiscard]]
+    U32 read(U32 address, OpSize size, Fault& fault) const
+    {
+        const U32 bytes = get_bytes_count(size);
+        const U8* host = translate(address, bytes, PAGE_READ, read_tlb);
+        if (host == nullptr) {
+            I32 region;
+            host = translate_slow(address, bytes, PAGE_READ, fault, region);
+            if (host == nullptr) {
+                return 0;
+            }
+            if (!watchpoints.empty()) {
+                const U32 value = read_bytes(host, size);
+                check_watchpoints(WATCH_READ, address, bytes, value, value, fault);
+                return value;
+            }
         }
-        else if (address >= stack_pos && address < stack_end) {
-            stack.write(address - stack_pos, value, size);
+        return read_bytes(host, size);
+    }
+
+
+    /**
+     * Writes to memory without throwing: an invalid access is recorded in 'fault', and nothing is written. A watchpoint
+     * hit is also recorded in 'fault', after which the value is still written.
+     */
+    void write(U32 address, U32 value, OpSize size, Fault& fault)
+    {
+        memory_change(address, size);
+
+        const U32 bytes = get_bytes_count(size);
+        U8* host = translate(address, bytes, PAGE_WRITE, write_tlb);
+        if (host != nullptr) {
+            if (track_cache_lines) {
+                on_write(page_table.find(address)->region, address, bytes);
+            }
         }
         else {
-            throw WrongMemoryAccess("Address out of bounds.", address);
+            I32 region;
+            host = translate_slow(address, bytes, PAGE_WRITE, fault, region);
+            if (host == nullptr) {
+                return;
+            }
+            on_write(U16(region), address, bytes);
+            if (!watchpoints.empty()) {
+                const U32 new_value = bytes == 4 ? value : value & ((U32(1) << (bytes * 8)) - 1);
+                check_watchpoints(WATCH_WRITE, address, bytes, read_bytes(host, size), new_value, fault);
+            }
         }
+        write_bytes(host, value, size);
     }
 };
 
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <memory>
+
+#include "../data_types.h"
+
+
+namespace Mem
+{
+
+const U32 PAGE_BITS = 12;
+const U32 PAGE_SIZE = 1 << PAGE_BITS; // 4 KiB
+const U32 PAGE_OFFSET_MASK = PAGE_SIZE - 1;
+
+
+enum PagePermissions : U8
+{
+    PAGE_NONE  = 0,
+    PAGE_READ  = 1 << 0,
+    PAGE_WRITE = 1 << 1,
+};
+
+
+/**
+ * Mapping of a guest page to the host memory.
+ *
+ * A region may start or end in the middle of a page, therefore only the bytes between 'first' and 'end' of the page
+ * are mapped.
+ */
+struct PageEntry
+{
+    U8* host = nullptr; // Host address of the first mapped byte of the page
+    U16 first = 0;      // Offset of the first mapped byte in the page
+    U16 end = 0;        // Offset after the last mapped byte in the page
+    U8 permissions = PAGE_NONE;
+    U16 region = 0;     // Index of the memory region of the mapped bytes
+
+    [[nodiscard]] bit is_mapped() const { return end > first; }
+};
+
+
+/**
+ * Page table of the 32-bit guest address space, in two levels: the directory is indexed by the upper bits of the
+ * address, and each table by the following bits. Tables are only allocated for the mapped parts of the address space.
+ */
+class PageTable
+{
+    static const U32 TABLE_BITS = 10;
+    static const U32 TABLE_SIZE = 1 << TABLE_BITS;
+    static const U32 DIRECTORY_SIZE = 1 << (32 - PAGE_BITS - TABLE_BITS);
+
+    std::array<std::unique_ptr<PageEntry[]>, DIRECTORY_SIZE> directory;
+
+    PageEntry& get_or_create_entry(U32 address)
+    {
+        std::unique_ptr<PageEntry[]>& table = directory[address >> (PAGE_BITS + TABLE_BITS)];
+        if (!table) {
+            table = std::make_unique<PageEntry[]>(TABLE_SIZE);
+        }
+        return table[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+    }
+
+public:
+    /**
+     * Maps the guest range of 'size' bytes starting at 'address' to the host memory.
+     *
+     * A page already mapped by another region keeps its mapping: the accesses to the rest of the page are not
+     * translated by the table.
+     */
+    void map(U32 address, U32 size, U8* host, U8 permissions, U16 region)
+    {
+        const U64 end = U64(address) + size;
+        U64 pos = address;
+        while (pos < end) {
+            const U64 page_end = (pos & ~U64(PAGE_OFFSET_MASK)) + PAGE_SIZE;
+            const U64 mapped_end = page_end < end ? page_end : end;
+
+            PageEntry& entry = get_or_create_entry(U32(pos));
+            if (!entry.is_mapped()) {
+                entry = {
+                    .host = host + (pos - address),
+                    .first = U16(pos & PAGE_OFFSET_MASK),
+                    .end = U16(mapped_end - (pos & ~U64(PAGE_OFFSET_MASK))),
+                    .permissions = permissions,
+                    .region = region,
+                };
+            }
+
+            pos = mapped_end;
+        }
+    }
+
+    /**
+     * Returns the entry of the page containing the address, or nullptr if nothing is mapped in this page.
+     */
+    [[nodiscard]]
+    PageEntry* find(U32 address)
+    {
+        const std::unique_ptr<PageEntry[]>& table = directory[address >> (PAGE_BITS + TABLE_BITS)];
+        if (!table) {
+            return nullptr;
+        }
+        PageEntry& entry = table[(address >> PAGE_BITS) & (TABLE_SIZE - 1)];
+        return entry.is_mapped() ? &entry : nullptr;
+    }
+
+    [[nodiscard]]
+    const PageEntry* find(U32 address) const
+    {
+        return const_cast<PageTable*>(this)->find(address);
+    }
+};
+
+
+/**
+ * Small direct-mapped cache of page translations, indexed by the lower bits of the page number.
+ *
+ * Each entry stores the mapped guest range of its page, so a single comparison checks both that the entry is for the
+ * right page and that the whole access is in the mapped part of the page. Accesses crossing the end of the range
+ * always miss.
+ */
+template<U32 N>
+class TLB
+{
+    static_assert((N & (N - 1)) == 0, "The number of entries must be a power of 2");
+
+    struct Entry
+    {
+        U32 base = 0;   // Guest address of the first mapped byte of the page
+        U32 length = 0; // Number of mapped bytes of the page
+        U8* host = nullptr;
+    };
+
+    std::array<Entry, N> entries{};
+
+public:
+    /**
+     * Returns the host address of the access of 'bytes' bytes at 'address', or nullptr if the translation is not
+     * cached.
+     */
+    [[nodiscard]]
+    U8* lookup(U32 address, U32 bytes) const
+    {
+        const Entry& entry = entries[(address >> PAGE_BITS) & (N - 1)];
+        const U32 offset = address - entry.base;
+        if (U64(offset) + bytes <= entry.length) {
+            return entry.host + offset;
+        }
+        return nullptr;
+    }
+
+    void insert(U32 address, const PageEntry& page)
+    {
+        entries[(address >> PAGE_BITS) & (N - 1)] = {
+            .base = (address & ~PAGE_OFFSET_MASK) + page.first,
+            .length = U32(page.end - page.first),
+            .host = page.host,
+        };
+    }
+
+    void flush()
+    {
+        entries.fill({});
+    }
+};
+
+}
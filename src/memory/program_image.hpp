@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "../data_types.h"
+#include "../CPU/instructions.h"
+#include "mapped_file.hpp"
+#include "memory_layout.hpp"
+#include "region.hpp"
+
+
+namespace Mem
+{
+
+/**
+ * Immutable parts of a program: its instructions, its memory layout, the read-only regions and the initial contents
+ * of the writable regions.
+ *
+ * An image is shared by all the memories running the same program, through a shared pointer. Nothing is modified
+ * after the construction, therefore it can be used from any number of threads without locking.
+ *
+ * The instructions and contents come either from vectors owned by the image, or directly from mapped files, which are
+ * then kept alive by the image. The read-only regions are only allocated once here. The writable regions are
+ * allocated by each memory, and their initial contents are mapped privately from the file when possible, sharing
+ * the pages with the image until they are written to.
+ */
+class ProgramImage
+{
+    U32 text_pos;
+    U32 text_size;
+
+    std::vector<Inst> owned_instructions;
+    std::shared_ptr<const MappedFile> instructions_file;
+    std::span<const Inst> instructions;
+
+    MemoryLayout layout;
+
+    // The contents of the regions are either in 'owned_contents', at the index of their region, or in 'contents_file'
+    // at the contents offset of their region
+    std::vector<std::vector<U8>> owned_contents;
+    std::shared_ptr<const MappedFile> contents_file;
+
+    std::vector<std::optional<Region>> read_only_regions; // Only for the regions which cannot be written to
+
+    static void check_layout(const MemoryLayout& layout)
+    {
+        if (layout.stack_region >= layout.regions.size()) {
+            throw std::invalid_argument("The stack region is not in the memory layout");
+        }
+        if (layout.ram_region != NO_REGION) {
+            if (layout.ram_region >= layout.regions.size()) {
+                throw std::invalid_argument("The RAM region is not in the memory layout");
+            }
+            const RegionDesc& ram = layout.regions[layout.ram_region];
+            if (ram.size != RAM_SIZE || !(ram.permissions & PAGE_WRITE)) {
+                throw std::invalid_argument("The RAM region must be writable and of RAM_SIZE bytes");
+            }
+        }
+
+        for (size_t i = 0; i < layout.regions.size(); i++) {
+            const RegionDesc& region = layout.regions[i];
+            if (region.size == 0 || region.end() > (U64(1) << 32)) {
+                throw std::invalid_argument("Invalid memory region size");
+            }
+            for (size_t j = 0; j < i; j++) {
+                const RegionDesc& other = layout.regions[j];
+                if (region.base < other.end() && other.base < region.end()) {
+                    throw std::invalid_argument("Overlapping memory regions");
+                }
+            }
+        }
+    }
+
+    static std::span<const Inst> get_mapped_instructions(const MappedFile& file, U64 offset, U32 count)
+    {
+        static_assert(std::is_trivially_copyable_v<Inst>, "Instructions are read directly from their file");
+
+        if (file.get_size() < offset + U64(count) * sizeof(Inst)) {
+            throw std::invalid_argument("The instructions file is too small");
+        }
+        if (offset % alignof(Inst) != 0) {
+            throw std::invalid_argument("The instructions are not aligned in their file");
+        }
+        return { reinterpret_cast<const Inst*>(file.get_bytes() + offset), count };
+    }
+
+    void create_read_only_regions()
+    {
+        read_only_regions.resize(layout.regions.size());
+        for (size_t i = 0; i < layout.regions.size(); i++) {
+            if (!(layout.regions[i].permissions & PAGE_WRITE)) {
+                read_only_regions[i].emplace(layout.regions[i].size);
+                load_initial_contents(i, *read_only_regions[i]);
+            }
+        }
+    }
+
+public:
+    /**
+     * Image owning its instructions, and the initial contents of the regions at the same index. The contents offsets
+     * of the layout are ignored.
+     */
+    ProgramImage(U32 text_pos, U32 text_size, std::vector<Inst>&& instructions, const MemoryLayout& layout,
+                 std::vector<std::vector<U8>>&& contents = {})
+        : text_pos(text_pos), text_size(text_size),
+          owned_instructions(std::move(instructions)),
+          instructions(owned_instructions),
+          layout((check_layout(layout), layout)),
+          owned_contents(std::move(contents))
+    {
+        owned_contents.resize(this->layout.regions.size());
+        for (size_t i = 0; i < this->layout.regions.size(); i++) {
+            RegionDesc& region = this->layout.regions[i];
+            if (owned_contents[i].size() > region.size) {
+                throw std::invalid_argument("The contents of a region are bigger than the region");
+            }
+            region.contents_offset = 0;
+            region.contents_size = U32(owned_contents[i].size());
+        }
+        create_read_only_regions();
+    }
+
+    /**
+     * Image using the 'instructions_count' instructions at 'instructions_offset' of the instructions file, and the
+     * contents of the regions from the contents file, both in place. Contents past the end of the file are zero.
+     */
+    ProgramImage(U32 text_pos, std::shared_ptr<const MappedFile> instructions_file, U64 instructions_offset,
+                 U32 instructions_count, const MemoryLayout& layout, std::shared_ptr<const MappedFile> contents_file)
+        : text_pos(text_pos), text_size(instructions_count * sizeof(Inst)),
+          instructions_file(std::move(instructions_file)),
+          instructions(get_mapped_instructions(*this->instructions_file, instructions_offset, instructions_count)),
+          layout((check_layout(layout), layout)),
+          contents_file(std::move(contents_file))
+    {
+        for (RegionDesc& region : this->layout.regions) {
+            if (region.contents_size > region.size) {
+                throw std::invalid_argument("The contents of a region are bigger than the region");
+            }
+            const U64 file_size = this->contents_file->get_size();
+            const U64 available = file_size > region.contents_offset ? file_size - region.contents_offset : 0;
+            region.contents_size = U32(std::min<U64>(region.contents_size, available));
+        }
+        create_read_only_regions();
+    }
+
+    ProgramImage(const ProgramImage&) = delete;
+    ProgramImage& operator=(const ProgramImage&) = delete;
+
+    [[nodiscard]] U32 get_text_pos() const { return text_pos; }
+    [[nodiscard]] U32 get_text_size() const { return text_size; }
+    [[nodiscard]] std::span<const Inst> get_instructions() const { return instructions; }
+    [[nodiscard]] const MemoryLayout& get_layout() const { return layout; }
+
+    /**
+     * Returns the shared region if it cannot be written to, or nullptr.
+     */
+    [[nodiscard]]
+    const Region* get_read_only_region(size_t i) const
+    {
+        return read_only_regions.at(i) ? &*read_only_regions[i] : nullptr;
+    }
+
+    [[nodiscard]]
+    std::span<const U8> get_initial_contents(size_t i) const
+    {
+        const RegionDesc& region = layout.regions.at(i);
+        if (contents_file) {
+            return { contents_file->get_bytes() + region.contents_offset, region.contents_size };
+        }
+        return owned_contents[i];
+    }
+
+    /**
+     * Fills the new host memory of the region with its initial contents. Whole host pages are mapped privately from
+     * the contents file when they are aligned in it, and are only copied by the host when they are written to.
+     */
+    void load_initial_contents(size_t i, Region& region) const
+    {
+        const std::span<const U8> contents = get_initial_contents(i);
+        if (contents.empty()) {
+            return;
+        }
+
+        U32 mapped = 0;
+        if (contents_file) {
+            mapped = region.map_file(contents_file->get_fd(), layout.regions[i].contents_offset, U32(contents.size()));
+        }
+        if (contents.size() > mapped) {
+            std::memcpy(region.get_bytes() + mapped, contents.data() + mapped, contents.size() - mapped);
+        }
+    }
+};
+
+}
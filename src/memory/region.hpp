@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define MCX86_MMAP_REGIONS 1
+#else
+#define MCX86_MMAP_REGIONS 0
+#endif
+
+#include "../data_types.h"
+
+
+namespace Mem
+{
+
+/**
+ * Zero-initialized host memory backing a region of the guest memory.
+ *
+ * The bytes are only reserved with an anonymous mapping: the host commits each page the first time it is touched, so
+ * a region costs only the pages used by the guest, and creating one doesn't need to clear anything.
+ * Without mmap, the bytes are allocated with calloc, which may do the same for large sizes.
+ */
+class Region
+{
+    U8* bytes = nullptr;
+    U32 size = 0;
+
+public:
+    explicit Region(U32 size)
+        : size(size)
+    {
+#if MCX86_MMAP_REGIONS
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#else
+        void* ptr = std::calloc(size, 1);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+#endif
+        bytes = static_cast<U8*>(ptr);
+    }
+
+    ~Region()
+    {
+        if (bytes == nullptr) {
+            return;
+        }
+#if MCX86_MMAP_REGIONS
+        munmap(bytes, size);
+#else
+        std::free(bytes);
+#endif
+    }
+
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    Region(Region&& other) noexcept
+        : bytes(other.bytes), size(other.size)
+    {
+        other.bytes = nullptr;
+        other.size = 0;
+    }
+
+    Region& operator=(Region&&) = delete;
+
+    [[nodiscard]] U8* get_bytes() const { return bytes; }
+    [[nodiscard]] U32 get_size() const { return size; }
+
+    /**
+     * Maps the whole host pages of the first 'count' bytes of the region to the file at 'offset', privately: the pages
+     * are shared with the page cache until they are written to. The offset must be aligned on a host page.
+     * Returns the number of bytes mapped, the remaining ones must be copied by the caller.
+     */
+    U32 map_file(int fd, U64 offset, U32 count)
+    {
+#if MCX86_MMAP_REGIONS
+        const U32 page_size = get_host_page_size();
+        const U32 mapped = std::min(count, size) / page_size * page_size;
+        if (fd < 0 || offset % page_size != 0 || mapped == 0) {
+            return 0;
+        }
+
+        void* ptr = mmap(bytes, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off_t(offset));
+        if (ptr == MAP_FAILED) {
+            // The anonymous mapping may have been replaced partially: restore it before copying the bytes instead
+            mmap(bytes, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+            return 0;
+        }
+        return mapped;
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * Size of the pages of the host, in bytes.
+     */
+    [[nodiscard]]
+    static U32 get_host_page_size()
+    {
+#if MCX86_MMAP_REGIONS
+        static const U32 page_size = U32(sysconf(_SC_PAGESIZE));
+        return page_size;
+#else
+        return 4096;
+#endif
+    }
+
+    [[nodiscard]]
+    U32 get_pages_count() const
+    {
+        return (size + get_host_page_size() - 1) / get_host_page_size();
+    }
+
+    /**
+     * Returns the number of host pages of the region currently committed in memory.
+     * Without mmap, all pages are considered resident.
+     */
+    [[nodiscard]]
+    U32 get_resident_pages_count() const
+    {
+#if MCX86_MMAP_REGIONS
+#ifdef __APPLE__
+        std::vector<char> residency(get_pages_count());
+#else
+        std::vector<unsigned char> residency(get_pages_count());
+#endif
+        if (mincore(bytes, size, residency.data()) != 0) {
+            return get_pages_count();
+        }
+
+        U32 count = 0;
+        for (auto page : residency) {
+            count += page & 1;
+        }
+        return count;
+#else
+        return get_pages_count();
+#endif
+    }
+};
+
+}
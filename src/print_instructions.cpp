@@ -1,7 +1,7 @@
 ﻿
 #include <iostream>
 #include <iomanip>
-#include <vector>
+#include <span>
 
 #include "CPU/instructions.h"
 #include "CPU/opcodes.h"
@@ -165,10 +165,10 @@ void print_instruction(U32 inst_address, const Inst& inst)
 }
 
 
-void print_instructions(const std::vector<Inst>* insts, int start, size_t count, size_t address)
+void print_instructions(std::span<const Inst> insts, int start, size_t count, size_t address)
 {
 	for (int i = start; i < start + count; i++) {
-		print_instruction(address, (*insts)[i]);
+		print_instruction(address, insts[i]);
         address++;
     }
 }
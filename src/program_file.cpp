@@ -0,0 +1,368 @@
+#include <array>
+#include <bit>
+#include <cstring>
+#include <fstream>
+
+#include "program_file.h"
+#include "memory/memory_manager.hpp"
+#include "logger.h"
+
+
+static_assert(std::endian::native == std::endian::little, "Program files are written with the host byte order");
+
+
+namespace ProgramFile
+{
+
+static constexpr std::array<U32, 256> make_crc32_table()
+{
+    std::array<U32, 256> table{};
+    for (U32 i = 0; i < 256; i++) {
+        U32 crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+
+/**
+ * CRC-32 (IEEE 802.3). The CRC of data in several parts is computed by passing the CRC of the previous parts.
+ */
+U32 crc32(const U8* bytes, size_t size, U32 crc)
+{
+    static constexpr std::array<U32, 256> table = make_crc32_table();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+
+static U32 header_checksum(const Header& header, std::span<const SectionEntry> sections)
+{
+    Header copy = header;
+    copy.checksum = 0;
+    const U32 crc = crc32(reinterpret_cast<const U8*>(&copy), sizeof(Header));
+    return crc32(reinterpret_cast<const U8*>(sections.data()), sections.size_bytes(), crc);
+}
+
+
+static U64 align_section(U64 offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+
+bool write(const std::string& filename, const ProgramContents& program)
+{
+    if (program.regions_contents.size() > program.layout.regions.size()) {
+        Logger::err() << "There are more region contents than regions.\n";
+        return false;
+    }
+
+    // All sections, in the order they are written to the file
+    std::vector<SectionEntry> sections;
+    std::vector<std::vector<U8>> sections_bytes;
+    auto add_section = [&](SectionType type, U32 index, std::vector<U8>&& bytes) {
+        sections.push_back({ .type = type, .index = index, .offset = 0, .size = bytes.size(),
+                             .checksum = crc32(bytes.data(), bytes.size()), .reserved = 0 });
+        sections_bytes.push_back(std::move(bytes));
+    };
+    auto to_bytes = [](const void* data, size_t size) {
+        const U8* begin = static_cast<const U8*>(data);
+        return std::vector<U8>(begin, begin + size);
+    };
+
+    add_section(SectionType::Instructions, 0,
+                to_bytes(program.instructions.data(), program.instructions.size() * sizeof(Inst)));
+
+    const LayoutHeader layout_header{ U32(program.layout.regions.size()), program.layout.stack_region,
+                                      program.layout.ram_region };
+    std::vector<U8> layout_bytes = to_bytes(&layout_header, sizeof(layout_header));
+    for (const Mem::RegionDesc& region : program.layout.regions) {
+        const LayoutRegion record{ region.base, region.size, region.permissions, 0 };
+        const std::vector<U8> record_bytes = to_bytes(&record, sizeof(record));
+        layout_bytes.insert(layout_bytes.end(), record_bytes.begin(), record_bytes.end());
+    }
+    add_section(SectionType::Layout, 0, std::move(layout_bytes));
+
+    for (size_t i = 0; i < program.regions_contents.size(); i++) {
+        if (!program.regions_contents[i].empty()) {
+            add_section(SectionType::RegionContents, U32(i), std::vector<U8>(program.regions_contents[i]));
+        }
+    }
+
+    add_section(SectionType::InstructionsMap, 0,
+                to_bytes(program.instructions_map.data(),
+                         program.instructions_map.size() * sizeof(InstructionsMapEntry)));
+
+    std::vector<U8> symbols_bytes;
+    for (const Symbol& symbol : program.symbols) {
+        const SymbolRecord record{ symbol.address, U32(symbol.name.size()) };
+        const std::vector<U8> record_bytes = to_bytes(&record, sizeof(record));
+        symbols_bytes.insert(symbols_bytes.end(), record_bytes.begin(), record_bytes.end());
+        symbols_bytes.insert(symbols_bytes.end(), symbol.name.begin(), symbol.name.end());
+    }
+    add_section(SectionType::Symbols, 0, std::move(symbols_bytes));
+
+    U64 offset = align_section(sizeof(Header) + sections.size() * sizeof(SectionEntry));
+    for (SectionEntry& section : sections) {
+        section.offset = offset;
+        offset = align_section(offset + section.size);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.inst_size = sizeof(Inst);
+    header.sections_count = U32(sections.size());
+    header.entry_point = program.entry_point;
+    header.text_pos = program.text_pos;
+    header.checksum = header_checksum(header, sections);
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        Logger::err() << "Could not open the program file '" << filename << "' for writing.\n";
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(sections.data()), std::streamsize(sections.size() * sizeof(SectionEntry)));
+
+    U64 file_end = sizeof(Header) + sections.size() * sizeof(SectionEntry);
+    U64 sections_end = file_end;
+    for (size_t i = 0; i < sections.size(); i++) {
+        file.seekp(std::streamoff(sections[i].offset));
+        file.write(reinterpret_cast<const char*>(sections_bytes[i].data()), std::streamsize(sections_bytes[i].size()));
+        if (sections[i].size > 0) {
+            file_end = sections[i].offset + sections[i].size;
+        }
+        sections_end = sections[i].offset + sections[i].size;
+    }
+
+    // Empty sections at the end are still in the file
+    if (file_end < sections_end) {
+        file.seekp(std::streamoff(file_end));
+        const std::vector<char> padding(sections_end - file_end, 0);
+        file.write(padding.data(), std::streamsize(padding.size()));
+    }
+
+    if (!file) {
+        Logger::err() << "Error while writing the program file '" << filename << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+
+Reader::Reader(std::shared_ptr<const Mem::MappedFile> file)
+    : file(std::move(file))
+{ }
+
+
+bool Reader::validate(const std::string& filename)
+{
+    if (file->get_size() < sizeof(Header)) {
+        Logger::err() << "'" << filename << "' is not a program file: too small.\n";
+        return false;
+    }
+
+    header = reinterpret_cast<const Header*>(file->get_bytes());
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        Logger::err() << "'" << filename << "' is not a program file.\n";
+        return false;
+    }
+    if (header->version != VERSION) {
+        Logger::err() << "Unsupported version of the program file '" << filename << "': " << header->version
+                      << ", expected " << VERSION << ".\n";
+        return false;
+    }
+    if (header->inst_size != sizeof(Inst)) {
+        Logger::err() << "The instructions of the program file '" << filename << "' have a different format: "
+                      << header->inst_size << " bytes per instruction, expected " << sizeof(Inst) << ".\n";
+        return false;
+    }
+
+    const U64 table_end = sizeof(Header) + U64(header->sections_count) * sizeof(SectionEntry);
+    if (table_end > file->get_size()) {
+        Logger::err() << "The sections table of the program file '" << filename << "' is truncated.\n";
+        return false;
+    }
+    sections = { reinterpret_cast<const SectionEntry*>(file->get_bytes() + sizeof(Header)), header->sections_count };
+
+    if (header_checksum(*header, sections) != header->checksum) {
+        Logger::err() << "The header of the program file '" << filename << "' is corrupted.\n";
+        return false;
+    }
+
+    for (const SectionEntry& section : sections) {
+        if (section.offset % SECTION_ALIGNMENT != 0 || section.offset < table_end
+            || section.offset + section.size > file->get_size() || section.offset + section.size < section.offset) {
+            Logger::err() << "Invalid section in the program file '" << filename << "'.\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+std::unique_ptr<Reader> Reader::open(const std::string& filename)
+{
+    std::shared_ptr<const Mem::MappedFile> file;
+    try {
+        file = std::make_shared<const Mem::MappedFile>(filename);
+    }
+    catch (std::system_error& e) {
+        Logger::err() << e.what() << "\n";
+        return nullptr;
+    }
+
+    std::unique_ptr<Reader> reader(new Reader(std::move(file)));
+    if (!reader->validate(filename)) {
+        return nullptr;
+    }
+    return reader;
+}
+
+
+bool Reader::verify_checksums() const
+{
+    for (const SectionEntry& section : sections) {
+        const std::span<const U8> bytes = get_section_bytes(section);
+        if (crc32(bytes.data(), bytes.size()) != section.checksum) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+const SectionEntry* Reader::find_section(SectionType type, U32 index) const
+{
+    for (const SectionEntry& section : sections) {
+        if (section.type == type && section.index == index) {
+            return &section;
+        }
+    }
+    return nullptr;
+}
+
+
+std::span<const U8> Reader::get_section_bytes(const SectionEntry& section) const
+{
+    return { file->get_bytes() + section.offset, size_t(section.size) };
+}
+
+
+bool Reader::get_layout(Mem::MemoryLayout& layout) const
+{
+    const SectionEntry* section = find_section(SectionType::Layout);
+    if (section == nullptr || section->size < sizeof(LayoutHeader)) {
+        return false;
+    }
+
+    const std::span<const U8> bytes = get_section_bytes(*section);
+    const auto* layout_header = reinterpret_cast<const LayoutHeader*>(bytes.data());
+    if (section->size != sizeof(LayoutHeader) + U64(layout_header->regions_count) * sizeof(LayoutRegion)) {
+        return false;
+    }
+    const auto* records = reinterpret_cast<const LayoutRegion*>(bytes.data() + sizeof(LayoutHeader));
+
+    layout.regions.resize(layout_header->regions_count);
+    layout.stack_region = layout_header->stack_region;
+    layout.ram_region = layout_header->ram_region;
+    for (U32 i = 0; i < layout_header->regions_count; i++) {
+        Mem::RegionDesc& region = layout.regions[i];
+        region = {
+            .base = records[i].base,
+            .size = records[i].size,
+            .permissions = U8(records[i].permissions),
+        };
+
+        if (const SectionEntry* contents = find_section(SectionType::RegionContents, i)) {
+            if (contents->size > region.size || contents->offset > U32(-1)) {
+                return false;
+            }
+            region.contents_offset = U32(contents->offset);
+            region.contents_size = U32(contents->size);
+        }
+    }
+
+    return true;
+}
+
+
+std::span<const InstructionsMapEntry> Reader::get_instructions_map() const
+{
+    const SectionEntry* section = find_section(SectionType::InstructionsMap);
+    if (section == nullptr) {
+        return {};
+    }
+    const std::span<const U8> bytes = get_section_bytes(*section);
+    return { reinterpret_cast<const InstructionsMapEntry*>(bytes.data()), bytes.size() / sizeof(InstructionsMapEntry) };
+}
+
+
+std::vector<Symbol> Reader::get_symbols() const
+{
+    std::vector<Symbol> symbols;
+    const SectionEntry* section = find_section(SectionType::Symbols);
+    if (section == nullptr) {
+        return symbols;
+    }
+
+    const std::span<const U8> bytes = get_section_bytes(*section);
+    size_t pos = 0;
+    while (pos + sizeof(SymbolRecord) <= bytes.size()) {
+        SymbolRecord record{};
+        std::memcpy(&record, bytes.data() + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.name_size > bytes.size() - pos) {
+            break;
+        }
+        symbols.push_back({ record.address, std::string(reinterpret_cast<const char*>(bytes.data() + pos),
+                                                        record.name_size) });
+        pos += record.name_size;
+    }
+    return symbols;
+}
+
+
+std::shared_ptr<const Mem::ProgramImage> Reader::create_image() const
+{
+    Mem::MemoryLayout layout;
+    if (!get_layout(layout)) {
+        Logger::err() << "Invalid memory layout section in the program file.\n";
+        return nullptr;
+    }
+
+    const SectionEntry* instructions = find_section(SectionType::Instructions);
+    if (instructions == nullptr || instructions->size % sizeof(Inst) != 0) {
+        Logger::err() << "Invalid instructions section in the program file.\n";
+        return nullptr;
+    }
+
+    try {
+        return std::make_shared<const Mem::ProgramImage>(header->text_pos, file, instructions->offset,
+                                                         U32(instructions->size / sizeof(Inst)), layout, file);
+    }
+    catch (std::invalid_argument& e) {
+        Logger::err() << "Invalid program: " << e.what() << "\n";
+        return nullptr;
+    }
+}
+
+
+Mem::Memory* Reader::create_memory() const
+{
+    std::shared_ptr<const Mem::ProgramImage> image = create_image();
+    return image ? new Mem::Memory(std::move(image)) : nullptr;
+}
+
+}
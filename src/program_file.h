@@ -0,0 +1,191 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "CPU/instructions.h"
+#include "memory/mapped_file.hpp"
+#include "memory/memory_layout.hpp"
+
+
+namespace Mem { class Memory; class ProgramImage; }
+
+
+/**
+ * Single-file container of a program, replacing the memory map, memory contents, instructions and instructions map
+ * files.
+ *
+ * The file starts with a header and a table of sections, followed by the sections. Each section is aligned for mmap,
+ * so the instructions are used in place and the contents of the regions can be mapped privately from the file.
+ * All values are little-endian. The header and the table are always validated when the file is opened, the
+ * checksums of the sections only on demand, as it requires reading the whole file.
+ *
+ * Sections:
+ *  - Instructions: the Inst array of the text
+ *  - Layout: the memory regions, see LayoutHeader and LayoutRegion
+ *  - RegionContents: the initial contents of a region, its index is the one of the region
+ *  - InstructionsMap: array of InstructionsMapEntry, from the original address of each instruction to its index
+ *  - Symbols: sequence of SymbolRecord, each followed by the characters of its name
+ */
+namespace ProgramFile
+{
+
+constexpr char MAGIC[8] = { 'M', 'C', 'X', '8', '6', 'P', 'R', 'G' };
+constexpr U32 VERSION = 2;
+constexpr U32 SECTION_ALIGNMENT = 0x4000; // Larger than the host pages of all supported hosts
+
+
+enum class SectionType : U32
+{
+    Instructions    = 1,
+    Layout          = 2,
+    RegionContents  = 3,
+    InstructionsMap = 4,
+    Symbols         = 5,
+};
+
+
+struct Header
+{
+    char magic[8];
+    U32 version;
+    U32 inst_size;      // sizeof(Inst) of the emulator which wrote the file
+    U32 sections_count;
+    U32 entry_point;
+    U32 text_pos;
+    U32 checksum;       // CRC-32 of the header and the sections table, computed with this field at 0
+};
+
+
+struct SectionEntry
+{
+    SectionType type;
+    U32 index;    // Index of the region of RegionContents sections, 0 for the others
+    U64 offset;   // From the start of the file, a multiple of SECTION_ALIGNMENT
+    U64 size;
+    U32 checksum; // CRC-32 of the section
+    U32 reserved;
+};
+
+
+struct LayoutHeader
+{
+    U32 regions_count;
+    U32 stack_region;
+    U32 ram_region; // Mem::NO_REGION if there is none
+};
+
+
+struct LayoutRegion
+{
+    U32 base;
+    U32 size;
+    U32 permissions; // Mem::PagePermissions
+    U32 reserved;
+};
+
+
+struct InstructionsMapEntry
+{
+    U32 address; // Address of the instruction in the original program
+    U32 index;   // Index of the instruction in the text
+
+    bool operator==(const InstructionsMapEntry& other) const = default;
+};
+
+
+struct SymbolRecord
+{
+    U32 address;
+    U32 name_size; // Number of characters of the name following the record, without padding
+};
+
+
+struct Symbol
+{
+    U32 address;
+    std::string name;
+
+    bool operator==(const Symbol& other) const = default;
+};
+
+
+/**
+ * All parts of a program, to write it to a file. The contents offsets of the regions are ignored, the contents of
+ * each region are in 'regions_contents', at the same index.
+ */
+struct ProgramContents
+{
+    U32 entry_point = 0;
+    U32 text_pos = 0;
+    std::vector<Inst> instructions;
+    Mem::MemoryLayout layout;
+    std::vector<std::vector<U8>> regions_contents;
+    std::vector<InstructionsMapEntry> instructions_map;
+    std::vector<Symbol> symbols;
+};
+
+
+[[nodiscard]] U32 crc32(const U8* bytes, size_t size, U32 crc = 0);
+
+
+/**
+ * Writes the program to the file. Returns false and logs the error if the file cannot be written.
+ */
+bool write(const std::string& filename, const ProgramContents& program);
+
+
+class Reader
+{
+    std::shared_ptr<const Mem::MappedFile> file;
+    const Header* header = nullptr;
+    std::span<const SectionEntry> sections;
+
+    explicit Reader(std::shared_ptr<const Mem::MappedFile> file);
+
+    [[nodiscard]] bool validate(const std::string& filename);
+
+public:
+    /**
+     * Opens the file and validates its header and its table of sections. Returns nullptr and logs the error if the
+     * file is not a valid program file.
+     */
+    static std::unique_ptr<Reader> open(const std::string& filename);
+
+    /**
+     * Returns true if the contents of all sections match their checksums.
+     */
+    [[nodiscard]] bool verify_checksums() const;
+
+    [[nodiscard]] U32 get_entry_point() const { return header->entry_point; }
+    [[nodiscard]] U32 get_text_pos() const { return header->text_pos; }
+    [[nodiscard]] std::span<const SectionEntry> get_sections() const { return sections; }
+
+    [[nodiscard]] const SectionEntry* find_section(SectionType type, U32 index = 0) const;
+    [[nodiscard]] std::span<const U8> get_section_bytes(const SectionEntry& section) const;
+
+    /**
+     * Reads the layout of the memory, with the contents offsets of the regions in the file. Returns false if it is
+     * invalid.
+     */
+    [[nodiscard]] bool get_layout(Mem::MemoryLayout& layout) const;
+
+    [[nodiscard]] std::span<const InstructionsMapEntry> get_instructions_map() const;
+    [[nodiscard]] std::vector<Symbol> get_symbols() const;
+
+    /**
+     * Creates the image of the program: the instructions are used in place, and the contents of the regions are
+     * mapped from the file, which is kept by the image. Returns nullptr and logs the error if the sections are
+     * invalid.
+     */
+    [[nodiscard]] std::shared_ptr<const Mem::ProgramImage> create_image() const;
+
+    /**
+     * Creates a memory using a new image of the program, or returns nullptr.
+     */
+    [[nodiscard]] Mem::Memory* create_memory() const;
+};
+
+}
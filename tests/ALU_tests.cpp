@@ -1,7 +1,10 @@
 
 #include "doctest.h"
 
+#include <vector>
+
 #include "ALU.hpp"
+#include "NativeALU.hpp"
 
 
 TEST_SUITE("ALU_negate")
@@ -277,3 +280,129 @@ TEST_SUITE("ALU_equal")
         REQUIRE(res == (a == b));
     }
 }
+
+
+/**
+ * Some interesting values and pseudo-random ones, truncated to N.
+ */
+template<typename N>
+std::vector<N> test_values()
+{
+    std::vector<N> values{
+        N(0), N(1), N(2), N(3), N(10), N(0x0F), N(0x10), N(0x7F), N(0x80), N(0xFF), N(0x100), N(0x7FFF), N(0x8000),
+        N(0xFFFF), N(0x10000), N(0x7FFFFFFF), N(0x80000000), N(0xFFFFFFFF), N(-2), N(-10)
+    };
+
+    U64 state = 0x9E3779B97F4A7C15;
+    for (int i = 0; i < 200; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        values.push_back(N(state >> (i % 40))); // varied magnitudes
+    }
+
+    return values;
+}
+
+
+template<typename N>
+void check_same_unary_results(N a)
+{
+    CAPTURE(a);
+
+    CHECK_EQ(NativeALU::check_parity(a), CircuitALU::check_parity(a));
+    CHECK_EQ(NativeALU::negate(a), CircuitALU::negate(a));
+    CHECK_EQ(NativeALU::abs(a), CircuitALU::abs(a));
+
+    bit native_zero, circuit_zero;
+    CHECK_EQ(NativeALU::get_first_set_bit_index(a, native_zero), CircuitALU::get_first_set_bit_index(a, circuit_zero));
+    CHECK_EQ(native_zero, circuit_zero);
+    CHECK_EQ(NativeALU::get_last_set_bit_index(a, native_zero), CircuitALU::get_last_set_bit_index(a, circuit_zero));
+    CHECK_EQ(native_zero, circuit_zero);
+
+    if constexpr (std::is_unsigned_v<N>) {
+        CHECK_EQ(NativeALU::check_power_of_2(a), CircuitALU::check_power_of_2(a));
+
+        for (OpSize size : { OpSize::DW, OpSize::W, OpSize::B, OpSize::UNKNOWN }) {
+            CHECK_EQ(NativeALU::sign_extend(a, size), CircuitALU::sign_extend(a, size));
+        }
+    }
+}
+
+
+template<typename N>
+void check_same_binary_results(N a, N b)
+{
+    CAPTURE(a);
+    CAPTURE(b);
+
+    CHECK_EQ(NativeALU::compare_equal(a, b), CircuitALU::compare_equal(a, b));
+    CHECK_EQ(NativeALU::compare_greater(a, b), CircuitALU::compare_greater(a, b));
+
+    bit native_eq = false, circuit_eq = false;
+    CHECK_EQ(NativeALU::compare_greater_or_equal_with_eq(a, b, native_eq),
+             CircuitALU::compare_greater_or_equal_with_eq(a, b, circuit_eq));
+    CHECK_EQ(native_eq, circuit_eq);
+
+    for (bit carry_in : { false, true }) {
+        bit native_carry = carry_in, circuit_carry = carry_in;
+        CHECK_EQ(NativeALU::add(a, b, native_carry), CircuitALU::add(a, b, circuit_carry));
+        CHECK_EQ(native_carry, circuit_carry);
+    }
+
+    bit native_carry = false, circuit_carry = false;
+    CHECK_EQ(NativeALU::sub(a, b, native_carry), CircuitALU::sub(a, b, circuit_carry));
+    CHECK_EQ(native_carry, circuit_carry);
+    CHECK_EQ(NativeALU::sub_no_carry(a, U8(b)), CircuitALU::sub_no_carry(a, U8(b)));
+
+    bit native_overflow = false, circuit_overflow = false;
+    CHECK_EQ(NativeALU::multiply(a, b, native_overflow), CircuitALU::multiply(a, b, circuit_overflow));
+    CHECK_EQ(native_overflow, circuit_overflow);
+
+    N native_q = 1, native_r = 1, circuit_q = 1, circuit_r = 1;
+    bit native_div_by_zero = false, circuit_div_by_zero = false;
+    if constexpr (std::is_unsigned_v<N>) {
+        NativeALU::unsigned_divide(a, b, native_q, native_r, native_div_by_zero);
+        CircuitALU::unsigned_divide(a, b, circuit_q, circuit_r, circuit_div_by_zero);
+    }
+    else {
+        NativeALU::signed_divide(a, b, native_q, native_r, native_div_by_zero);
+        CircuitALU::signed_divide(a, b, circuit_q, circuit_r, circuit_div_by_zero);
+    }
+    CHECK_EQ(native_div_by_zero, circuit_div_by_zero);
+    CHECK_EQ(native_q, circuit_q);
+    CHECK_EQ(native_r, circuit_r);
+}
+
+
+TEST_SUITE("ALU_native")
+{
+    TEST_CASE_TEMPLATE("same_results_as_circuit", N, U8, U16, U32, I8, I16, I32)
+    {
+        const std::vector<N> values = test_values<N>();
+        for (N a : values) {
+            check_same_unary_results(a);
+            for (N b : values) {
+                check_same_binary_results(a, b);
+            }
+        }
+    }
+
+    TEST_CASE("same_results_as_circuit_U64")
+    {
+        // Only the operations relying on the host for 64 bit operands
+        for (U64 a : test_values<U64>()) {
+            for (U64 b : test_values<U64>()) {
+                bit native_overflow = false, circuit_overflow = false;
+                CHECK_EQ(NativeALU::multiply(a, b, native_overflow), CircuitALU::multiply(a, b, circuit_overflow));
+                CHECK_EQ(native_overflow, circuit_overflow);
+            }
+
+            bit native_zero, circuit_zero;
+            CHECK_EQ(NativeALU::get_first_set_bit_index(a, native_zero), CircuitALU::get_first_set_bit_index(a, circuit_zero));
+            CHECK_EQ(native_zero, circuit_zero);
+            CHECK_EQ(NativeALU::get_last_set_bit_index(a, native_zero), CircuitALU::get_last_set_bit_index(a, circuit_zero));
+            CHECK_EQ(native_zero, circuit_zero);
+        }
+    }
+}
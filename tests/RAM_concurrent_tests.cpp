@@ -0,0 +1,204 @@
+#include "doctest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "memory/RAM.hpp"
+#include "memory/ConcurrentBinaryTreeManagedMemory.hpp"
+#include "memory/region.hpp"
+
+
+namespace Mem
+{
+
+/**
+ * Runs the steps of concurrent deallocations in a chosen order.
+ */
+struct ConcurrentBinaryTreeManagedMemoryTest
+{
+    template<typename Memory>
+    static void free_buddies_concurrently(Memory& memory, U8* cell_1, U8* cell_2, size_t bytes)
+    {
+        const U8 layer = Memory::get_allocation_layer(bytes);
+        const U32 first_node = U32(1) << (Memory::layers_count - layer);
+        const U32 node_1 = first_node + U32((cell_1 - memory.memory_position) / bytes);
+        const U32 node_2 = first_node + U32((cell_2 - memory.memory_position) / bytes);
+
+        // Both threads mark the parents as coalescing before any of them releases its node
+        memory.mark_coalescing(node_1, Memory::layers_count);
+        memory.mark_coalescing(node_2, Memory::layers_count);
+        memory.release_node(node_1, Memory::layers_count);
+        memory.release_node(node_2, Memory::layers_count);
+    }
+
+    template<typename Memory>
+    static U8 get_root_state(const Memory& memory)
+    {
+        return memory.node_state(1).load();
+    }
+};
+
+}
+
+
+TEST_SUITE("RAM_concurrent_alloc")
+{
+    constexpr U32 threads_count = 8;
+
+    TEST_CASE("alloc_U32")
+    {
+        U8 memory[128 / sizeof(U8)];
+        Mem::RAM<128, U32, Mem::ConcurrentBinaryTreeManagedMemory> ram(memory);
+
+        U32* test = ram.allocate<U32>(42);
+        REQUIRE(test != nullptr);
+        REQUIRE(*test == 42);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == sizeof(U32));
+
+        U64* double_cell = ram.allocate<U64>(43);
+        REQUIRE(double_cell != nullptr);
+        REQUIRE(ram.allocate<U64>(44) == nullptr); // the other double cell is split by 'test'
+
+        ram.deallocate(test);
+        ram.deallocate(test); // double free
+        ram.deallocate(double_cell);
+
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+        REQUIRE(ram.get_memory_manager().compute_allocated_memory_size() == 0);
+        REQUIRE(ram.get_memory_manager().get_largest_free_block() == 4 * sizeof(U32));
+    }
+
+    TEST_CASE("free_buddies_concurrently")
+    {
+        // The last buddy to finish must clear the marks of all parents, even if both saw each other allocated
+        U8 bytes[128 / sizeof(U8)];
+        Mem::ConcurrentBinaryTreeManagedMemory<128, sizeof(U32)> memory(bytes);
+
+        U8* cells[4];
+        for (U8*& cell : cells) {
+            cell = static_cast<U8*>(memory.allocate(sizeof(U32)));
+            REQUIRE(cell != nullptr);
+        }
+        std::sort(std::begin(cells), std::end(cells));
+
+        memory.deallocate(cells[0], sizeof(U32));
+        memory.deallocate(cells[1], sizeof(U32));
+        Mem::ConcurrentBinaryTreeManagedMemoryTest::free_buddies_concurrently(memory, cells[2], cells[3], sizeof(U32));
+
+        REQUIRE(Mem::ConcurrentBinaryTreeManagedMemoryTest::get_root_state(memory) == 0);
+        REQUIRE(memory.compute_allocated_memory_size() == 0);
+        REQUIRE(memory.allocate(4 * sizeof(U32)) == bytes);
+    }
+
+    TEST_CASE("exhaust_from_all_threads")
+    {
+        // All threads allocate single cells until the memory is full: each cell must be given exactly once
+        constexpr U32 memory_bits = 1 << 16;
+        Mem::Region region(memory_bits / 8);
+        Mem::ConcurrentBinaryTreeManagedMemory<memory_bits, sizeof(U32)> memory(region.get_bytes());
+
+        std::vector<std::vector<U8*>> allocations(threads_count);
+        std::vector<std::thread> threads;
+        for (U32 t = 0; t < threads_count; t++) {
+            threads.emplace_back([&memory, &cells = allocations[t]]() {
+                while (void* ptr = memory.allocate(sizeof(U32))) {
+                    cells.push_back(static_cast<U8*>(ptr));
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        std::vector<U8*> all_cells;
+        for (const std::vector<U8*>& cells : allocations) {
+            all_cells.insert(all_cells.end(), cells.begin(), cells.end());
+        }
+        std::sort(all_cells.begin(), all_cells.end());
+        REQUIRE(all_cells.size() == memory.get_cells_count());
+        REQUIRE(std::adjacent_find(all_cells.begin(), all_cells.end()) == all_cells.end());
+        REQUIRE(memory.get_allocated_memory_size() == memory_bits / 8);
+        REQUIRE(memory.get_largest_free_block() == 0);
+
+        // Free them from other threads, which must merge everything back
+        threads.clear();
+        for (U32 t = 0; t < threads_count; t++) {
+            threads.emplace_back([&memory, &cells = allocations[(t + 1) % threads_count]]() {
+                for (U8* cell : cells) {
+                    memory.deallocate(cell, sizeof(U32));
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        REQUIRE(memory.get_allocated_memory_size() == 0);
+        REQUIRE(memory.compute_allocated_memory_size() == 0);
+        REQUIRE(memory.allocate(memory_bits / 8) == region.get_bytes());
+    }
+
+    TEST_CASE("stress")
+    {
+        // Random allocations and deallocations of different sizes: each thread fills its cells with its own pattern,
+        // and checks it is still there before freeing them, which would not be the case if two allocations overlapped
+        constexpr U32 memory_bits = 1 << 26;
+        Mem::Region region(memory_bits / 8);
+        Mem::ConcurrentBinaryTreeManagedMemory<memory_bits, sizeof(U32)> memory(region.get_bytes());
+
+        std::atomic<U32> errors = 0;
+        std::atomic<U32> failed_allocations = 0;
+        std::vector<std::thread> threads;
+        for (U32 t = 0; t < threads_count; t++) {
+            threads.emplace_back([&, t]() {
+                std::mt19937 rng(t);
+                std::vector<std::pair<U8*, size_t>> live;
+                const U8 pattern = U8(0xA0 + t);
+
+                for (U32 i = 0; i < 20000; i++) {
+                    if (live.empty() || (rng() % 3 != 0 && live.size() < 256)) {
+                        const size_t size = size_t(4) << (rng() % 8);
+                        auto* ptr = static_cast<U8*>(memory.allocate(size));
+                        if (ptr == nullptr) {
+                            failed_allocations++;
+                            continue;
+                        }
+                        std::fill(ptr, ptr + size, pattern);
+                        live.emplace_back(ptr, size);
+                    }
+                    else {
+                        const size_t index = rng() % live.size();
+                        auto [ptr, size] = live[index];
+                        if (std::any_of(ptr, ptr + size, [pattern](U8 b) { return b != pattern; })) {
+                            errors++;
+                        }
+                        memory.deallocate(ptr, size);
+                        live[index] = live.back();
+                        live.pop_back();
+                    }
+                }
+
+                for (auto [ptr, size] : live) {
+                    if (std::any_of(ptr, ptr + size, [pattern](U8 b) { return b != pattern; })) {
+                        errors++;
+                    }
+                    memory.deallocate(ptr, size);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        CHECK(errors == 0);
+        CHECK(failed_allocations == 0);
+        CHECK(memory.get_stats().allocations_count == 0);
+        CHECK(memory.get_allocated_memory_size() == 0);
+        CHECK(memory.compute_allocated_memory_size() == 0);
+        CHECK(memory.get_stats().peak_allocated_bytes > 0);
+        CHECK(memory.get_largest_free_block() == memory_bits / 8);
+    }
+}
@@ -1,7 +1,12 @@
 
 #include "doctest.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "memory/RAM.hpp"
+#include "memory/CachedManagedMemory.hpp"
+#include "memory/region.hpp"
 
 
 TEST_SUITE("RAM_alloc")
@@ -13,8 +18,11 @@ TEST_SUITE("RAM_alloc")
 
         REQUIRE(ram.get_memory_manager().get_cells_count() == 4);
         REQUIRE(ram.get_memory_manager().get_layers_count() == 2);
+        REQUIRE(!ram.get_memory_manager().is_tree_built());
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
 
         U32* test = ram.allocate<U32>(42);
+        REQUIRE(ram.get_memory_manager().is_tree_built());
 
         REQUIRE(test != nullptr);
         REQUIRE(*test == 42);
@@ -150,4 +158,410 @@ TEST_SUITE("RAM_alloc")
         REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == (2 * sizeof(U16)));
         REQUIRE_EQ(U64(small_number) + 2 * sizeof(U8), U64(neighbour)); // both pointers should be neighbours
     }
+
+    TEST_CASE("dealloc_any_cell")
+    {
+        U8 memory[512 / sizeof(U8)];
+        Mem::RAM<512, U32> ram(memory);
+
+        REQUIRE(ram.get_memory_manager().get_cells_count() == 16);
+
+        std::vector<U32*> cells;
+        for (U32 i = 0; i < 16; i++) {
+            cells.push_back(ram.allocate<U32>(i));
+            REQUIRE_EQ(U64(cells.back()), U64(memory) + i * sizeof(U32));
+        }
+        REQUIRE(ram.allocate<U32>(0) == nullptr);
+
+        // Free the cells in an order which splits the allocations across all layers
+        for (U32 i : { 5, 10, 0, 15, 3, 12, 6, 9, 1, 14, 7, 8, 2, 13, 4, 11 }) {
+            REQUIRE(*cells[i] == i);
+            ram.deallocate(cells[i]);
+        }
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+
+        struct Block { U32 values[16]; };
+        REQUIRE_EQ(U64(ram.allocate<Block>()), U64(memory));
+    }
+}
+
+
+TEST_SUITE("RAM_implicit_alloc")
+{
+    template<U32 N, typename Granularity>
+    using ImplicitRAM = Mem::RAM<N, Granularity, Mem::ImplicitBinaryTreeManagedMemory>;
+
+    TEST_CASE("alloc_U32")
+    {
+        U8 memory[128 / sizeof(U8)];
+        ImplicitRAM<128, U32> ram(memory);
+
+        REQUIRE(ram.get_memory_manager().get_cells_count() == 4);
+        REQUIRE(ram.get_memory_manager().get_layers_count() == 2);
+        REQUIRE(!ram.get_memory_manager().is_tree_built());
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+
+        U32* test = ram.allocate<U32>(42);
+        REQUIRE(ram.get_memory_manager().is_tree_built());
+
+        REQUIRE(test != nullptr);
+        REQUIRE(*test == 42);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == sizeof(U32));
+
+        ram.deallocate(test);
+
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+    }
+
+    TEST_CASE("split_and_merge")
+    {
+        U8 memory[128 / sizeof(U8)];
+
+        //    0
+        //  0   0
+        // 0 0 0 0
+        ImplicitRAM<128, U32> ram(memory);
+
+        //    0
+        //  1   0
+        // 0 0 0 0
+        U64* double_cell = ram.allocate<U64>(42);
+        REQUIRE(double_cell != nullptr);
+        REQUIRE_EQ(U64(double_cell), U64(memory));
+
+        //    0
+        //  1   0
+        // 0 0 1 0
+        U32* single_cell_1 = ram.allocate<U32>(1000);
+        REQUIRE_EQ(U64(single_cell_1), U64(memory) + 2 * sizeof(U32));
+
+        //    0
+        //  0   0
+        // 0 0 1 0
+        ram.deallocate(double_cell);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == sizeof(U32));
+
+        //    0
+        //  0   0
+        // 0 0 1 1 <- the smallest free block is used first
+        U32* single_cell_2 = ram.allocate<U32>(1010);
+        REQUIRE_EQ(U64(single_cell_2), U64(memory) + 3 * sizeof(U32));
+
+        //    0
+        //  1   0
+        // 0 0 1 1
+        double_cell = ram.allocate<U64>(99);
+        REQUIRE_EQ(U64(double_cell), U64(memory));
+        REQUIRE(*single_cell_1 == 1000);
+        REQUIRE(*single_cell_2 == 1010);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 4 * sizeof(U32));
+        REQUIRE(ram.allocate<U8>(1) == nullptr);
+
+        ram.deallocate(single_cell_1);
+        ram.deallocate(single_cell_2);
+        ram.deallocate(double_cell);
+
+        //        1 <- all cells were merged back
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+        struct Block { U32 values[4]; };
+        Block* everything = ram.allocate<Block>();
+        REQUIRE_EQ(U64(everything), U64(memory));
+    }
+
+    TEST_CASE("invalid_deallocation")
+    {
+        U8 bytes[64 / sizeof(U8)];
+        Mem::ImplicitBinaryTreeManagedMemory<64, sizeof(U8)> memory(bytes);
+
+        auto* number = static_cast<U8*>(memory.allocate(sizeof(U16)));
+        REQUIRE(number != nullptr);
+
+        // Not the start of a cell of this size, then not allocated
+        memory.deallocate(number + 1, sizeof(U16));
+        memory.deallocate(number + 2, sizeof(U16));
+        REQUIRE(memory.get_allocated_memory_size() == sizeof(U16));
+
+        memory.deallocate(number, sizeof(U16));
+        memory.deallocate(number, sizeof(U16)); // double free
+        REQUIRE(memory.get_allocated_memory_size() == 0);
+        REQUIRE(memory.allocate(sizeof(U64)) == bytes);
+    }
+
+    TEST_CASE("over_alloc")
+    {
+        U8 memory[32 / sizeof(U8)];
+        ImplicitRAM<32, U16> ram(memory);
+
+        REQUIRE(ram.get_memory_manager().get_cells_count() == 2);
+        REQUIRE(ram.get_memory_manager().get_layers_count() == 1);
+
+        U64* big_number = ram.allocate<U64>(0); // not enough space
+
+        REQUIRE(big_number == nullptr);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+    }
+
+    TEST_CASE("array_and_aligned")
+    {
+        alignas(64) U8 memory[512 / sizeof(U8)];
+        ImplicitRAM<512, U32> ram(memory);
+
+        U16* array = ram.allocate_array<U16>(3); // 6 bytes, in 2 cells
+        REQUIRE_EQ(U64(array), U64(memory));
+        REQUIRE(array[0] == 0);
+        REQUIRE(array[2] == 0);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 8);
+        REQUIRE(ram.allocate_array<U16>(0) == nullptr);
+        REQUIRE(ram.allocate_array<U64>(SIZE_MAX / 4) == nullptr);
+
+        // Aligned on 32 bytes from the start of the RAM, while the 8 bytes after the array are free
+        void* aligned = ram.allocate_aligned(4, 32);
+        REQUIRE_EQ(U64(aligned), U64(memory) + 32);
+        REQUIRE(ram.allocate_aligned(4, 3) == nullptr);
+
+        ram.deallocate_aligned(aligned, 4, 32);
+        ram.deallocate_array(array, 3);
+        REQUIRE(ram.get_memory_manager().get_allocated_memory_size() == 0);
+    }
+
+    TEST_CASE("resize_in_place")
+    {
+        U8 memory[512 / sizeof(U8)];
+        ImplicitRAM<512, U32> ram(memory);
+        auto& manager = ram.get_memory_manager();
+
+        //        0
+        //    0       0
+        //  0   0   0   0
+        // 1 0 0 0 0 0 0 0 <- 16 cells in 8 pairs, only the first 8 are drawn
+        U8* buffer = ram.allocate_array<U8>(4);
+
+        // Grow into the free buddies: 4 -> 8 -> 32 bytes
+        REQUIRE(ram.try_resize(buffer, 4, 8));
+        REQUIRE(ram.try_resize(buffer, 8, 32));
+        REQUIRE(manager.get_allocated_memory_size() == 32);
+        REQUIRE(manager.compute_allocated_memory_size() == 32);
+
+        // Another allocation after the buffer prevents it from growing further
+        U32* next = ram.allocate<U32>(1);
+        REQUIRE_EQ(U64(next), U64(memory) + 32);
+        REQUIRE(!ram.try_resize(buffer, 32, 64));
+        REQUIRE(manager.get_allocated_memory_size() == 36);
+
+        // Shrink back to a single cell, the rest being free again
+        REQUIRE(ram.try_resize(buffer, 32, 3));
+        REQUIRE(manager.get_allocated_memory_size() == 8);
+        REQUIRE(manager.compute_allocated_memory_size() == 8);
+        REQUIRE_EQ(U64(ram.allocate<U64>(2)), U64(memory) + 8);
+
+        // Only the first half of a cell can grow
+        U32* second_half = ram.allocate<U32>(3);
+        REQUIRE_EQ(U64(second_half), U64(memory) + 4);
+        REQUIRE(!ram.try_resize(second_half, 4, 8));
+        REQUIRE(manager.get_stats().peak_allocated_bytes == 36);
+    }
+
+    TEST_CASE("large_memory")
+    {
+        // 256 MiB of 4 bytes cells, far above the 2^16 cells of the cells tree
+        constexpr U32 memory_bits = U32(1) << 31;
+        constexpr U32 memory_bytes = memory_bits / 8;
+        Mem::Region region(memory_bytes);
+        Mem::ImplicitBinaryTreeManagedMemory<memory_bits, sizeof(U32)> memory(region.get_bytes());
+
+        REQUIRE(memory.get_cells_count() == memory_bytes / sizeof(U32));
+        REQUIRE(memory.get_tree_cells_size() < memory_bytes / 8);
+
+        // Fill a part of the memory with cells of different sizes, without overlaps
+        std::vector<std::pair<U8*, size_t>> allocations;
+        for (size_t i = 0; i < 10000; i++) {
+            const size_t size = size_t(4) << (i % 7);
+            auto* ptr = static_cast<U8*>(memory.allocate(size));
+            REQUIRE(ptr != nullptr);
+            REQUIRE((ptr - region.get_bytes()) % size == 0);
+            allocations.emplace_back(ptr, size);
+        }
+
+        std::sort(allocations.begin(), allocations.end());
+        size_t allocated = 0;
+        for (size_t i = 0; i < allocations.size(); i++) {
+            if (i > 0) {
+                REQUIRE(allocations[i - 1].first + allocations[i - 1].second <= allocations[i].first);
+            }
+            allocated += allocations[i].second;
+        }
+        REQUIRE_EQ(memory.get_allocated_memory_size(), allocated);
+
+        // The whole memory can be allocated at once after everything is freed
+        for (auto [ptr, size] : allocations) {
+            memory.deallocate(ptr, size);
+        }
+        REQUIRE_EQ(memory.get_allocated_memory_size(), 0);
+        REQUIRE(memory.allocate(memory_bytes) == region.get_bytes());
+    }
+}
+
+
+TEST_SUITE("RAM_cached_alloc")
+{
+    template<U32 N, typename Granularity>
+    using CachedRAM = Mem::RAM<N, Granularity, Mem::CachedStaticBinaryTreeManagedMemory>;
+
+    TEST_CASE("resize_not_supported")
+    {
+        U8 memory[512 / sizeof(U8)];
+        CachedRAM<512, U32> ram(memory);
+
+        U8* buffer = ram.allocate_array<U8>(4);
+        REQUIRE(!ram.try_resize(buffer, 4, 8)); // the cells tree cannot resize allocations
+    }
+
+    TEST_CASE("reuse_freed_cells")
+    {
+        U8 memory[512 / sizeof(U8)];
+        CachedRAM<512, U32> ram(memory);
+        auto& manager = ram.get_memory_manager();
+
+        U32* a = ram.allocate<U32>(1);
+        U64* b = ram.allocate<U64>(2);
+        REQUIRE(manager.get_cache_misses() == 2);
+        REQUIRE(manager.get_allocated_memory_size() == sizeof(U32) + sizeof(U64));
+
+        ram.deallocate(a);
+        ram.deallocate(b);
+        REQUIRE(manager.get_allocated_memory_size() == 0);
+        REQUIRE(manager.get_cached_memory_size() == sizeof(U32) + sizeof(U64));
+
+        // The same cells are given back from the free lists of their layer
+        REQUIRE_EQ(U64(ram.allocate<U64>(3)), U64(b));
+        REQUIRE_EQ(U64(ram.allocate<U32>(4)), U64(a));
+        REQUIRE(ram.allocate<U32>(5) != a);
+        REQUIRE(manager.get_cache_hits() == 2);
+        REQUIRE(manager.get_cache_misses() == 3);
+        REQUIRE(manager.get_hit_rate() == doctest::Approx(0.4));
+    }
+
+    TEST_CASE("double_free")
+    {
+        U8 memory[512 / sizeof(U8)];
+        CachedRAM<512, U32> ram(memory);
+
+        U32* a = ram.allocate<U32>(1);
+        ram.deallocate(a);
+        ram.deallocate(a);
+
+        REQUIRE(ram.get_memory_manager().get_cached_memory_size() == sizeof(U32));
+        REQUIRE(ram.allocate<U32>(2) == a);
+        REQUIRE(ram.allocate<U32>(3) != a);
+    }
+
+    TEST_CASE("invalid_deallocation")
+    {
+        U8 outside[16];
+        U8 memory[512 / sizeof(U8)];
+        CachedRAM<512, U32> ram(memory);
+        auto& manager = ram.get_memory_manager();
+
+        U32* cell = ram.allocate<U32>(1);
+        REQUIRE_EQ(U64(cell), U64(memory));
+
+        // Neither a pointer outside of the memory nor one inside of a cell are cached
+        manager.deallocate(outside, sizeof(U32));
+        manager.deallocate(memory + 1, sizeof(U32));
+        REQUIRE(manager.get_cached_memory_size() == 0);
+        REQUIRE(manager.get_allocated_memory_size() == sizeof(U32));
+
+        U32* other_cell = ram.allocate<U32>(2);
+        REQUIRE_EQ(U64(other_cell), U64(memory) + sizeof(U32));
+        REQUIRE(manager.get_allocated_memory_size() == 2 * sizeof(U32));
+    }
+
+    TEST_CASE("overflow_and_trim")
+    {
+        U8 memory[512 / sizeof(U8)];
+        Mem::CachedManagedMemory<512, sizeof(U32), Mem::StaticBinaryTreeManagedMemory, 4> manager(memory);
+
+        std::vector<void*> cells;
+        for (U32 i = 0; i < 16; i++) {
+            cells.push_back(manager.allocate(sizeof(U32)));
+            REQUIRE(cells.back() != nullptr);
+        }
+
+        // The free list holds at most 4 cells, the 2 oldest ones are given back to the tree when it is full
+        for (U32 i = 0; i < 5; i++) {
+            manager.deallocate(cells[i], sizeof(U32));
+        }
+        REQUIRE(manager.get_cached_memory_size() == 3 * sizeof(U32));
+        REQUIRE(manager.get_allocator().get_allocated_memory_size() == 14 * sizeof(U32));
+
+        for (U32 i = 5; i < 16; i++) {
+            manager.deallocate(cells[i], sizeof(U32));
+        }
+        REQUIRE(manager.get_allocated_memory_size() == 0);
+
+        // The cached cells prevent the tree from merging back until they are trimmed
+        REQUIRE(manager.allocate(16 * sizeof(U32)) == nullptr);
+        manager.trim();
+        REQUIRE(manager.get_cached_memory_size() == 0);
+        REQUIRE(manager.get_allocator().get_allocated_memory_size() == 0);
+        REQUIRE(manager.allocate(16 * sizeof(U32)) == memory);
+    }
+}
+
+
+TEST_SUITE("RAM_stats")
+{
+    TEST_CASE_TEMPLATE("occupancy_and_fragmentation", Manager,
+                       Mem::StaticBinaryTreeManagedMemory<512, sizeof(U32)>,
+                       Mem::ImplicitBinaryTreeManagedMemory<512, sizeof(U32)>,
+                       Mem::CachedStaticBinaryTreeManagedMemory<512, sizeof(U32)>)
+    {
+        U8 memory[512 / sizeof(U8)];
+        Manager manager(memory);
+
+        // 16 cells of 4 bytes, all in a single free block
+        REQUIRE(manager.get_largest_free_block() == 64);
+        Mem::FragmentationReport report = manager.get_fragmentation_report();
+        REQUIRE(report.free_bytes_per_layer == std::vector<U32>{ 0, 0, 0, 0, 64 });
+        REQUIRE(report.get_fragmentation() == 0);
+
+        void* cells[16];
+        for (void*& cell : cells) {
+            cell = manager.allocate(sizeof(U32));
+        }
+        void* big = manager.allocate(sizeof(U32));
+        REQUIRE(big == nullptr);
+
+        REQUIRE(manager.get_stats().allocations_count == 16);
+        REQUIRE(manager.get_allocated_memory_size() == 64);
+        REQUIRE(manager.get_largest_free_block() == 0);
+
+        // Free every other cell: 32 free bytes, but only in blocks of 4 bytes
+        for (U32 i = 0; i < 16; i += 2) {
+            manager.deallocate(cells[i], sizeof(U32));
+        }
+        REQUIRE(manager.get_stats().allocations_count == 8);
+        REQUIRE(manager.get_stats().peak_allocated_bytes == 64);
+        REQUIRE(manager.get_allocated_memory_size() == 32);
+        REQUIRE(manager.compute_allocated_memory_size() == 32);
+        REQUIRE(manager.get_largest_free_block() == 4);
+
+        report = manager.get_fragmentation_report();
+        REQUIRE(report.free_bytes_per_layer == std::vector<U32>{ 32, 0, 0, 0, 0 });
+        REQUIRE(report.get_fragmentation() == doctest::Approx(1.0 - 4.0 / 32.0));
+
+        // Freeing the first half merges it back into a 32 bytes block in the tree
+        for (U32 i = 1; i < 8; i += 2) {
+            manager.deallocate(cells[i], sizeof(U32));
+        }
+        if constexpr (requires { manager.trim(); }) {
+            manager.trim();
+        }
+        REQUIRE(manager.get_allocated_memory_size() == 16);
+        REQUIRE(manager.compute_allocated_memory_size() == 16);
+        REQUIRE(manager.get_largest_free_block() == 32);
+        report = manager.get_fragmentation_report();
+        REQUIRE(report.free_bytes_per_layer == std::vector<U32>{ 16, 0, 0, 32, 0 });
+        REQUIRE(report.largest_free_block == 32);
+    }
 }
@@ -0,0 +1,500 @@
+
+#include "doctest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "CPU/instructions.h"
+#include "CPU/opcodes.h"
+#include "memory/memory_manager.hpp"
+#include "memory/buffer.hpp"
+#include "load_program.h"
+#include "program_file.h"
+
+
+TEST_SUITE("memory")
+{
+    const U32 text_pos = 0x10000;
+    const U32 rom_pos = 0x200800; // Not aligned on a page: the last page of the ROM is shared with the RAM
+    const U32 rom_end = rom_pos + Mem::ROM_SIZE;
+    const U32 ram_pos = rom_end;
+
+
+    std::unique_ptr<Mem::Memory> create_memory()
+    {
+        std::vector<Inst> instructions(4);
+        std::vector<std::vector<U8>> contents{ { 0x42 } }; // Start of the ROM
+        auto image = std::make_shared<const Mem::ProgramImage>(text_pos, instructions.size() * sizeof(Inst),
+                                                               std::move(instructions),
+                                                               Mem::MemoryLayout::default_layout(rom_pos),
+                                                               std::move(contents));
+        return std::make_unique<Mem::Memory>(image);
+    }
+
+
+    std::string fault_message(const char* msg, U32 address)
+    {
+        return Mem::WrongMemoryAccess(msg, address).what();
+    }
+
+
+    TEST_CASE("read_write")
+    {
+        auto memory = create_memory();
+
+        CHECK_EQ(memory->read(rom_pos, OpSize::B), 0x42);
+
+        for (U32 address : { ram_pos, ram_pos + 0x1234, memory->stack_pos, memory->stack_end - 4 }) {
+            memory->write(address, 0x12345678, OpSize::DW);
+            CHECK_EQ(memory->read(address, OpSize::DW), 0x12345678);
+            CHECK_EQ(memory->read(address, OpSize::W), 0x5678);
+            CHECK_EQ(memory->read(address + 3, OpSize::B), 0x12);
+            CHECK_EQ(*memory->physical_at(address), 0x78);
+        }
+    }
+
+    TEST_CASE("across_pages")
+    {
+        auto memory = create_memory();
+
+        const U32 address = ram_pos + 2 * Mem::PAGE_SIZE - 2;
+        memory->write(address, 0xAABBCCDD, OpSize::DW);
+        CHECK_EQ(memory->read(address, OpSize::DW), 0xAABBCCDD);
+        CHECK_EQ(memory->read(address + 2, OpSize::W), 0xAABB);
+
+        // The page shared by the ROM and the RAM
+        const U32 rom_last = rom_end - 1;
+        CHECK_EQ(memory->read(rom_last, OpSize::B), 0);
+        memory->write(ram_pos, 0x99, OpSize::B);
+        CHECK_EQ(memory->read(ram_pos, OpSize::B), 0x99);
+    }
+
+    TEST_CASE("wrong_accesses")
+    {
+        auto memory = create_memory();
+
+        Fault fault;
+        CHECK_EQ(memory->read(text_pos, OpSize::DW, fault), 0);
+        CHECK_EQ(fault.format(), fault_message("Text cannot be read.", text_pos));
+
+        fault.clear();
+        memory->write(rom_end - 1, 1, OpSize::B, fault);
+        CHECK_EQ(fault.format(), fault_message("ROM is read-only.", rom_end - 1));
+        CHECK_EQ(memory->read(rom_end - 1, OpSize::B), 0);
+
+        fault.clear();
+        memory->write(memory->stack_end, 1, OpSize::B, fault);
+        CHECK_EQ(fault.format(), fault_message("Address out of bounds.", memory->stack_end));
+
+        CHECK_THROWS_AS(memory->write(rom_pos, 1, OpSize::DW), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS((void) memory->read(rom_pos - 1, OpSize::B), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS((void) memory->physical_at(text_pos), Mem::WrongMemoryAccess);
+    }
+
+    TEST_CASE("lazy_regions")
+    {
+        auto memory = create_memory();
+
+        const Mem::Region& ram = memory->get_region(1);
+        CHECK_EQ(ram.get_resident_pages_count(), 0);
+        CHECK_EQ(memory->get_region(2).get_resident_pages_count(), 0);
+        CHECK(!memory->get_RAM()->get_memory_manager().is_tree_built());
+
+        memory->write(ram_pos + 0x5000, 0x12345678, OpSize::DW);
+        memory->write(ram_pos + 0x5010, 0x12345678, OpSize::DW);
+        CHECK_EQ(ram.get_resident_pages_count(), 1);
+        CHECK_EQ(memory->read(ram_pos + 0x80000, OpSize::DW), 0);
+
+        // Only the first page of the ROM was written
+        CHECK_EQ(memory->get_region(0).get_resident_pages_count(), 1);
+        CHECK_EQ(ram.get_pages_count(), Mem::RAM_SIZE / Mem::Region::get_host_page_size());
+    }
+
+    TEST_CASE("RAM_allocator")
+    {
+        auto memory = create_memory();
+        Mem::RAM<Mem::RAM_SIZE, U32>* ram = memory->get_RAM();
+        REQUIRE(ram != nullptr);
+        CHECK_EQ(ram->get_bytes(), memory->get_region_bytes(1));
+
+        // Allocations are in the RAM region, seen by the guest
+        U32* value = ram->allocate<U32>(0xCAFEBABE);
+        REQUIRE(value != nullptr);
+        const U32 address = ram_pos + U32(reinterpret_cast<U8*>(value) - ram->get_bytes());
+        CHECK_EQ(memory->read(address, OpSize::DW), 0xCAFEBABE);
+        ram->deallocate(value);
+    }
+
+    TEST_CASE("custom_layout")
+    {
+        const Mem::MemoryLayout layout{
+            .regions = {
+                { .base = 0x400000, .size = 0x100, .permissions = Mem::PAGE_READ },
+                { .base = 0x400100, .size = 0x2000 },
+                { .base = 0x800000, .size = 0x1000 },
+            },
+            .stack_region = 2,
+        };
+
+        std::vector<Inst> instructions(4);
+        Mem::Memory memory(text_pos, instructions.size() * sizeof(Inst), instructions, layout);
+
+        CHECK_EQ(memory.get_regions_count(), 3);
+        CHECK_EQ(memory.get_RAM(), nullptr);
+        CHECK_EQ(memory.stack_pos, 0x800000);
+        CHECK_EQ(memory.stack_end, 0x801000);
+
+        // In the page shared by the first two regions
+        memory.write(0x400100, 0x1234, OpSize::W);
+        CHECK_EQ(memory.read(0x400100, OpSize::W), 0x1234);
+
+        Fault fault;
+        memory.write(0x4000FF, 1, OpSize::B, fault);
+        CHECK_EQ(fault.format(), fault_message("ROM is read-only.", 0x4000FF));
+
+        // Accesses must be entirely in a region
+        fault.clear();
+        CHECK_EQ(memory.read(0x4020FE, OpSize::DW, fault), 0);
+        CHECK_EQ(fault.format(), fault_message("Address out of bounds.", 0x4020FE));
+        CHECK_EQ(memory.read(0x4020FC, OpSize::DW), 0);
+
+        auto overlapping = layout;
+        overlapping.regions[1].base = 0x4000F0;
+        CHECK_THROWS_AS(Mem::Memory(text_pos, 0, instructions, overlapping), std::invalid_argument);
+
+        // The RAM allocator needs a writable region of its size
+        auto small_ram = layout;
+        small_ram.ram_region = 1;
+        CHECK_THROWS_AS(Mem::Memory(text_pos, 0, instructions, small_ram), std::invalid_argument);
+
+        auto ram_layout = layout;
+        ram_layout.regions[1].size = Mem::RAM_SIZE;
+        ram_layout.ram_region = 1;
+        Mem::Memory memory_with_ram(text_pos, 0, instructions, ram_layout);
+        CHECK_NE(memory_with_ram.get_RAM(), nullptr);
+    }
+
+    TEST_CASE("snapshot")
+    {
+        auto memory = create_memory();
+        CHECK_THROWS_AS(memory->restore(), std::logic_error);
+
+        memory->write(ram_pos + 0x10, 1, OpSize::DW);
+        memory->snapshot();
+        CHECK_EQ(memory->get_snapshot_dirty_pages_count(), 0);
+
+        memory->write(ram_pos + 0x10, 2, OpSize::DW);
+        memory->write(ram_pos + 0x20, 3, OpSize::DW);
+        memory->write(ram_pos + 0x5000, 4, OpSize::DW);
+        // Across the shared page, already saved, and the next one
+        memory->write(ram_pos + Mem::PAGE_SIZE - 0x800 - 2, 0xFFFFFFFF, OpSize::DW);
+        memory->write(memory->stack_end - 4, 5, OpSize::DW);
+        CHECK_EQ(memory->get_snapshot_dirty_pages_count(), 4);
+
+        memory->restore();
+        CHECK_EQ(memory->get_snapshot_dirty_pages_count(), 0);
+        CHECK_EQ(memory->read(ram_pos + 0x10, OpSize::DW), 1);
+        CHECK_EQ(memory->read(ram_pos + 0x20, OpSize::DW), 0);
+        CHECK_EQ(memory->read(ram_pos + 0x5000, OpSize::DW), 0);
+        CHECK_EQ(memory->read(ram_pos + Mem::PAGE_SIZE - 0x800 - 2, OpSize::DW), 0);
+        CHECK_EQ(memory->read(memory->stack_end - 4, OpSize::DW), 0);
+
+        // The pages are protected again after the restore
+        memory->write(ram_pos + 0x10, 6, OpSize::DW);
+        CHECK_EQ(memory->get_snapshot_dirty_pages_count(), 1);
+
+        // A new snapshot keeps the current contents
+        memory->snapshot();
+        memory->write(ram_pos + 0x10, 7, OpSize::DW);
+        memory->restore();
+        CHECK_EQ(memory->read(ram_pos + 0x10, OpSize::DW), 6);
+    }
+
+    TEST_CASE("modified_ranges")
+    {
+        auto memory = create_memory();
+        auto ranges_since = [&](U32 epoch) {
+            std::vector<std::pair<U32, U32>> ranges;
+            for (const Mem::MemoryRange& range : memory->get_modified_ranges(epoch)) {
+                ranges.emplace_back(range.address, range.size);
+            }
+            return ranges;
+        };
+        using Ranges = std::vector<std::pair<U32, U32>>;
+
+        CHECK_EQ(memory->get_epoch(), 0);
+        CHECK(ranges_since(0).empty());
+
+        // Whole pages, limited to the region in the shared page
+        memory->write(ram_pos + 0x10, 1, OpSize::DW);
+        memory->write(ram_pos + 0x3000, 1, OpSize::B);
+        CHECK_EQ(ranges_since(0), Ranges{ { ram_pos, 0x800 }, { 0x303000, 0x1000 } });
+
+        CHECK_EQ(memory->new_epoch(), 1);
+        CHECK(ranges_since(1).empty());
+
+        memory->set_track_cache_lines(true);
+        memory->write(ram_pos + 0x3004, 1, OpSize::DW);
+        memory->write(ram_pos + 0x303E, 1, OpSize::DW); // Across two lines
+        memory->write(0x305FFE, 1, OpSize::DW);         // Across two pages
+        memory->write(ram_pos + 0x3000, 2, OpSize::B);  // Already written in the epoch
+        CHECK_EQ(ranges_since(1), Ranges{ { 0x303800, 0x80 }, { 0x305FC0, 0x80 } });
+
+        // The ranges of the previous epochs are merged
+        memory->new_epoch();
+        CHECK(ranges_since(2).empty());
+        CHECK_EQ(ranges_since(0), Ranges{ { ram_pos, 0x800 }, { 0x303000, 0x1000 }, { 0x305FC0, 0x80 } });
+    }
+
+    TEST_CASE("retire_epochs")
+    {
+        auto memory = create_memory();
+        auto ranges_since = [&](U32 epoch) {
+            std::vector<std::pair<U32, U32>> ranges;
+            for (const Mem::MemoryRange& range : memory->get_modified_ranges(epoch)) {
+                ranges.emplace_back(range.address, range.size);
+            }
+            return ranges;
+        };
+        using Ranges = std::vector<std::pair<U32, U32>>;
+
+        memory->write(ram_pos + 0x1000, 1, OpSize::DW);
+        memory->new_epoch();
+        memory->write(ram_pos + 0x2000, 1, OpSize::DW);
+        memory->new_epoch();
+        memory->write(ram_pos + 0x3000, 1, OpSize::DW);
+
+        memory->retire_epochs(2);
+        CHECK_EQ(memory->get_oldest_epoch(), 2);
+        CHECK_THROWS_AS((void) memory->get_modified_ranges(0), std::out_of_range);
+        CHECK_THROWS_AS((void) memory->get_modified_ranges(1), std::out_of_range);
+        CHECK_EQ(ranges_since(2), Ranges{ { 0x303000, 0x1000 } });
+        CHECK_THROWS_AS(memory->retire_epochs(3), std::logic_error);
+
+        // The pages written in the kept epochs are still tracked, even if written again
+        memory->write(ram_pos + 0x3004, 2, OpSize::DW);
+        memory->write(ram_pos + 0x1000, 2, OpSize::DW);
+        CHECK_EQ(ranges_since(2), Ranges{ { 0x301000, 0x1000 }, { 0x303000, 0x1000 } });
+        CHECK_EQ(memory->read(ram_pos + 0x3004, OpSize::DW), 2);
+
+        memory->new_epoch();
+        memory->write(ram_pos + 0x1000, 3, OpSize::DW);
+        memory->retire_epochs(3);
+        memory->write(ram_pos + 0x2000, 3, OpSize::DW);
+        CHECK_EQ(ranges_since(3), Ranges{ { 0x301000, 0x2000 } });
+        memory->retire_epochs(1); // Already retired
+        CHECK_EQ(memory->get_oldest_epoch(), 3);
+    }
+
+    TEST_CASE("watchpoints")
+    {
+        auto memory = create_memory();
+        memory->write(ram_pos + 0x1010, 0x11223344, OpSize::DW);
+
+        const U32 read_id = memory->add_watchpoint(ram_pos + 0x1010, 4, Mem::WATCH_READ);
+        const U32 write_id = memory->add_watchpoint(ram_pos + 0x3000, 0x10, Mem::WATCH_WRITE);
+
+        // Accesses to the rest of the watched pages, or of the wrong kind, don't hit
+        Fault fault;
+        CHECK_EQ(memory->read(ram_pos + 0x1020, OpSize::DW, fault), 0);
+        memory->write(ram_pos + 0x1010, 0x55667788, OpSize::DW, fault);
+        CHECK_EQ(memory->read(ram_pos + 0x3000, OpSize::DW, fault), 0);
+        CHECK(!fault.is_set());
+
+        CHECK_EQ(memory->read(ram_pos + 0x1012, OpSize::W, fault), 0x5566);
+        CHECK_EQ(fault.kind, FaultKind::Watchpoint);
+        CHECK_EQ(fault.address, ram_pos + 0x1012);
+        CHECK_EQ(fault.watchpoint.kind, Mem::WATCH_READ);
+        CHECK_EQ(fault.watchpoint.size, 2);
+
+        // The write is made, with the old and new values in the hit
+        fault.clear();
+        memory->write(ram_pos + 0x2FFE, 0xAABBCCDD, OpSize::DW, fault);
+        CHECK_EQ(fault.kind, FaultKind::Watchpoint);
+        CHECK_EQ(fault.watchpoint.kind, Mem::WATCH_WRITE);
+        CHECK_EQ(fault.watchpoint.old_value, 0);
+        CHECK_EQ(fault.watchpoint.new_value, 0xAABBCCDD);
+        CHECK_EQ(memory->read(ram_pos + 0x3000, OpSize::W), 0xAABB);
+
+        // Only the first hit is kept
+        memory->write(ram_pos + 0x3000, 1, OpSize::B, fault);
+        CHECK_EQ(fault.address, ram_pos + 0x2FFE);
+
+        // Hits are not thrown
+        memory->write(ram_pos + 0x3000, 2, OpSize::B);
+
+        CHECK(memory->remove_watchpoint(read_id));
+        CHECK(memory->remove_watchpoint(write_id));
+        CHECK(!memory->remove_watchpoint(write_id));
+        fault.clear();
+        (void) memory->read(ram_pos + 0x1010, OpSize::DW, fault);
+        memory->write(ram_pos + 0x3000, 3, OpSize::DW, fault);
+        CHECK(!fault.is_set());
+
+        CHECK_THROWS_AS(memory->add_watchpoint(ram_pos, 0, Mem::WATCH_READ), std::invalid_argument);
+    }
+
+    TEST_CASE("mapped_program")
+    {
+        const auto dir = std::filesystem::temp_directory_path() / "mcx86_mapped_program";
+        std::filesystem::create_directories(dir);
+        const std::string map_path = (dir / "memory_map.txt").string();
+        const std::string contents_path = (dir / "memory_data.bin").string();
+        const std::string instructions_path = (dir / "instructions.bin").string();
+
+        // The ROM contents end in the middle of a page, followed by other data of the file, which must not be loaded.
+        // The RAM contents are aligned, and end in the middle of a page.
+        std::vector<U8> contents(0x5000);
+        for (size_t i = 0; i < contents.size(); i++) {
+            contents[i] = U8(i * 7 + 1);
+        }
+        std::ofstream(contents_path, std::ios::binary).write(reinterpret_cast<const char*>(contents.data()),
+                                                             std::streamsize(contents.size()));
+
+        std::vector<Inst> instructions(3);
+        instructions[1].opcode = Opcodes::HLT;
+        std::ofstream(instructions_path, std::ios::binary).write(reinterpret_cast<const char*>(instructions.data()),
+                                                                 std::streamsize(instructions.size() * sizeof(Inst)));
+
+        std::ofstream(map_path) << "0 10000 10003 400000 500000 0 0\n"
+                                << "3\n"
+                                << "400000 3000 1 0 2100\n"
+                                << "500000 3000 3 3000 1800\n"
+                                << "600000 1000 3 0 0\n"
+                                << "2\n";
+
+        std::unique_ptr<Mem::Memory> memory(load_memory(map_path, contents_path, instructions_path));
+        REQUIRE(memory != nullptr);
+
+        CHECK_EQ(memory->get_instructions().size(), 3);
+        CHECK_EQ(memory->fetch_instruction(0x10001).opcode, Opcodes::HLT);
+        CHECK_THROWS_AS((void) memory->fetch_instruction(0x10003), std::out_of_range);
+        CHECK_EQ(memory->get_RAM(), nullptr); // No RAM region in the table
+
+        CHECK_EQ(memory->read(0x400000, OpSize::B), contents[0]);
+        CHECK_EQ(memory->read(0x4020FF, OpSize::B), contents[0x20FF]);
+        CHECK_EQ(memory->read(0x402100, OpSize::B), 0);
+        CHECK_EQ(memory->read(0x500000, OpSize::B), contents[0x3000]);
+        CHECK_EQ(memory->read(0x5017FF, OpSize::B), contents[0x47FF]);
+        CHECK_EQ(memory->read(0x501800, OpSize::B), 0);
+
+        // Writes to the mapped pages are private
+        memory->write(0x500000, 0x12345678, OpSize::DW);
+        CHECK_EQ(memory->read(0x500000, OpSize::DW), 0x12345678);
+        memory.reset();
+
+        std::ifstream file(contents_path, std::ios::binary);
+        file.seekg(0x3000);
+        CHECK_EQ(file.get(), contents[0x3000]);
+
+        // Too few instructions in the file
+        std::ofstream(map_path) << "0 10000 10004 200000 300000 0 0\n";
+        CHECK_EQ(load_memory(map_path, contents_path, instructions_path), nullptr);
+
+        std::filesystem::remove_all(dir);
+    }
+
+    TEST_CASE("program_file")
+    {
+        const std::string path = (std::filesystem::temp_directory_path() / "mcx86_program_file.mcx86").string();
+
+        ProgramFile::ProgramContents program{
+            .entry_point = 0x10001,
+            .text_pos = 0x10000,
+            .instructions = std::vector<Inst>(2),
+            .layout = Mem::MemoryLayout::default_layout(0x200000),
+            .regions_contents = { { 1, 2, 3 }, std::vector<U8>(0x1234, 0xAA) },
+            .instructions_map = { { 0x8000, 0 }, { 0x8004, 1 } },
+            .symbols = { { 0x8000, "main" }, { 0x200000, "data" } },
+        };
+        program.instructions[1].opcode = Opcodes::HLT;
+        REQUIRE(ProgramFile::write(path, program));
+
+        {
+            auto reader = ProgramFile::Reader::open(path);
+            REQUIRE(reader != nullptr);
+            CHECK(reader->verify_checksums());
+            CHECK_EQ(reader->get_entry_point(), 0x10001);
+            for (const ProgramFile::SectionEntry& section : reader->get_sections()) {
+                CHECK_EQ(section.offset % ProgramFile::SECTION_ALIGNMENT, 0);
+            }
+
+            const auto map = reader->get_instructions_map();
+            CHECK_EQ(std::vector(map.begin(), map.end()), program.instructions_map);
+            CHECK_EQ(reader->get_symbols(), program.symbols);
+
+            std::unique_ptr<Mem::Memory> memory(reader->create_memory());
+            REQUIRE(memory != nullptr);
+            CHECK_EQ(memory->text_pos, 0x10000);
+            CHECK_EQ(memory->fetch_instruction(0x10001).opcode, Opcodes::HLT);
+            CHECK_EQ(memory->read(0x200000, OpSize::DW), 0x030201);
+            CHECK_EQ(memory->read(0x300000 + 0x1232, OpSize::DW), 0xAAAA);
+            CHECK_EQ(memory->stack_end, Mem::STACK_POS + Mem::STACK_SIZE);
+            CHECK_NE(memory->get_RAM(), nullptr);
+        }
+
+        // Corrupted contents are only detected by the checksums
+        {
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(ProgramFile::SECTION_ALIGNMENT * 2);
+            file.put(42);
+        }
+        auto reader = ProgramFile::Reader::open(path);
+        REQUIRE(reader != nullptr);
+        CHECK(!reader->verify_checksums());
+
+        // Corrupted header
+        {
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(offsetof(ProgramFile::Header, text_pos));
+            file.put(1);
+        }
+        CHECK_EQ(ProgramFile::Reader::open(path), nullptr);
+
+        std::ofstream(path) << "not a program";
+        CHECK_EQ(ProgramFile::Reader::open(path), nullptr);
+        CHECK_EQ(load_program_file(path), nullptr);
+
+        std::filesystem::remove(path);
+    }
+
+    TEST_CASE("packed_accessors")
+    {
+        U8 bytes[16] { };
+        Mem::Buffer<16, U8> buffer(bytes);
+
+        buffer.write<OpSize::DW>(4, 0x12345678);
+        CHECK_EQ(bytes[4], 0x78);
+        CHECK_EQ(bytes[7], 0x12);
+        CHECK_EQ(buffer.read<OpSize::W>(6), 0x1234);
+        CHECK_EQ(buffer.read<OpSize::B>(5), 0x56);
+        CHECK_EQ(buffer.read(4, OpSize::DW), 0x12345678);
+
+        // Only the lower bits are written
+        buffer.write<OpSize::W>(0, 0xAABBCCDD);
+        CHECK_EQ(buffer.read<OpSize::DW>(0), 0xCCDD);
+
+        CHECK_EQ(buffer.read_checked(12, OpSize::DW), 0);
+        CHECK_THROWS_AS((void) buffer.read_checked(13, OpSize::DW), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS(buffer.write_checked(15, 0, OpSize::W), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS(buffer.write_checked(0xFFFFFFFF, 0, OpSize::DW), Mem::WrongMemoryAccess);
+    }
+
+    TEST_CASE("block_copy")
+    {
+        U8 bytes[16] { };
+        Mem::Buffer<16, U8> buffer(bytes);
+
+        const U8 data[5] { 1, 2, 3, 4, 5 };
+        buffer.write_block(10, data, 5);
+        CHECK_EQ(buffer.read<OpSize::DW>(10), 0x04030201);
+
+        U8 copy[5] { };
+        buffer.read_block(10, copy, 5);
+        CHECK_EQ(std::memcmp(copy, data, 5), 0);
+
+        CHECK_THROWS_AS(buffer.write_block(12, data, 5), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS(buffer.read_block(16, copy, 1), Mem::WrongMemoryAccess);
+    }
+}
@@ -5,11 +5,19 @@
 #include <ranges>
 #include <iostream>
 #include <limits>
+#include <sstream>
+#include <thread>
 
 #include "CPU/CPU.h"
 #include "CPU/instructions.h"
 #include "CPU/opcodes.h"
 #include "memory/memory_manager.hpp"
+#include "logger.h"
+
+
+const U32 test_text_pos = 0x10000;
+const U32 test_rom_pos = 0x200000;
+const U32 test_ram_pos = test_rom_pos + Mem::ROM_SIZE;
 
 
 template<typename Iter>
@@ -17,22 +25,21 @@ Mem::Memory* create_memory(Iter start, Iter end)
 {
     std::vector<Inst> instructions_cpy(start, end);
 
-    const U32 text_pos = 0x10000;
-    const U32 rom_pos = 0x200000;
+    const U32 text_pos = test_text_pos;
+    const U32 rom_pos = test_rom_pos;
 
-    U8* rom = new U8[Mem::ROM_SIZE] { };
-    U8* ram = new U8[Mem::RAM_SIZE] { };
-
-    Mem::Memory* memory = new Mem::Memory(text_pos, instructions_cpy.size() * sizeof(Inst), instructions_cpy,
-                                          rom_pos, rom, ram);
+    Mem::Memory* memory = new Mem::Memory(text_pos, instructions_cpy.size() * sizeof(Inst), instructions_cpy, rom_pos);
 
     return memory;
 }
 
 
-TEST_CASE("EFLAGS")
+/**
+ * Instructions with the flags they should set: name, flags, initial value of EAX, instruction, expected EAX.
+ */
+auto EFLAGS_tests()
 {
-    const std::array instructions_tests{
+    return std::array{
         std::make_tuple(
             "ADD 2,-7", EFLAGS::SF,
             0x2,
@@ -138,10 +145,16 @@ TEST_CASE("EFLAGS")
             static_cast<U32>(std::numeric_limits<I32>::min())
         )
     };
+}
+
+
+TEST_CASE_TEMPLATE("EFLAGS", ALU_t, CircuitALU, NativeALU)
+{
+    const auto instructions_tests = EFLAGS_tests();
 
     auto instructions = instructions_tests | std::views::elements<3>;
     Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
-    CPU cpu(memory);
+    CPU<ALU_t> cpu(memory);
 
     Registers& registers = cpu.get_registers();
     int i = 0;
@@ -169,3 +182,765 @@ TEST_CASE("EFLAGS")
 
     delete memory;
 }
+
+
+/**
+ * EAX = 5 + 3 + 2 + 1, stored in RAM
+ */
+std::vector<Inst> simple_loop_program()
+{
+    const U32 text_pos = test_text_pos;
+    const U32 ram_pos = test_ram_pos;
+
+    return {
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .write_ret1_to_op1 = true,
+            .immediate_value = 5,
+        },
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::REG, .reg = Register::ECX },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .write_ret1_to_op1 = true,
+            .immediate_value = 3,
+        },
+        Inst{
+            .opcode = Opcodes::ADD,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .op2 = { .type = OpType::REG, .reg = Register::ECX, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+        },
+        Inst{
+            .opcode = Opcodes::SUB,
+            .op1 = { .type = OpType::REG, .reg = Register::ECX, .read = true },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+            .immediate_value = 1,
+        },
+        Inst{
+            .opcode = Opcodes::Jcc,
+            .op1 = { .type = OpType::IMM_MEM, .read = true },
+            .get_flags = true,
+            .address_value = text_pos + 2,
+            .immediate_value = 0b00101, // JNZ
+        },
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::MEM },
+            .op2 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .write_ret1_to_op1 = true,
+            .address_value = ram_pos,
+        },
+        Inst{
+            .opcode = Opcodes::HLT,
+        },
+    };
+}
+
+
+TEST_CASE_TEMPLATE("simple_loop", ALU_t, CircuitALU, NativeALU)
+{
+    const U32 text_pos = test_text_pos;
+    const U32 ram_pos = test_ram_pos;
+
+    const std::vector<Inst> instructions = simple_loop_program();
+    Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+    CPU<ALU_t> cpu(memory);
+
+    // [MOV, MOV] [ADD, SUB, Jcc] [MOV, HLT]
+    CHECK_EQ(cpu.get_basic_blocks_count(), 3);
+    CHECK_EQ(cpu.get_fused_pairs_count(), 1);
+
+    cpu.startup();
+
+    SUBCASE("until halt") {
+        cpu.run(100);
+
+        CHECK(cpu.is_halted());
+        CHECK_EQ(cpu.get_registers().read(Register::EAX), 11);
+        CHECK_EQ(cpu.get_registers().read(Register::ECX), 0);
+        CHECK_EQ(cpu.get_memory().read(ram_pos, OpSize::DW), 11);
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 * 3 + 2);
+    }
+
+    SUBCASE("max cycles in the middle of a block") {
+        // Stops after the ADD of the second iteration
+        cpu.run(2 + 3 + 1);
+
+        CHECK(!cpu.is_halted());
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 + 1);
+        CHECK_EQ(cpu.get_registers().EIP, text_pos + 3);
+        CHECK_EQ(cpu.get_registers().read(Register::EAX), 5 + 3 + 2);
+
+        // Resumes in the middle of the block
+        cpu.run(100);
+
+        CHECK(cpu.is_halted());
+        CHECK_EQ(cpu.get_registers().read(Register::EAX), 11);
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 * 3 + 2);
+    }
+
+    SUBCASE("max cycles between a fused pair") {
+        // Stops after the SUB of the first iteration, the Jcc must not be executed
+        cpu.run(2 + 2);
+
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 2);
+        CHECK_EQ(cpu.get_registers().EIP, text_pos + 4);
+        CHECK_EQ(cpu.get_registers().read(Register::ECX), 2);
+
+        cpu.run(100);
+
+        CHECK(cpu.is_halted());
+        CHECK_EQ(cpu.get_registers().read(Register::EAX), 11);
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 * 3 + 2);
+    }
+
+    SUBCASE("snapshot and restore") {
+        cpu.get_memory().write(ram_pos, 42, OpSize::DW);
+        cpu.run(2 + 3 + 1);
+        cpu.write_io(127, 0x24, OpSize::B); // Last byte of the IO buffer
+        cpu.snapshot();
+
+        cpu.write_io(127, 0x99, OpSize::B);
+        cpu.run(100);
+        CHECK(cpu.is_halted());
+        CHECK_EQ(cpu.get_memory().read(ram_pos, OpSize::DW), 11);
+        CHECK_EQ(cpu.get_memory().get_snapshot_dirty_pages_count(), 1);
+
+        for (int i = 0; i < 2; i++) {
+            cpu.restore();
+            CHECK(!cpu.is_halted());
+            CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 + 1);
+            CHECK_EQ(cpu.get_registers().EIP, text_pos + 3);
+            CHECK_EQ(cpu.get_registers().read(Register::EAX), 5 + 3 + 2);
+            CHECK_EQ(cpu.get_memory().read(ram_pos, OpSize::DW), 42);
+            CHECK_EQ(cpu.get_memory().get_snapshot_dirty_pages_count(), 0);
+            CHECK_EQ(cpu.read_io(127, OpSize::B), 0x24);
+
+            cpu.run(100);
+            CHECK(cpu.is_halted());
+            CHECK_EQ(cpu.get_registers().read(Register::EAX), 11);
+            CHECK_EQ(cpu.get_memory().read(ram_pos, OpSize::DW), 11);
+            CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 * 3 + 2);
+        }
+    }
+
+    SUBCASE("watchpoints") {
+        const Fault& fault = cpu.get_fault();
+        cpu.get_memory().add_watchpoint(ram_pos, 4, Mem::WATCH_WRITE);
+        const U32 exec_id = cpu.get_memory().add_watchpoint(text_pos + 3, 1, Mem::WATCH_EXEC);
+
+        // Stops before each SUB, and continues from it
+        for (U32 i = 0; i < 3; i++) {
+            cpu.run(100);
+            REQUIRE_EQ(fault.kind, FaultKind::Watchpoint);
+            CHECK_EQ(fault.watchpoint.kind, Mem::WATCH_EXEC);
+            CHECK_EQ(fault.watchpoint.instruction, 3);
+            CHECK_EQ(cpu.get_registers().EIP, text_pos + 3);
+            CHECK_EQ(cpu.get_registers().read(Register::ECX), 3 - i);
+        }
+        cpu.get_memory().remove_watchpoint(exec_id);
+
+        // Stops after the write to the RAM
+        cpu.run_threaded(100);
+        REQUIRE_EQ(fault.kind, FaultKind::Watchpoint);
+        CHECK_EQ(fault.watchpoint.kind, Mem::WATCH_WRITE);
+        CHECK_EQ(fault.watchpoint.instruction, 5);
+        CHECK_EQ(fault.address, ram_pos);
+        CHECK_EQ(fault.watchpoint.size, 4);
+        CHECK_EQ(fault.watchpoint.old_value, 0);
+        CHECK_EQ(fault.watchpoint.new_value, 11);
+        CHECK(!cpu.is_halted());
+        CHECK_EQ(cpu.get_memory().read(ram_pos, OpSize::DW), 11);
+
+        cpu.run(100);
+        CHECK(cpu.is_halted());
+        CHECK(!fault.is_set());
+        CHECK_EQ(cpu.get_clock_cycle(), 2 + 3 * 3 + 2);
+    }
+
+    delete memory;
+}
+
+
+/**
+ * Bitwise operations, comparisons and the carry flag of SUB, which is never cleared by the circuit.
+ */
+std::vector<Inst> logic_program()
+{
+    auto reg_imm = [](U8 opcode, Register reg, U32 imm, bit get_flags, bit write = true) {
+        return Inst{
+            .opcode = opcode,
+            .op1 = { .type = OpType::REG, .reg = reg, .read = opcode != Opcodes::MOV },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = get_flags,
+            .write_ret1_to_op1 = write,
+            .immediate_value = imm,
+        };
+    };
+
+    auto reg_reg = [](U8 opcode, Register reg_1, Register reg_2, bit get_flags, bit write = true) {
+        return Inst{
+            .opcode = opcode,
+            .op1 = { .type = OpType::REG, .reg = reg_1, .read = true },
+            .op2 = { .type = OpType::REG, .reg = reg_2, .read = true },
+            .get_flags = get_flags,
+            .write_ret1_to_op1 = write,
+        };
+    };
+
+    return {
+        reg_imm(Opcodes::MOV, Register::EAX, 0xF0F0F0F0, false),
+        reg_imm(Opcodes::MOV, Register::EBX, 0x0FF00FF0, false),
+        reg_reg(Opcodes::AND, Register::EAX, Register::EBX, true),
+        reg_imm(Opcodes::OR, Register::EBX, 0x80000000, true),
+        reg_reg(Opcodes::TEST, Register::EAX, Register::EBX, true, false),
+        reg_imm(Opcodes::MOV, Register::ECX, 5, false),
+        reg_imm(Opcodes::CMP, Register::ECX, 7, true, false),
+        reg_imm(Opcodes::SUB, Register::ECX, 1, true),
+        reg_reg(Opcodes::XOR, Register::EAX, Register::ECX, true),
+        reg_reg(Opcodes::ADD, Register::EDX, Register::EAX, false),
+        reg_imm(Opcodes::ADD, Register::EAX, 0xFFFFFFFF, true),
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::MEM },
+            .op2 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .write_ret1_to_op1 = true,
+            .address_value = test_ram_pos,
+        },
+        Inst{
+            .opcode = Opcodes::HLT,
+        },
+    };
+}
+
+
+/**
+ * Writes to the ROM in the middle of a block.
+ */
+std::vector<Inst> fault_program()
+{
+    return {
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .write_ret1_to_op1 = true,
+            .immediate_value = 1,
+        },
+        Inst{
+            .opcode = Opcodes::ADD,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+            .immediate_value = 2,
+        },
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::MEM },
+            .op2 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .write_ret1_to_op1 = true,
+            .address_value = test_rom_pos,
+        },
+        Inst{
+            .opcode = Opcodes::HLT,
+        },
+    };
+}
+
+
+/**
+ * The adjust flag of an ADD is kept by the following AND, then all flags are read by LAHF.
+ */
+std::vector<Inst> adjust_flag_program()
+{
+    return {
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .write_ret1_to_op1 = true,
+            .immediate_value = 0x0F,
+        },
+        Inst{
+            .opcode = Opcodes::ADD,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+            .immediate_value = 1,
+        },
+        Inst{
+            .opcode = Opcodes::AND,
+            .op1 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+            .immediate_value = 0x30,
+        },
+        Inst{
+            .opcode = Opcodes::LAHF,
+            .op1 = { .type = OpType::REG, .reg = Register::ECX },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+        },
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::MEM },
+            .op2 = { .type = OpType::REG, .reg = Register::ECX, .read = true },
+            .write_ret1_to_op1 = true,
+            .address_value = test_ram_pos,
+        },
+        Inst{
+            .opcode = Opcodes::HLT,
+        },
+    };
+}
+
+
+/**
+ * ECX = 3, decremented until zero, with a conditional exit and an unconditional jump back.
+ */
+std::vector<Inst> countdown_program()
+{
+    const U32 text_pos = test_text_pos;
+
+    return {
+        Inst{
+            .opcode = Opcodes::MOV,
+            .op1 = { .type = OpType::REG, .reg = Register::ECX },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .write_ret1_to_op1 = true,
+            .immediate_value = 3,
+        },
+        Inst{
+            .opcode = Opcodes::SUB,
+            .op1 = { .type = OpType::REG, .reg = Register::ECX, .read = true },
+            .op2 = { .type = OpType::IMM, .read = true },
+            .get_flags = true,
+            .write_ret1_to_op1 = true,
+            .immediate_value = 1,
+        },
+        Inst{
+            .opcode = Opcodes::Jcc,
+            .op1 = { .type = OpType::IMM_MEM, .read = true },
+            .get_flags = true,
+            .address_value = text_pos + 4,
+            .immediate_value = 0b00100, // JZ
+        },
+        Inst{
+            .opcode = Opcodes::JMP,
+            .op1 = { .type = OpType::IMM_MEM, .read = true },
+            .address_value = text_pos + 1,
+        },
+        Inst{
+            .opcode = Opcodes::HLT,
+        },
+    };
+}
+
+
+/**
+ * Configuration of the tested CPU. Macro fusion is always enabled.
+ */
+struct LockstepOptions
+{
+    bit jit = false; // Compile all blocks
+    bit lazy_flags = false;
+    bit flags_liveness = false;
+    bit threaded = false; // Use CPU::run_threaded()
+    bit fault_status = false; // Don't throw faults
+};
+
+
+/**
+ * Runs the program with the plain interpreter and with the tested configuration, stopping at each cycle, and checks
+ * that both CPUs have the same state each time.
+ * Dead flags are not computed with the flags liveness, therefore the flags are then only compared at the end.
+ */
+void check_lockstep(const std::vector<Inst>& instructions, U32 initial_EAX, const LockstepOptions& options)
+{
+    Mem::Memory* reference_memory = create_memory(instructions.begin(), instructions.end());
+    Mem::Memory* tested_memory = create_memory(instructions.begin(), instructions.end());
+
+    CPU reference(reference_memory);
+    CPU tested(tested_memory);
+    reference.set_macro_fusion(false);
+    tested.set_jit_enabled(options.jit, 0);
+    tested.set_lazy_flags(options.lazy_flags);
+    tested.set_flags_liveness(options.flags_liveness);
+    tested.set_throw_faults(!options.fault_status);
+
+    for (size_t max_cycles = 1; max_cycles < 1000; max_cycles++) {
+        for (CPU<>* cpu : { &reference, &tested }) {
+            cpu->startup();
+            cpu->get_registers().write(Register::EAX, initial_EAX);
+        }
+
+        reference.run(max_cycles);
+        if (options.threaded) {
+            tested.run_threaded(max_cycles);
+        }
+        else {
+            tested.run(max_cycles);
+        }
+
+        CAPTURE(max_cycles);
+
+        const Registers& expected = reference.get_registers();
+        const Registers& actual = tested.get_registers();
+        for (int i = 0; i < 8; i++) {
+            CHECK_EQ(actual.registers[i], expected.registers[i]);
+        }
+        CHECK_EQ(actual.EIP, expected.EIP);
+        if (!options.flags_liveness || reference.is_halted()) {
+            CHECK_EQ(actual.flags.value, expected.flags.value);
+        }
+        CHECK_EQ(tested.get_clock_cycle(), reference.get_clock_cycle());
+        CHECK_EQ(tested.is_halted(), reference.is_halted());
+        CHECK_EQ(tested.get_memory().read(test_ram_pos, OpSize::DW), reference.get_memory().read(test_ram_pos, OpSize::DW));
+
+        if (reference.get_clock_cycle() < max_cycles) {
+            // The program stopped by itself
+            break;
+        }
+    }
+
+    if (options.jit && JIT::is_available()) {
+        CHECK_GT(tested.get_jit()->get_compiled_blocks_count(), 0);
+    }
+
+    delete reference_memory;
+    delete tested_memory;
+}
+
+
+void check_lockstep_programs(const LockstepOptions& options)
+{
+    SUBCASE("EFLAGS") {
+        for (const auto& [test_name, _, first_value, inst, __] : EFLAGS_tests()) {
+            CAPTURE(test_name);
+            check_lockstep({ inst, Inst{ .opcode = Opcodes::HLT } }, first_value, options);
+        }
+    }
+
+    SUBCASE("simple_loop") {
+        check_lockstep(simple_loop_program(), 0, options);
+    }
+
+    SUBCASE("logic") {
+        check_lockstep(logic_program(), 0, options);
+    }
+
+    SUBCASE("fault") {
+        check_lockstep(fault_program(), 0, options);
+    }
+
+    SUBCASE("countdown") {
+        check_lockstep(countdown_program(), 0, options);
+    }
+
+    SUBCASE("adjust flag") {
+        check_lockstep(adjust_flag_program(), 0, options);
+    }
+}
+
+
+TEST_CASE("macro fusion lockstep")
+{
+    check_lockstep_programs({});
+}
+
+
+TEST_CASE("JIT lockstep")
+{
+    check_lockstep_programs({ .jit = true });
+}
+
+
+TEST_CASE("lazy flags lockstep")
+{
+    check_lockstep_programs({ .lazy_flags = true });
+}
+
+
+TEST_CASE("lazy flags with JIT lockstep")
+{
+    check_lockstep_programs({ .jit = true, .lazy_flags = true });
+}
+
+
+TEST_CASE("flags liveness lockstep")
+{
+    SUBCASE("interpreter") {
+        check_lockstep_programs({ .flags_liveness = true });
+    }
+
+    SUBCASE("lazy flags with JIT") {
+        check_lockstep_programs({ .jit = true, .lazy_flags = true, .flags_liveness = true });
+    }
+}
+
+
+TEST_CASE("threaded interpreter lockstep")
+{
+    SUBCASE("interpreter") {
+        check_lockstep_programs({ .threaded = true });
+    }
+
+    SUBCASE("lazy flags and flags liveness") {
+        check_lockstep_programs({ .lazy_flags = true, .flags_liveness = true, .threaded = true });
+    }
+}
+
+
+TEST_CASE("fault status lockstep")
+{
+    SUBCASE("interpreter") {
+        check_lockstep_programs({ .fault_status = true });
+    }
+
+    SUBCASE("JIT") {
+        check_lockstep_programs({ .jit = true, .fault_status = true });
+    }
+
+    SUBCASE("threaded") {
+        check_lockstep_programs({ .threaded = true, .fault_status = true });
+    }
+}
+
+
+TEST_CASE("fault status")
+{
+    SUBCASE("memory access") {
+        const std::vector<Inst> instructions = fault_program();
+        Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+        CPU cpu(memory);
+        cpu.set_throw_faults(false);
+        cpu.startup();
+
+        cpu.run(100);
+
+        const Fault& fault = cpu.get_fault();
+        CHECK_EQ(fault.kind, FaultKind::MemoryAccess);
+        CHECK_EQ(fault.address, test_rom_pos);
+        CHECK_EQ(fault.format(), std::string(Mem::WrongMemoryAccess("ROM is read-only.", test_rom_pos).what()));
+        CHECK_THROWS_AS(fault.raise(), Mem::WrongMemoryAccess);
+
+        CHECK(!cpu.is_halted());
+        CHECK_EQ(cpu.get_clock_cycle(), 3);
+
+        // The fault is cleared at startup
+        cpu.startup();
+        CHECK(!cpu.get_fault().is_set());
+
+        delete memory;
+    }
+
+    SUBCASE("divide error") {
+        const std::vector<Inst> instructions{
+            Inst{
+                .opcode = Opcodes::MOV,
+                .op1 = { .type = OpType::REG, .reg = Register::EAX },
+                .op2 = { .type = OpType::IMM, .read = true },
+                .write_ret1_to_op1 = true,
+                .immediate_value = 10,
+            },
+            Inst{
+                .opcode = Opcodes::DIV,
+                .op1 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+                .op2 = { .type = OpType::REG, .reg = Register::ECX, .read = true },
+                .write_ret1_to_op1 = true,
+            },
+            Inst{
+                .opcode = Opcodes::HLT,
+            },
+        };
+        Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+        CPU cpu(memory);
+        cpu.set_throw_faults(false);
+        cpu.startup();
+
+        cpu.run(100);
+
+        const Fault& fault = cpu.get_fault();
+        CHECK_EQ(fault.kind, FaultKind::Processor);
+        CHECK_EQ(fault.vector, Interrupts::DivideError.vector);
+        CHECK_EQ(fault.format(), std::string(ProcessorException("#DE", test_text_pos + 1, 0).what()));
+
+        // The result is not written, and EIP stays at the faulting instruction
+        CHECK_EQ(cpu.get_registers().read(Register::EAX), 10);
+        CHECK_EQ(cpu.get_registers().EIP, test_text_pos + 1);
+        CHECK(!cpu.is_halted());
+
+        delete memory;
+    }
+
+    SUBCASE("IO access") {
+        // The last double word of the IO buffer can be written, but not one ending after it
+        const U32 last_port = 127;
+        const std::vector<Inst> instructions{
+            Inst{
+                .opcode = Opcodes::OUT,
+                .op1 = { .type = OpType::IMM, .read = true },
+                .op2 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+                .immediate_value = last_port - 3,
+            },
+            Inst{
+                .opcode = Opcodes::OUT,
+                .op1 = { .type = OpType::IMM, .read = true },
+                .op2 = { .type = OpType::REG, .reg = Register::EAX, .read = true },
+                .immediate_value = last_port - 1,
+            },
+            Inst{
+                .opcode = Opcodes::HLT,
+            },
+        };
+        Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+        CPU cpu(memory);
+        cpu.set_throw_faults(false);
+        cpu.startup();
+
+        cpu.run(100);
+
+        const Fault& fault = cpu.get_fault();
+        CHECK_EQ(fault.kind, FaultKind::MemoryAccess);
+        CHECK_EQ(fault.address, last_port - 1);
+        CHECK_EQ(fault.format(), std::string(Mem::WrongMemoryAccess("Address out of bounds.", last_port - 1).what()));
+        CHECK_EQ(cpu.get_registers().EIP, test_text_pos + 1);
+        CHECK_EQ(cpu.get_clock_cycle(), 2);
+
+        cpu.set_throw_faults(true);
+        cpu.startup();
+        CHECK_THROWS_AS(cpu.write_io(last_port - 1, 0, OpSize::DW), Mem::WrongMemoryAccess);
+        CHECK_THROWS_AS((void) cpu.read_io(last_port, OpSize::W), Mem::WrongMemoryAccess);
+        cpu.write_io(last_port, 0x42, OpSize::B);
+        CHECK_EQ(cpu.read_io(last_port, OpSize::B), 0x42);
+
+        delete memory;
+    }
+}
+
+
+TEST_CASE("unknown opcodes")
+{
+    // Outside of the arithmetic and non-arithmetic ranges, and in the jumps group without a matching instruction
+    for (U8 opcode : { U8(Opcodes::MULX + 1), U8(Opcodes::WAIT + 1), U8(Opcodes::RET + 1) }) {
+        const std::vector<Inst> instructions{ Inst{ .opcode = opcode } };
+        Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+        CPU cpu(memory);
+        cpu.startup();
+
+        CHECK_THROWS_AS(cpu.execute_instruction(), UnknownInstruction);
+
+        // The threaded interpreter stops at the instruction
+        cpu.startup();
+        cpu.run_threaded(100);
+        CHECK_EQ(cpu.get_clock_cycle(), 1);
+        CHECK_EQ(cpu.get_registers().EIP, test_text_pos);
+
+        delete memory;
+    }
+}
+
+
+TEST_CASE("flags liveness")
+{
+    const std::vector<Inst> instructions = simple_loop_program();
+    Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+    CPU cpu(memory);
+
+    CHECK_EQ(cpu.get_eliminated_flags_count(), 0);
+
+    cpu.set_flags_liveness(true);
+
+    // The flags of the ADD are overwritten by the SUB, except the carry flag which is only set by the SUB
+    CHECK_EQ(cpu.get_eliminated_flags_count(), 5);
+
+    cpu.set_flags_liveness(false);
+    CHECK_EQ(cpu.get_eliminated_flags_count(), 0);
+
+    delete memory;
+}
+
+
+TEST_CASE("shared program image")
+{
+    std::vector<Inst> instructions = simple_loop_program();
+    std::vector<std::vector<U8>> contents{ { 1, 2, 3, 4 }, { 42 } };
+    auto image = std::make_shared<const Mem::ProgramImage>(test_text_pos, instructions.size() * sizeof(Inst),
+                                                           std::move(instructions),
+                                                           Mem::MemoryLayout::default_layout(test_rom_pos),
+                                                           std::move(contents));
+
+    // Each thread runs the program in its own memory
+    std::vector<std::unique_ptr<Mem::Memory>> memories;
+    std::vector<U32> results(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); i++) {
+        memories.push_back(std::make_unique<Mem::Memory>(image));
+        threads.emplace_back([&memory = *memories.back(), &result = results[i]]() {
+            CHECK_EQ(memory.read(test_ram_pos, OpSize::DW), 42);
+
+            CPU cpu(&memory);
+            cpu.startup();
+            cpu.run(100);
+            result = cpu.is_halted() ? memory.read(test_ram_pos, OpSize::DW) : 0;
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    for (U32 result : results) {
+        CHECK_EQ(result, 11);
+    }
+
+    // The ROM is shared, the RAM is not
+    CHECK_EQ(memories[0]->get_region_bytes(0), memories[1]->get_region_bytes(0));
+    CHECK_NE(memories[0]->get_region_bytes(1), memories[1]->get_region_bytes(1));
+    CHECK_EQ(memories[0]->read(test_rom_pos, OpSize::DW), 0x04030201);
+    CHECK_EQ(image.use_count(), 1 + memories.size());
+
+    Mem::Memory new_memory(image);
+    CHECK_EQ(new_memory.read(test_ram_pos, OpSize::DW), 42);
+    CHECK_EQ(new_memory.get_instructions().data(), memories[0]->get_instructions().data());
+}
+
+
+#if MCX86_LOG_LEVEL >= MCX86_LOG_LEVEL_DEBUG
+TEST_CASE("binary log sink")
+{
+    const std::vector<Inst> instructions = simple_loop_program();
+    Mem::Memory* memory = create_memory(instructions.begin(), instructions.end());
+    CPU cpu(memory);
+    cpu.startup();
+
+    BinaryLogSink sink;
+    Logger::set_binary_sink(&sink);
+    Logger::set_mode(Logger::Mode::DEBUG);
+
+    cpu.run(100);
+
+    Logger::set_mode(Logger::Mode::OFF);
+    Logger::set_binary_sink(nullptr);
+
+    const std::vector<LogRecord>& records = sink.get_records();
+    REQUIRE(!records.empty());
+    CHECK_EQ(records[0].event, LogEvent::Block);
+    CHECK_EQ(records[0].arg_1, 1);
+    CHECK_EQ(records[0].arg_2, test_text_pos);
+
+    std::ostringstream text;
+    sink.print(text);
+    CHECK_EQ(text.str().substr(0, 26), "Cycle 1: block at 0x10000\n");
+
+    delete memory;
+}
+#endif